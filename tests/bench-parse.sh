@@ -0,0 +1,36 @@
+#!/bin/sh
+# usage: bench-parse.sh TURTLE [MEGABYTES] [THREADS]
+# benchmark of the parser, not run by ctest : generate a program of MEGABYTES
+# (1024 by default) and time its parse with --estimate, from the file which
+# is mapped in memory, from stdin which is read through stdio, and from the
+# file by parts with THREADS threads (4 by default)
+
+turtle=$1
+megabytes=${2:-1024}
+threads=${3:-4}
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+# lines of about 100 bytes, so that the time goes to the scan more than to the tree
+awk -v size=$((megabytes * 1048576)) 'BEGIN {
+    for (n = 0; n < size; n += length(line) + 1) {
+        line = sprintf("position %d.%030d, %d.%030d", n % 1000, n, n % 997, n)
+        print line
+    }
+}' > "$dir/big.turtle"
+ls -l "$dir/big.turtle"
+
+# the time of a command, in milliseconds
+run() {
+    start=$(date +%s%N)
+    "$@" > "$dir/estimate" 2>&1 || { cat "$dir/estimate"; exit 1; }
+    end=$(date +%s%N)
+    echo $(( (end - start) / 1000000 ))
+}
+
+# the file is read once first, so that every parse finds it in the page cache
+cat "$dir/big.turtle" > /dev/null
+echo "mmap : $(run "$turtle" --estimate "$dir/big.turtle") ms"
+echo "stdio : $(run sh -c '"$1" --estimate < "$2"' sh "$turtle" "$dir/big.turtle") ms"
+echo "mmap, $threads threads : $(run "$turtle" --parse-threads "$threads" --estimate "$dir/big.turtle") ms"
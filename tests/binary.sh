@@ -0,0 +1,73 @@
+#!/bin/sh
+# usage: binary.sh TURTLE PROGRAM...
+# write each program in the binary format, at the default grid and at the
+# grid 1000000, decode it and compare it to the text format : the same lines,
+# the same operations, the values which are not numbers kept as they are and
+# the numbers within half a step of the grid, plus the last digit of %f
+
+turtle=$1
+shift
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+failed=0
+for program in "$@"; do
+    "$turtle" --seed 1 "$program" > "$dir/text" 2> /dev/null
+    for grid in 1000 1000000; do
+        "$turtle" --seed 1 --format binary --grid $grid --output "$dir/binary" "$program" 2> /dev/null
+        if ! "$turtle" --decode "$dir/binary" > "$dir/decoded"; then
+            echo "$program : the grid $grid can not be decoded"
+            failed=1
+            continue
+        fi
+        if ! awk -v grid=$grid -v text="$dir/text" '
+            function number(s) {
+                return s ~ /^-?[0-9]+\.[0-9]+$/
+            }
+            {
+                if ((getline line < text) <= 0) {
+                    print "line " NR " : more lines than the text"
+                    bad = 1
+                    exit 1
+                }
+                n = split(line, field, " ")
+                if (n != NF || field[1] != $1) {
+                    print "line " NR " : " $0 " instead of " line
+                    bad = 1
+                    exit 1
+                }
+                for (i = 2; i <= NF; i++) {
+                    if (number(field[i]) && number($i)) {
+                        d = field[i] - $i
+                        if (d < 0) {
+                            d = -d
+                        }
+                        if (d > 0.5 / grid + 0.0000011) {
+                            print "line " NR " : " $0 " instead of " line
+                            bad = 1
+                    exit 1
+                        }
+                    } else if (field[i] != $i) {
+                        print "line " NR " : " $0 " instead of " line
+                        bad = 1
+                    exit 1
+                    }
+                }
+            }
+            END {
+                if (bad) {
+                    exit 1
+                }
+                if ((getline line < text) > 0) {
+                    print "line " NR + 1 " : less lines than the text"
+                    exit 1
+                }
+            }' "$dir/decoded"; then
+            echo "$program : the grid $grid does not decode to the text"
+            failed=1
+        fi
+    done
+done
+
+exit $failed
@@ -0,0 +1,84 @@
+#!/bin/sh
+# usage: compress.sh TURTLE PROGRAM...
+# compress the output of each program and of a program writing several blocks,
+# and check that it decompresses to the same bytes with 1 and 4 threads. then
+# check that a truncated or corrupted file fails with an error, and that a
+# byte changed anywhere does not crash the decompression
+
+turtle=$1
+shift
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+# more than COMPRESS_BLOCK_SIZE bytes of output, with random values
+echo "repeat 100000 { fw random(0, 100) left 1.7 }" > "$dir/big.turtle"
+
+failed=0
+for program in "$@" "$dir/big.turtle"; do
+    "$turtle" --seed 1 "$program" > "$dir/text" 2> /dev/null
+    "$turtle" --seed 1 --compress --output "$dir/compressed" "$program" 2> /dev/null
+    for threads in 1 4; do
+        if ! "$turtle" --threads $threads --decompress "$dir/compressed" > "$dir/decompressed" \
+            || ! cmp -s "$dir/text" "$dir/decompressed"; then
+            echo "$program : the decompression with $threads threads differs from the output"
+            failed=1
+        fi
+    done
+done
+
+size=$(wc -c < "$dir/text")
+if [ "$size" -le 262144 ]; then
+    echo "the output of the big program takes only one block : $size bytes"
+    failed=1
+fi
+
+# change the byte at an offset of the compressed file
+patch() {
+    cp "$dir/compressed" "$dir/corrupted"
+    printf "$2" | dd of="$dir/corrupted" bs=1 seek="$1" conv=notrunc 2> /dev/null
+}
+
+# the decompression of the corrupted file must fail with an error
+corrupted() {
+    for threads in 1 4; do
+        "$turtle" --threads $threads --decompress "$dir/corrupted" > /dev/null 2> "$dir/error"
+        status=$?
+        if [ $status -ne 1 ] || ! grep -q "^Error : " "$dir/error"; then
+            echo "$1 : exit status $status with $threads threads"
+            cat "$dir/error"
+            failed=1
+        fi
+    done
+}
+
+size=$(wc -c < "$dir/compressed")
+head -c $((size / 2)) "$dir/compressed" > "$dir/corrupted"
+corrupted "truncated in the middle"
+head -c $((size - 8)) "$dir/compressed" > "$dir/corrupted"
+corrupted "truncated before the end of the index"
+{ cat "$dir/compressed"; printf 'x'; } > "$dir/corrupted"
+corrupted "a byte after the index"
+patch 0 'X'
+corrupted "bad magic"
+patch 12 '\377'
+corrupted "bad size of the first block"
+patch $((size - 8)) '\377'
+corrupted "bad number of blocks in the index"
+patch $((size - 20)) '\377'
+corrupted "bad size in the index"
+
+# a changed byte of the data may not be seen, but it must not crash
+for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15; do
+    patch $((size * i / 16)) '\125'
+    for threads in 1 4; do
+        "$turtle" --threads $threads --decompress "$dir/corrupted" > /dev/null 2>&1
+        status=$?
+        if [ $status -gt 1 ]; then
+            echo "byte $((size * i / 16)) changed : exit status $status with $threads threads"
+            failed=1
+        fi
+    done
+done
+
+exit $failed
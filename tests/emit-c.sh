@@ -0,0 +1,40 @@
+#!/bin/sh
+# usage: emit-c.sh TURTLE CC PROGRAM...
+# translate each program to C with --emit-c, compile it with CC and check
+# that it gives the same output, errors and exit status as the interpreter
+# with the same seed
+
+turtle=$1
+cc=$2
+shift 2
+
+seed=42
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+failed=0
+for program in "$@"; do
+    name=$(basename "$program" .turtle)
+    if ! "$turtle" --emit-c --output "$dir/$name.c" "$program"; then
+        echo "$program : --emit-c failed"
+        failed=1
+        continue
+    fi
+    if ! "$cc" -std=c99 -O2 -o "$dir/$name" "$dir/$name.c" -lm -lpthread; then
+        echo "$program : the emitted C does not compile"
+        failed=1
+        continue
+    fi
+
+    "$turtle" --seed $seed "$program" > "$dir/$name.expected" 2> "$dir/$name.expected.err"
+    echo "exit $?" >> "$dir/$name.expected"
+    "$dir/$name" --seed $seed > "$dir/$name.actual" 2> "$dir/$name.actual.err"
+    echo "exit $?" >> "$dir/$name.actual"
+
+    if ! diff -u "$dir/$name.expected" "$dir/$name.actual" || ! diff -u "$dir/$name.expected.err" "$dir/$name.actual.err"; then
+        echo "$program : the emitted C differs from the interpreter"
+        failed=1
+    fi
+done
+
+exit $failed
@@ -0,0 +1,12 @@
+#!/bin/sh
+# usage: expect.sh TURTLE PROGRAM EXPECTED [OPTION...]
+# evaluate the program with the options and compare its output and its errors,
+# followed by the line "exit N" with its exit status, to the expected file
+
+turtle=$1
+program=$2
+expected=$3
+shift 3
+
+actual=$("$turtle" "$@" "$program" 2>&1; echo "exit $?")
+printf '%s\n' "$actual" | diff -u "$expected" - || exit 1
@@ -0,0 +1,38 @@
+#!/bin/sh
+# usage: parse-big.sh TURTLE
+# parse a flat program of 10 million commands with a small stack, and check
+# that it takes about 10 times as long as a program of 1 million commands :
+# the sequences must not grow the parser or the C stack, nor take quadratic time
+
+turtle=$1
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+# the time of the estimate of a program of $1 commands, in milliseconds
+parse() {
+    awk -v n="$1" 'BEGIN { for (i = 0; i < n; i++) print "fw 1" }' > "$dir/big.turtle"
+    start=$(date +%s%N)
+    (ulimit -s 256 && "$turtle" --estimate "$dir/big.turtle") > "$dir/estimate" 2>&1
+    status=$?
+    end=$(date +%s%N)
+    if [ $status -ne 0 ] || ! grep -q "^commands $1\$" "$dir/estimate"; then
+        echo "the program of $1 commands is not parsed :"
+        cat "$dir/estimate"
+        exit 1
+    fi
+    echo $(( (end - start) / 1000000 ))
+}
+
+small=$(parse 1000000) || { echo "$small"; exit 1; }
+big=$(parse 10000000) || { echo "$big"; exit 1; }
+echo "1000000 commands : $small ms, 10000000 commands : $big ms"
+
+# linear is about 10 times, quadratic 100 times
+if [ $small -lt 100 ]; then
+    small=100
+fi
+if [ $big -gt $((30 * small)) ]; then
+    echo "the parse time is not linear in the number of commands"
+    exit 1
+fi
@@ -0,0 +1,50 @@
+#!/bin/sh
+# usage: parse-threads.sh TURTLE
+# generate a program of more than 2 MiB, with procedures, repeats, comments
+# and an error at the end, and check that it gives the same output, the same
+# error on the same line and the same exit status with --parse-threads 4 as
+# with the sequential parse
+
+turtle=$1
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+awk 'BEGIN {
+    for (i = 0; i < 40000; i++) {
+        print "# part " i ", with a comment"
+        if (i % 50 == 0) {
+            print "proc P" i " {"
+            print "  repeat 2 {"
+            print "    fw " i % 7 + 1 " left " i % 90
+            print "  }"
+            print "}"
+            print "call P" i
+        }
+        print "set X " i " * 2"
+        print "repeat X / (X + 1) {"
+        print "  fw 1 right " i % 45
+        print "}"
+        print "{ up fw 1 down }"
+    }
+    print "call MISSING"
+}' > "$dir/big.turtle"
+
+size=$(wc -c < "$dir/big.turtle")
+if [ "$size" -le 2097152 ]; then
+    echo "the program is too small to be parsed by parts : $size bytes"
+    exit 1
+fi
+
+"$turtle" --parse-threads 1 "$dir/big.turtle" > "$dir/sequential" 2> "$dir/sequential.err"
+echo "exit $?" >> "$dir/sequential.err"
+"$turtle" --parse-threads 4 "$dir/big.turtle" > "$dir/parallel" 2> "$dir/parallel.err"
+echo "exit $?" >> "$dir/parallel.err"
+
+if ! grep -q "^Error : line $(wc -l < "$dir/big.turtle") : " "$dir/sequential.err"; then
+    echo "the error is not on the last line :"
+    cat "$dir/sequential.err"
+    exit 1
+fi
+diff "$dir/sequential.err" "$dir/parallel.err" || exit 1
+cmp "$dir/sequential" "$dir/parallel" || exit 1
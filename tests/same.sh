@@ -0,0 +1,24 @@
+#!/bin/sh
+# usage: same.sh TURTLE PROGRAM OTHER [OPTION...]
+# evaluate both programs with the options and check that they draw something,
+# with the same output and the same exit status
+
+turtle=$1
+program=$2
+other=$3
+shift 3
+
+first=$("$turtle" "$@" "$program"; echo "exit $?")
+second=$("$turtle" "$@" "$other"; echo "exit $?")
+
+if [ "$first" = "exit 0" ]; then
+    echo "$program draws nothing"
+    exit 1
+fi
+if [ "$first" != "$second" ]; then
+    echo "$program and $other differ :"
+    printf '%s\n' "$first" > "$program.out.$$"
+    printf '%s\n' "$second" | diff -u "$program.out.$$" -
+    rm -f "$program.out.$$"
+    exit 1
+fi
@@ -1,4 +1,9 @@
 #include "turtle-ast.h"
+#include "turtle-budget.h"
+#include "turtle-checkpoint.h"
+#include "turtle-hoist.h"
+#include "turtle-jit.h"
+#include "turtle-parallel.h"
 
 #include <assert.h>
 #include <stdarg.h>
@@ -420,31 +425,142 @@ void ast_destroy(struct ast *self) {
 }
 
 /**
- * recursive function to free the current node
+ * function to free a node, its children and the nodes after it
+ * the sequences are freed in a loop, only the nesting uses the C stack
  * @param self the current node to free
  */
 void ast_node_destroy(struct ast_node *self) {
-    if (!self) {
-        return;
+    while (self) {
+        struct ast_node *next = self->next;
+
+        if(self->kind == KIND_EXPR_NAME) {
+            free(self->u.name);
+        }
+        if(self->kind == KIND_CMD_PROC) {
+            free(self->u.name);
+        }
+        if(self->kind == KIND_CMD_SET) {
+            free(self->u.name);
+        }
+        jit_release(self->jit);
+
+        for(int i=0; i<self->children_count; ++i) {
+            ast_node_destroy(self->children[i]);
+        }
+        free(self);
+        self = next;
     }
+}
+
+/**
+ * intern function to check the kind of a simple command
+ */
+static bool ast_is_cmd(const struct ast_node *self, enum ast_cmd cmd) {
+    return self && self->kind == KIND_CMD_SIMPLE && self->u.cmd == cmd;
+}
+
+/**
+ * mark the steps of the sequences of a tree : the pairs of a move and a turn,
+ * and the jumps up, position, down. the tree is not changed otherwise, the
+ * commands of a step are still in the sequence for printing, comparing and
+ * the checkpoints
+ * @param self the first command of the sequence
+ */
+void ast_fuse(struct ast_node *self) {
+    for (; self; self = self->next) {
+        const struct ast_node *next = self->next;
+        bool move = ast_is_cmd(self, CMD_FORWARD) || ast_is_cmd(self, CMD_BACKWARD);
+        bool turn = ast_is_cmd(self, CMD_LEFT) || ast_is_cmd(self, CMD_RIGHT);
+        bool nextMove = ast_is_cmd(next, CMD_FORWARD) || ast_is_cmd(next, CMD_BACKWARD);
+        bool nextTurn = ast_is_cmd(next, CMD_LEFT) || ast_is_cmd(next, CMD_RIGHT);
+
+        self->step = STEP_NONE;
+        if (move && nextTurn) {
+            self->step = STEP_MOVE_TURN;
+        } else if (turn && nextMove) {
+            self->step = STEP_TURN_MOVE;
+        } else if (ast_is_cmd(self, CMD_UP) && ast_is_cmd(next, CMD_POSITION) && ast_is_cmd(next->next, CMD_DOWN)) {
+            self->step = STEP_JUMP;
+        }
 
-    if(self->kind == KIND_EXPR_NAME) {
-        free(self->u.name);
+        switch (self->kind) {
+            case KIND_CMD_REPEAT:
+                ast_fuse(self->children[1]);
+                break;
+            case KIND_CMD_BLOCK:
+            case KIND_CMD_PROC:
+                ast_fuse(self->children[0]);
+                break;
+            default:
+                break;
+        }
     }
-    if(self->kind == KIND_CMD_PROC) {
-        free(self->u.name);
+}
+
+/**
+ * compare two nodes and their children, but not the nodes after them
+ * @param self the first node
+ * @param other the second node
+ * @return true if both nodes are the same command or expression
+ */
+bool ast_node_equal(const struct ast_node *self, const struct ast_node *other) {
+    if (!self || !other) {
+        return self == other;
     }
-    if(self->kind == KIND_CMD_SET) {
-        free(self->u.name);
+    if (self->kind != other->kind || self->children_count != other->children_count) {
+        return false;
     }
 
-    if(self->next) {
-        ast_node_destroy(self->next);
+    switch (self->kind) {
+        case KIND_CMD_SIMPLE:
+            if (self->u.cmd != other->u.cmd) {
+                return false;
+            }
+            break;
+        case KIND_EXPR_VALUE:
+            if (self->u.value != other->u.value) {
+                return false;
+            }
+            break;
+        case KIND_EXPR_UNOP:
+        case KIND_EXPR_BINOP:
+            if (self->u.op != other->u.op) {
+                return false;
+            }
+            break;
+        case KIND_EXPR_NAME:
+        case KIND_CMD_PROC:
+        case KIND_CMD_SET:
+            if (strcmp(self->u.name, other->u.name) != 0) {
+                return false;
+            }
+            break;
+        case KIND_EXPR_FUNC:
+            if (self->u.func != other->u.func) {
+                return false;
+            }
+            break;
+        default:
+            break;
     }
-    for(int i=0; i<self->children_count; ++i) {
-        ast_node_destroy(self->children[i]);
+
+    for (size_t i = 0; i < self->children_count; ++i) {
+        // the children are sequences for blocks
+        const struct ast_node *a = self->children[i];
+        const struct ast_node *b = other->children[i];
+        while (a && b) {
+            if (!ast_node_equal(a, b)) {
+                return false;
+            }
+            a = a->next;
+            b = b->next;
+        }
+        if (a || b) {
+            return false;
+        }
     }
-    free(self);
+
+    return true;
 }
 
 /**
@@ -454,7 +570,7 @@ void ast_node_destroy(struct ast_node *self) {
  */
 void context_create(struct context *self) {
     /*
-    self->stopProgram = false;
+    self->status = EVAL_OK;
     self->x = 0.0;
     self->y = 0.0;
     self->angle = 0.0;
@@ -472,6 +588,14 @@ void context_create(struct context *self) {
     self->handlerForVar = calloc(1, sizeof(struct var_handling));
     self->handlerForVar->first = NULL;
 
+    self->stack.maxDepth = EVAL_DEPTH_DEFAULT;
+    self->out = stdout;
+    output_create(&self->output, OUTPUT_TEXT, OUTPUT_GRID_DEFAULT);
+    self->threads = 1;
+    self->jit = JIT_AVAILABLE;
+    self->fuse = true;
+    self->hoist = true;
+
     //create the different default variable
     add_default_var("PI", PI, self);
     add_default_var("SQRT2", SQRT2, self);
@@ -488,10 +612,10 @@ void context_create(struct context *self) {
 void add_default_var(char *name, double value, struct context *ctx) {
     struct var_handling_node *node = calloc(1, sizeof(struct var_handling_node));
     if(node == NULL) {
-        fprintf(stderr, "Error : allocation\n");
+        eval_error(ctx, EVAL_ERR_ALLOC, "allocation");
         return;
     }
-    node->name = name;
+    node->name = str_dup(name);
     node->value = value;
 
     if(ctx->handlerForVar->first == NULL) {
@@ -517,11 +641,10 @@ void handler_proc_push(struct context *ctx, const struct ast_node *self, struct
 
     struct proc_handling_node *node = calloc(1, sizeof(struct proc_handling_node));
     if(node == NULL) {
-        fprintf(stderr, "Error : allocation\n");
-        ctx->stopProgram = true;
+        eval_error(ctx, EVAL_ERR_ALLOC, "allocation");
         return;
     }
-    node->name = self->u.name;
+    node->name = str_dup(self->u.name);
     node->astNode = astNode;
 
     if(ctx->handlerForProc->first == NULL) {
@@ -554,11 +677,10 @@ void handler_var_push(struct context *ctx, const struct ast_node *self, double v
 
     struct var_handling_node *node = calloc(1, sizeof(struct var_handling_node));
     if(node == NULL) {
-        fprintf(stderr, "Error : allocation\n");
-        ctx->stopProgram = true;
+        eval_error(ctx, EVAL_ERR_ALLOC, "allocation");
         return;
     }
-    node->name = self->u.name;
+    node->name = str_dup(self->u.name);
     node->value = value;
 
     if(ctx->handlerForVar->first == NULL) {
@@ -584,6 +706,7 @@ void ctx_handler_destroy(struct context *ctx) {
     while(currProc) {
         struct proc_handling_node *tmp = currProc;
         currProc = currProc->next;
+        free(tmp->name);
         free(tmp);
     }
     free(currProc);
@@ -592,12 +715,142 @@ void ctx_handler_destroy(struct context *ctx) {
     while(currVar) {
         struct var_handling_node *tmp = currVar;
         currVar = currVar->next;
+        free(tmp->name);
         free(tmp);
     }
     free(currVar);
     free(ctx->handlerForVar);
+
+    free(ctx->stack.frames);
+
+    free(ctx->hoisted.values);
+    ctx->hoisted.values = NULL;
+    ctx->hoisted.size = 0;
+}
+
+/**
+ * function to copy a context, with its own procedures and variables
+ * the evaluation stack of the copy is empty
+ * @param dst the context to create
+ * @param src the context to copy
+ */
+void context_copy(struct context *dst, const struct context *src) {
+    *dst = *src;
+    dst->current = NULL;
+    memset(&dst->stack, 0, sizeof(struct eval_stack));
+    dst->stack.maxDepth = src->stack.maxDepth;
+    memset(&dst->hoisted, 0, sizeof(dst->hoisted));
+
+    dst->handlerForProc = calloc(1, sizeof(struct proc_handling));
+    struct proc_handling_node **lastProc = &dst->handlerForProc->first;
+    for (const struct proc_handling_node *curr = src->handlerForProc->first; curr; curr = curr->next) {
+        struct proc_handling_node *node = calloc(1, sizeof(struct proc_handling_node));
+        assert(node);
+        node->name = str_dup(curr->name);
+        node->astNode = curr->astNode;
+        *lastProc = node;
+        lastProc = &node->next;
+    }
+
+    dst->handlerForVar = calloc(1, sizeof(struct var_handling));
+    struct var_handling_node **lastVar = &dst->handlerForVar->first;
+    for (const struct var_handling_node *curr = src->handlerForVar->first; curr; curr = curr->next) {
+        struct var_handling_node *node = calloc(1, sizeof(struct var_handling_node));
+        assert(node);
+        node->name = str_dup(curr->name);
+        node->value = curr->value;
+        *lastVar = node;
+        lastVar = &node->next;
+    }
 }
 
+/**
+ * draw a random number, with the generator of the context (splitmix64)
+ * @param ctx the current context
+ * @return a number in [0 - 1[
+ */
+double context_random(struct context *ctx) {
+    uint64_t z = (ctx->seed += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z = z ^ (z >> 31);
+    return (double) (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/**
+ * function to push a sequence of commands on the evaluation stack
+ * if the sequence on the top is over, its frame is reused, so that
+ * a call, a block or a repeat in tail position does not make the stack grow
+ * @param ctx the current context
+ * @param cmd the first command of the sequence
+ * @param body the first command of the body for a repeat, NULL otherwise
+ * @param remaining the number of iterations of the body after this one
+ */
+void eval_stack_push(struct context *ctx, const struct ast_node *cmd, const struct ast_node *body, double remaining) {
+    struct eval_stack *stack = &ctx->stack;
+
+    if (stack->size > stack->base) {
+        const struct eval_frame *top = &stack->frames[stack->size - 1];
+        if (!top->cmd && top->remaining < 1) {
+            stack->size--;
+        }
+    }
+
+    if (stack->size >= stack->maxDepth) {
+        eval_error(ctx, EVAL_ERR_DEPTH, "maximum recursion depth (%zu) exceeded", stack->maxDepth);
+        return;
+    }
+
+    if (stack->size == stack->capacity) {
+        size_t capacity = stack->capacity ? 2 * stack->capacity : 64;
+        struct eval_frame *frames = realloc(stack->frames, capacity * sizeof(struct eval_frame));
+        if (frames == NULL) {
+            eval_error(ctx, EVAL_ERR_ALLOC, "allocation");
+            return;
+        }
+        stack->frames = frames;
+        stack->capacity = capacity;
+    }
+
+    struct eval_frame *frame = &stack->frames[stack->size++];
+    frame->cmd = cmd;
+    frame->body = body;
+    frame->remaining = remaining;
+}
+
+/**
+ * function to stop the evaluation on an error
+ * only the first error is kept, with the line of the command being executed
+ * @param ctx the current context
+ * @param status the kind of the error
+ * @param fmt the message, as for printf
+ */
+void eval_error(struct context *ctx, enum eval_status status, const char *fmt, ...) {
+    if (ctx->status != EVAL_OK) {
+        return;
+    }
+
+    ctx->status = status;
+    ctx->error.line = ctx->current ? ctx->current->line : 0;
+
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(ctx->error.msg, EVAL_ERROR_MAX, fmt, ap);
+    va_end(ap);
+}
+
+
+/**
+ * print the error of the evaluation on stderr
+ * @param ctx the context with the error
+ */
+void eval_error_print(const struct context *ctx) {
+    if (ctx->error.line > 0) {
+        fprintf(stderr, "Error : line %d : %s\n", ctx->error.line, ctx->error.msg);
+    } else {
+        fprintf(stderr, "Error : %s\n", ctx->error.msg);
+    }
+}
 
 /**
  * we have multiple function for all the eval for the
@@ -607,17 +860,36 @@ void ctx_handler_destroy(struct context *ctx) {
  */
 
 
+static void eval_stack_run(struct context *ctx);
+static const struct ast_node *eval_step(const struct ast_node *self, struct context *ctx);
+static double eval_node(const struct ast_node *self, struct context *ctx);
+
 /**
  * evaluate a turtle tree
+ * the evaluation stops at the first error, kept in ctx->error
  * @param self the tree to evaluate
  * @param ctx the context to evaluate
+ * @return EVAL_OK or the status of the error
  */
-void ast_eval(const struct ast *self, struct context *ctx) {
+enum eval_status ast_eval(const struct ast *self, struct context *ctx) {
     if (!self) {
-        return;
+        return ctx->status;
     }
 
     ast_node_eval(self->unit, ctx);
+    return ctx->status;
+}
+
+/**
+ * continue the evaluation of a context restored from a checkpoint,
+ * or paused with ctx->yield
+ * @param ctx the context with its evaluation stack
+ * @return EVAL_OK or the status of the error
+ */
+enum eval_status ast_eval_resume(struct context *ctx) {
+    ctx->stack.base = 0;
+    eval_stack_run(ctx);
+    return ctx->status;
 }
 
 /**
@@ -631,11 +903,322 @@ double ast_node_eval(const struct ast_node *self, struct context *ctx) {
     if (!self) {
         return -1;
     }
-    if(ctx->stopProgram){
-        printf("stop!\n");
+    if (ctx->status != EVAL_OK) {
         return -1;
     }
 
+    // a loop-invariant expression is evaluated once per entry of its repeat
+    if (self->slot && ctx->hoist) {
+        if (self->slot <= ctx->hoisted.size && ctx->hoisted.values[self->slot - 1].node == self) {
+            return ctx->hoisted.values[self->slot - 1].value;
+        }
+        double value = eval_node(self, ctx);
+        // without its value, in a context restored or copied in the repeat, it is evaluated each time
+        if (self->slot <= ctx->hoisted.size && ctx->status == EVAL_OK) {
+            ctx->hoisted.values[self->slot - 1].node = self;
+            ctx->hoisted.values[self->slot - 1].value = value;
+        }
+        return value;
+    }
+
+    return eval_node(self, ctx);
+}
+
+/**
+ * intern function to evaluate a node of the turtle tree
+ * @param self the node to evaluate
+ * @param ctx the context to evaluate
+ * @return the value if it's a value expression, otherwise 0.0
+ */
+static double eval_node(const struct ast_node *self, struct context *ctx) {
+    // the operators of the hot expressions run as native code
+    if (ctx->jit && (self->kind == KIND_EXPR_FUNC || self->kind == KIND_EXPR_UNOP || self->kind == KIND_EXPR_BINOP)) {
+        double value;
+        if (jit_eval(self, ctx, &value)) {
+            return value;
+        }
+    }
+
+    switch (self->kind) {
+        case KIND_CMD_SIMPLE:
+        case KIND_CMD_REPEAT:
+        case KIND_CMD_BLOCK:
+        case KIND_CMD_PROC:
+        case KIND_CMD_CALL:
+        case KIND_CMD_SET:
+            eval_cmds(self, ctx);
+            break;
+        case KIND_EXPR_FUNC:
+            switch (self->u.func) {
+                case FUNC_COS:
+                    return eval_func_cos(self, ctx);
+                case FUNC_RANDOM:
+                    return eval_func_random(self, ctx);
+                case FUNC_SIN:
+                    return eval_func_sin(self, ctx);
+                case FUNC_SQRT:
+                    return eval_func_sqrt(self, ctx);
+                case FUNC_TAN:
+                    return eval_func_tan(self, ctx);
+            }
+            break;
+        case KIND_EXPR_VALUE:
+            return self->u.value;
+        case KIND_EXPR_UNOP:
+            return eval_unary_operand(self, ctx);
+        case KIND_EXPR_BINOP:
+            return eval_binary_operand(self, ctx);
+        case KIND_EXPR_BLOCK:
+            return eval_expr_block(self, ctx);
+            break;
+        case KIND_EXPR_NAME:
+            return eval_set_value(self, ctx);
+            break;
+    }
+
+    return 0.0;
+}
+
+/**
+ * evaluate a sequence of commands
+ * the sequences opened by blocks, repeats and calls are pushed on the
+ * evaluation stack of the context instead of the native C stack,
+ * so the depth of the recursion is only limited by ctx->stack.maxDepth
+ * @param self the first command of the sequence
+ * @param ctx the context to evaluate
+ */
+void eval_cmds(const struct ast_node *self, struct context *ctx) {
+    struct eval_stack *stack = &ctx->stack;
+    size_t base = stack->base;
+
+    stack->base = stack->size;
+    eval_stack_push(ctx, self, NULL, 0);
+    eval_stack_run(ctx);
+    stack->base = base;
+}
+
+/**
+ * evaluate a sequence of commands several times
+ * @param self the first command of the sequence
+ * @param iter the number of iterations
+ * @param ctx the context to evaluate
+ */
+void eval_repeat(const struct ast_node *self, double iter, struct context *ctx) {
+    // a count which is not a number gives no iteration
+    if (!(iter >= 1)) {
+        return;
+    }
+
+    struct eval_stack *stack = &ctx->stack;
+    size_t base = stack->base;
+
+    stack->base = stack->size;
+    eval_stack_push(ctx, self, self, iter - 1);
+    eval_stack_run(ctx);
+    stack->base = base;
+}
+
+/**
+ * evaluate a single command, without the commands after it
+ * @param self the command to evaluate
+ * @param ctx the context to evaluate
+ */
+void eval_cmd_single(const struct ast_node *self, struct context *ctx) {
+    struct eval_stack *stack = &ctx->stack;
+    size_t base = stack->base;
+
+    stack->base = stack->size;
+    ctx->current = self;
+    ctx->executed++;
+    eval_cmd(self, ctx);
+    eval_stack_run(ctx);
+    stack->base = base;
+}
+
+/**
+ * run the frames of the evaluation stack above stack->base
+ * the top level run (base 0) stops early when ctx->yield is set, its frames
+ * are kept to resume it; the nested runs can not be resumed, they go on
+ * @param ctx the context to evaluate
+ */
+static void eval_stack_run(struct context *ctx) {
+    struct eval_stack *stack = &ctx->stack;
+
+    while (stack->size > stack->base && ctx->status == EVAL_OK) {
+        if (ctx->yield && stack->base == 0) {
+            return;
+        }
+        if (ctx->checkpoint && --ctx->checkpoint->countdown == 0) {
+            checkpoint_poll(ctx->checkpoint, ctx);
+        }
+        if (ctx->budget && --ctx->budget->countdown == 0) {
+            budget_poll(ctx->budget, ctx);
+            if (ctx->status != EVAL_OK) {
+                break;
+            }
+        }
+
+        struct eval_frame *top = &stack->frames[stack->size - 1];
+
+        if (!top->cmd) {
+            if (top->remaining >= 1) {
+                // next iteration of a repeat
+                top->remaining -= 1;
+                top->cmd = top->body;
+            } else {
+                stack->size--;
+            }
+            continue;
+        }
+
+        const struct ast_node *cmd = top->cmd;
+        ctx->current = cmd;
+        ctx->executed++;
+        // the travels of --optimize are not a fusion, they do not depend on --no-fuse
+        if (cmd->step == STEP_TRAVEL || (cmd->step != STEP_NONE && ctx->fuse)) {
+            top->cmd = eval_step(cmd, ctx);
+            continue;
+        }
+        top->cmd = cmd->next;
+        eval_cmd(cmd, ctx);
+    }
+
+    stack->size = stack->base;
+}
+
+/**
+ * intern function to move the turtle for a step, without writing the point
+ * @param self the forward or backward command
+ * @param ctx the context to evaluate
+ * @return true on success
+ */
+static bool eval_step_position(const struct ast_node *self, struct context *ctx) {
+    double angle_radian = degree_to_radian(ctx->angle);
+    double value = ast_node_eval(self->children[0], ctx);
+    if (ctx->status != EVAL_OK) {
+        return false;
+    }
+    if (self->u.cmd == CMD_FORWARD) {
+        value = -value;
+    }
+    ctx->x += sin(angle_radian) * value;
+    ctx->y += cos(angle_radian) * value;
+    return true;
+}
+
+/**
+ * intern function to move the turtle for a step
+ * @param self the forward or backward command
+ * @param ctx the context to evaluate
+ */
+static void eval_step_move(const struct ast_node *self, struct context *ctx) {
+    if (eval_step_position(self, ctx)) {
+        output_point(&ctx->output, ctx->out, ctx->x, ctx->y, ctx->up);
+    }
+}
+
+/**
+ * intern function to turn the turtle for a step
+ * @param self the left or right command
+ * @param ctx the context to evaluate
+ */
+static void eval_step_turn(const struct ast_node *self, struct context *ctx) {
+    double value = ast_node_eval(self->children[0], ctx);
+    if (self->u.cmd == CMD_RIGHT) {
+        ctx->angle -= value;
+    } else {
+        ctx->angle += value;
+    }
+    if (ctx->angle > 360) {
+        ctx->angle -= 360;
+    }
+    if (ctx->angle < 0) {
+        ctx->angle += 360;
+    }
+}
+
+/**
+ * intern function to evaluate a run of moves and turns : with the pen up,
+ * the turtle only goes to the last position, with a single MoveTo
+ * @param self the first command of the run
+ * @param ctx the context to evaluate, ctx->current is self
+ * @return the command after the run
+ */
+static const struct ast_node *eval_step_travel(const struct ast_node *self, struct context *ctx) {
+    bool moved = false;
+    for (const struct ast_node *first = self; self && self->kind == KIND_CMD_SIMPLE; self = self->next) {
+        bool move = self->u.cmd == CMD_FORWARD || self->u.cmd == CMD_BACKWARD;
+        if (!move && self->u.cmd != CMD_LEFT && self->u.cmd != CMD_RIGHT) {
+            break;
+        }
+        if (self != first) {
+            ctx->current = self;
+            ctx->executed++;
+        }
+        if (!move) {
+            eval_step_turn(self, ctx);
+        } else if (!ctx->up) {
+            eval_step_move(self, ctx);
+        } else if (eval_step_position(self, ctx)) {
+            moved = true;
+        }
+        if (ctx->status != EVAL_OK) {
+            break;
+        }
+    }
+    if (moved) {
+        output_point(&ctx->output, ctx->out, ctx->x, ctx->y, true);
+    }
+    return self;
+}
+
+/**
+ * evaluate the commands of a step marked by ast_fuse, with a single
+ * iteration of the evaluation loop
+ * @param self the first command of the step
+ * @param ctx the context to evaluate, ctx->current is self
+ * @return the command after the step
+ */
+static const struct ast_node *eval_step(const struct ast_node *self, struct context *ctx) {
+    const struct ast_node *next = self->next;
+    switch (self->step) {
+        case STEP_MOVE_TURN:
+            eval_step_move(self, ctx);
+            ctx->current = next;
+            ctx->executed++;
+            eval_step_turn(next, ctx);
+            return next->next;
+        case STEP_TURN_MOVE:
+            eval_step_turn(self, ctx);
+            ctx->current = next;
+            ctx->executed++;
+            eval_step_move(next, ctx);
+            return next->next;
+        case STEP_JUMP:
+            ctx->up = true;
+            ctx->current = next;
+            eval_cmd_position(next, ctx);
+            if (ctx->status != EVAL_OK) {
+                return next;
+            }
+            ctx->current = next->next;
+            ctx->executed += 2;
+            ctx->up = false;
+            return next->next->next;
+        case STEP_TRAVEL:
+            return eval_step_travel(self, ctx);
+        default:
+            eval_cmd(self, ctx);
+            return next;
+    }
+}
+
+/**
+ * evaluate a single command, without its next commands
+ * @param self the command to evaluate
+ * @param ctx the context to evaluate
+ */
+void eval_cmd(const struct ast_node *self, struct context *ctx) {
     switch (self->kind) {
         case KIND_CMD_SIMPLE:
             switch (self->u.cmd){
@@ -689,39 +1272,9 @@ double ast_node_eval(const struct ast_node *self, struct context *ctx) {
         case KIND_CMD_SET:
             eval_cmd_set(self, ctx);
             break;
-        case KIND_EXPR_FUNC:
-            switch (self->u.func) {
-                case FUNC_COS:
-                    return eval_func_cos(self, ctx);
-                case FUNC_RANDOM:
-                    return eval_func_random(self, ctx);
-                case FUNC_SIN:
-                    return eval_func_sin(self, ctx);
-                case FUNC_SQRT:
-                    return eval_func_sqrt(self, ctx);
-                case FUNC_TAN:
-                    return eval_func_tan(self, ctx);
-            }
+        default:
             break;
-        case KIND_EXPR_VALUE:
-            return self->u.value;
-        case KIND_EXPR_UNOP:
-            return eval_unary_operand(self, ctx);
-        case KIND_EXPR_BINOP:
-            return eval_binary_operand(self, ctx);
-        case KIND_EXPR_BLOCK:
-            return eval_expr_block(self, ctx);
-            break;
-        case KIND_EXPR_NAME:
-            return eval_set_value(self, ctx);
-            break;
-    }
-
-    if (self->next) {
-        return ast_node_eval(self->next, ctx);
     }
-
-    return 0.0;
 }
 
 /**
@@ -732,36 +1285,33 @@ double ast_node_eval(const struct ast_node *self, struct context *ctx) {
 void eval_cmd_forward(const struct ast_node *self, struct context *ctx) {
     double angle_radian = degree_to_radian(ctx->angle);
     double value = ast_node_eval(self->children[0], ctx);
+    if (ctx->status != EVAL_OK) {
+        return;
+    }
     ctx->x -= sin(angle_radian) * value;
     ctx->y -= cos(angle_radian) * value;
 
-    if (ctx->up) {
-        fprintf(stdout, "MoveTo %f %f", ctx->x, ctx->y);
-    } else {
-        fprintf(stdout, "LineTo %f %f", ctx->x, ctx->y);
-    }
-
-    fprintf(stdout, "\n");
+    output_point(&ctx->output, ctx->out, ctx->x, ctx->y, ctx->up);
 }
 void eval_cmd_backward(const struct ast_node *self, struct context *ctx) {
     double angle_radian = degree_to_radian(ctx->angle);
     double value = ast_node_eval(self->children[0], ctx);
+    if (ctx->status != EVAL_OK) {
+        return;
+    }
     ctx->x += sin(angle_radian) * value;
     ctx->y += cos(angle_radian) * value;
 
-    if (ctx->up) {
-        fprintf(stdout, "MoveTo %f %f", ctx->x, ctx->y);
-    } else {
-        fprintf(stdout, "LineTo %f %f", ctx->x, ctx->y);
-    }
-
-    fprintf(stdout, "\n");
+    output_point(&ctx->output, ctx->out, ctx->x, ctx->y, ctx->up);
 }
 void eval_cmd_position(const struct ast_node *self, struct context *ctx) {
     ctx->x = ast_node_eval(self->children[0], ctx);
     ctx->y = ast_node_eval(self->children[1], ctx);
+    if (ctx->status != EVAL_OK) {
+        return;
+    }
 
-    fprintf(stdout, "MoveTo %f %f\n", ctx->x, ctx->y);
+    output_point(&ctx->output, ctx->out, ctx->x, ctx->y, true);
 }
 void eval_cmd_right(const struct ast_node *self, struct context *ctx) {
     ctx->angle -= ast_node_eval(self->children[0], ctx);
@@ -794,13 +1344,17 @@ void eval_cmd_color(const struct ast_node *self, struct context *ctx) {
     ctx->color.g = ast_node_eval(self->children[1], ctx);
     ctx->color.b = ast_node_eval(self->children[2], ctx);
 
+    if (ctx->status != EVAL_OK) {
+        return;
+    }
+
     if(ctx->color.r < 0 || ctx->color.r > 1 || ctx->color.g < 0 || ctx->color.g > 1 || ctx->color.b < 0 || ctx->color.b > 1){
         //not in interval [0 - 1]
-        fprintf(stderr, "Error : color values must be in [0 - 1] interval\n");
-        ctx->stopProgram = true;
+        eval_error(ctx, EVAL_ERR_VALUE, "color values must be in [0 - 1] interval");
+        return;
     }
 
-    fprintf(stdout, "Color %f %f %f\n", ctx->color.r, ctx->color.g, ctx->color.b);
+    output_color(&ctx->output, ctx->out, ctx->color.r, ctx->color.g, ctx->color.b);
 }
 void eval_cmd_home(const struct ast_node *self, struct context *ctx) {
     ctx->x = 0.0;
@@ -813,12 +1367,28 @@ void eval_cmd_home(const struct ast_node *self, struct context *ctx) {
 }
 void eval_cmd_repeat(const struct ast_node *self, struct context *ctx) {
     double iter = floor(ast_node_eval(self->children[0], ctx));
-    for(int i = 0; i < iter; ++i) {
-        ast_node_eval(self->children[1], ctx);
+    // a count which is not a number gives no iteration
+    if (ctx->status != EVAL_OK || !(iter >= 1)) {
+        return;
+    }
+
+    // big loops without side effects are split between threads
+    if (iter >= PARALLEL_MIN_ITERATIONS && ctx->threads > 1 && ctx->out && !ctx->checkpoint && !ctx->budget
+        && !ctx->output.sink && parallel_repeat_pure(self->children[1])) {
+        parallel_repeat(self->children[1], iter, ctx);
+        return;
+    }
+
+    if (self->slots && ctx->hoist) {
+        hoist_enter(self, ctx);
     }
+    eval_stack_push(ctx, self->children[1], self->children[1], iter - 1);
 }
 void eval_cmd_set(const struct ast_node *self, struct context *ctx) {
     double value = ast_node_eval(self->children[0], ctx);
+    if (ctx->status != EVAL_OK) {
+        return;
+    }
     handler_var_push(ctx, self, value);
 }
 void eval_cmd_proc(const struct ast_node *self, struct context *ctx) {
@@ -826,16 +1396,13 @@ void eval_cmd_proc(const struct ast_node *self, struct context *ctx) {
     struct proc_handling_node *currProc = ctx->handlerForProc->first;
     while(currProc) {
         if (strcmp(currProc->name, self->u.name) == 0) {
-            fprintf(stderr, "Error : procedure %s is already created\n", self->u.name);
-            ctx->stopProgram = true;
-            break;
+            eval_error(ctx, EVAL_ERR_NAME, "procedure %s is already created", self->u.name);
+            return;
         }
         currProc = currProc->next;
     }
 
-    if (!ctx->stopProgram) {
-        handler_proc_push(ctx, self, self->children[0]);
-    }
+    handler_proc_push(ctx, self, self->children[0]);
 }
 void eval_cmd_call(const struct ast_node *self, struct context *ctx) {
     char* name = self->children[0]->u.name;
@@ -844,16 +1411,16 @@ void eval_cmd_call(const struct ast_node *self, struct context *ctx) {
 
     while(curr) {
         if (strcmp(name, curr->name)==0) {
-            ast_node_eval(curr->astNode, ctx);
+            eval_stack_push(ctx, curr->astNode, NULL, 0);
             return;
         }
         curr = curr->next;
     }
 
-    fprintf(stderr, "Error : no procedure with this name !\n");
+    eval_error(ctx, EVAL_ERR_NAME, "no procedure with the name %s", name);
 }
 void eval_cmd_block(const struct ast_node *self, struct context *ctx) {
-    ast_node_eval(self->children[0], ctx);
+    eval_stack_push(ctx, self->children[0], NULL, 0);
 }
 double eval_func_sin(const struct ast_node *self, struct context *ctx) {
     double value = ast_node_eval(self->children[0], ctx);
@@ -876,12 +1443,11 @@ double eval_func_random(const struct ast_node *self, struct context *ctx) {
 
     if(upper < lower) {
         // invalid intervals
-        fprintf(stderr, "Error : the lower limit must be lesser than the upper limit\n");
-        ctx->stopProgram = true;
+        eval_error(ctx, EVAL_ERR_VALUE, "the lower limit must be lesser than the upper limit");
         return -1;
     }
 
-    double f = (double) rand() / RAND_MAX;
+    double f = context_random(ctx);
     return lower + f * (upper - lower);
 }
 double eval_func_sqrt(const struct ast_node *self, struct context *ctx) {
@@ -889,37 +1455,73 @@ double eval_func_sqrt(const struct ast_node *self, struct context *ctx) {
 
     if(value < 0) {
         // sqrt of a negative number
-        fprintf(stderr, "Error : the value to put in the square root is negative\n");
-        ctx->stopProgram = true;
+        eval_error(ctx, EVAL_ERR_VALUE, "the value to put in the square root is negative");
         return -1;
     }
 
     double res = sqrt(value);
     return res;
 }
+/**
+ * compute a power as pow, with repeated multiplications only when they are exact :
+ * an integral base and a natural exponent lesser than 32, while the products stay
+ * below 2^53, so the result is the same as the one of pow
+ * @param base the base
+ * @param exponent the exponent
+ * @return base raised to the power exponent
+ */
+double eval_pow(double base, double exponent) {
+    if (exponent < 0 || exponent >= 32 || exponent != floor(exponent)
+            || base != floor(base) || fabs(base) > EVAL_POW_EXACT) {
+        return pow(base, exponent);
+    }
+
+    unsigned n = (unsigned) exponent;
+    double res = 1.0;
+    double square = base;
+    while (n) {
+        if (n & 1) {
+            res *= square;
+            if (fabs(res) > EVAL_POW_EXACT) {
+                return pow(base, exponent);
+            }
+        }
+        n >>= 1;
+        if (n) {
+            square *= square;
+            if (square > EVAL_POW_EXACT) {
+                return pow(base, exponent);
+            }
+        }
+    }
+
+    return res;
+}
 double eval_binary_operand(const struct ast_node *self, struct context *ctx) {
+    // the left operand is evaluated first, for the random numbers and the errors
+    double lhs = ast_node_eval(self->children[0],ctx);
+    double rhs = ast_node_eval(self->children[1],ctx);
     double value = 0.0;
     switch (self->u.op) {
         case '+':
-            value = ast_node_eval(self->children[0],ctx) + ast_node_eval(self->children[1],ctx);
+            value = lhs + rhs;
             break;
         case '-':
-            value = ast_node_eval(self->children[0],ctx) - ast_node_eval(self->children[1],ctx);
+            value = lhs - rhs;
             break;
         case '*':
-            value = ast_node_eval(self->children[0],ctx) * ast_node_eval(self->children[1],ctx);
+            value = lhs * rhs;
             break;
         case '/':
-            value = ast_node_eval(self->children[0],ctx) / ast_node_eval(self->children[1],ctx);
+            value = lhs / rhs;
             break;
         case '^':
-            if(ast_node_eval(self->children[1],ctx) >= 32) {
+            if(rhs >= 32) {
                 // power of the current value is out of bounds
-                fprintf(stderr, "Error : pow arguments too big\n");
-                ctx->stopProgram = true;
+                eval_error(ctx, EVAL_ERR_VALUE, "pow arguments too big");
                 return -1;
             }
-            value = pow(ast_node_eval(self->children[0],ctx), ast_node_eval(self->children[1],ctx));
+            value = eval_pow(lhs, rhs);
             break;
     }
 
@@ -948,7 +1550,7 @@ double eval_set_value(const struct ast_node *self, struct context *ctx) {
         curr = curr->next;
     }
 
-    fprintf(stderr, "Error : no variables with this name !\n");
+    eval_error(ctx, EVAL_ERR_NAME, "no variable with the name %s", self->u.name);
     return -1;
 }
 double eval_expr_block(const struct ast_node *self, struct context *ctx) {
@@ -970,104 +1572,101 @@ void ast_print(const struct ast *self) {
 /**
  * function for debug the turtle program
  * it depends on the kind of the node we want
- * to display
+ * to display, the nodes after it are displayed too
  * @param self the node to display
  */
 void ast_node_print(const struct ast_node *self) {
-    if (!self) {
-        return;
-    }
-
-    switch (self->kind) {
-        case KIND_CMD_SIMPLE:
-            switch (self->u.cmd){
-                case CMD_UP:
-                    print_cmd_up(self);
-                    break;
-                case CMD_DOWN:
-                    print_cmd_down(self);
-                    break;
-                case CMD_RIGHT:
-                    print_cmd_right(self);
-                    break;
-                case CMD_LEFT:
-                    print_cmd_left(self);
-                    break;
-                case CMD_HEADING:
-                    print_cmd_heading(self);
-                    break;
-                case CMD_FORWARD:
-                    print_cmd_forward(self);
-                    break;
-                case CMD_BACKWARD:
-                    print_cmd_backward(self);
-                    break;
-                case CMD_POSITION:
-                    print_cmd_position(self);
-                    break;
-                case CMD_HOME:
-                    print_cmd_home(self);
-                    break;
-                case CMD_COLOR:
-                    print_cmd_color(self);
-                    break;
-                case CMD_PRINT:
-                    print_cmd_print(self);
-                    break;
-            }
-            break;
-        case KIND_CMD_REPEAT:
-            print_cmd_repeat(self);
-            break;
-        case KIND_CMD_BLOCK:
-            print_cmd_block(self);
-            break;
-        case KIND_CMD_PROC:
-            print_cmd_proc(self);
-            break;
-        case KIND_CMD_CALL:
-            print_cmd_call(self);
-            break;
-        case KIND_CMD_SET:
-            print_cmd_set(self);
-            break;
-        case KIND_EXPR_FUNC:
-            switch (self->u.func) {
-                case FUNC_COS:
-                    print_func_cos(self);
-                    break;
-                case FUNC_RANDOM:
-                    print_func_random(self);
-                    break;
-                case FUNC_SIN:
-                    print_func_sin(self);
-                    break;
-                case FUNC_SQRT:
-                    print_func_sqrt(self);
-                    break;
-                case FUNC_TAN:
-                    print_func_tan(self);
-                    break;
-            }
-            break;
-        case KIND_EXPR_VALUE:
-            fprintf(stderr, "%.1f", self->u.value);
-            break;
-        case KIND_EXPR_UNOP:
-            print_unary_operand(self);
-            break;
-        case KIND_EXPR_BINOP:
-            print_binary_operand(self);
-            break;
-        case KIND_EXPR_BLOCK:
-            print_expr_block(self);
-            break;
-        case KIND_EXPR_NAME:
-            fprintf(stderr, "%s", self->u.name);
-            break;
+    // the nodes after self in a loop, only the nesting uses the C stack
+    for (; self; self = self->next) {
+        switch (self->kind) {
+            case KIND_CMD_SIMPLE:
+                switch (self->u.cmd){
+                    case CMD_UP:
+                        print_cmd_up(self);
+                        break;
+                    case CMD_DOWN:
+                        print_cmd_down(self);
+                        break;
+                    case CMD_RIGHT:
+                        print_cmd_right(self);
+                        break;
+                    case CMD_LEFT:
+                        print_cmd_left(self);
+                        break;
+                    case CMD_HEADING:
+                        print_cmd_heading(self);
+                        break;
+                    case CMD_FORWARD:
+                        print_cmd_forward(self);
+                        break;
+                    case CMD_BACKWARD:
+                        print_cmd_backward(self);
+                        break;
+                    case CMD_POSITION:
+                        print_cmd_position(self);
+                        break;
+                    case CMD_HOME:
+                        print_cmd_home(self);
+                        break;
+                    case CMD_COLOR:
+                        print_cmd_color(self);
+                        break;
+                    case CMD_PRINT:
+                        print_cmd_print(self);
+                        break;
+                }
+                break;
+            case KIND_CMD_REPEAT:
+                print_cmd_repeat(self);
+                break;
+            case KIND_CMD_BLOCK:
+                print_cmd_block(self);
+                break;
+            case KIND_CMD_PROC:
+                print_cmd_proc(self);
+                break;
+            case KIND_CMD_CALL:
+                print_cmd_call(self);
+                break;
+            case KIND_CMD_SET:
+                print_cmd_set(self);
+                break;
+            case KIND_EXPR_FUNC:
+                switch (self->u.func) {
+                    case FUNC_COS:
+                        print_func_cos(self);
+                        break;
+                    case FUNC_RANDOM:
+                        print_func_random(self);
+                        break;
+                    case FUNC_SIN:
+                        print_func_sin(self);
+                        break;
+                    case FUNC_SQRT:
+                        print_func_sqrt(self);
+                        break;
+                    case FUNC_TAN:
+                        print_func_tan(self);
+                        break;
+                }
+                break;
+            case KIND_EXPR_VALUE:
+                fprintf(stderr, "%.1f", self->u.value);
+                break;
+            case KIND_EXPR_UNOP:
+                print_unary_operand(self);
+                break;
+            case KIND_EXPR_BINOP:
+                print_binary_operand(self);
+                break;
+            case KIND_EXPR_BLOCK:
+                print_expr_block(self);
+                break;
+            case KIND_EXPR_NAME:
+                fprintf(stderr, "%s", self->u.name);
+                break;
+        }
     }
-
-    ast_node_print(self->next);
 }
 
 
@@ -3,6 +3,10 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "turtle-output.h"
 
 // simple commands
 enum ast_cmd {
@@ -28,6 +32,15 @@ enum ast_func {
   FUNC_TAN,
 };
 
+// fused sequences of commands, evaluated at once
+enum ast_step {
+  STEP_NONE,
+  STEP_MOVE_TURN,  // forward or backward, then left or right
+  STEP_TURN_MOVE,  // left or right, then forward or backward
+  STEP_JUMP,       // up, position, down
+  STEP_TRAVEL,     // moves and turns, with the pen up only the last position is written, see ast_optimize
+};
+
 // kind of a node in the abstract syntax tree
 enum ast_kind {
   KIND_CMD_SIMPLE,
@@ -47,6 +60,8 @@ enum ast_kind {
 
 #define AST_CHILDREN_MAX 3
 
+struct jit_code;
+
 // a node in the abstract syntax tree
 struct ast_node {
   enum ast_kind kind; // kind of the node
@@ -62,6 +77,15 @@ struct ast_node {
   size_t children_count;  // the number of children of the node
   struct ast_node *children[AST_CHILDREN_MAX];  // the children of the node (arguments of commands, etc)
   struct ast_node *next;  // the next node in the sequence
+  int line;               // line of the command in the source, 0 if unknown
+  enum ast_step step;     // the command and the next ones form a step, see ast_fuse
+
+  unsigned hits;          // number of evaluations of the expression, for the JIT
+  struct jit_code *jit;   // compiled code of the expression, NULL until it is hot
+
+  size_t slot;            // loop-invariant expression : index of its value in ctx->hoisted plus one, 0 otherwise
+                          // repeat : index of the first value of its hoisted expressions, see ast_hoist
+  size_t slots;           // repeat : number of hoisted expressions
 };
 
 /*
@@ -121,6 +145,12 @@ struct ast {
 void ast_destroy(struct ast *self);
 void ast_node_destroy(struct ast_node *self);
 
+// mark the steps of the sequences of a tree
+void ast_fuse(struct ast_node *self);
+
+// compare two nodes and their children
+bool ast_node_equal(const struct ast_node *self, const struct ast_node *other);
+
 // handling of procedure for the context
 struct proc_handling_node {
     char* name;
@@ -141,11 +171,62 @@ struct var_handling {
     struct var_handling_node* first;
 };
 
+// default maximum depth of the evaluation stack (nested blocks, repeats and calls)
+#define EVAL_DEPTH_DEFAULT 1000000
+
+// a frame of the evaluation stack : a sequence of commands being executed
+struct eval_frame {
+    const struct ast_node *cmd;  // next command to execute, NULL when the sequence is over
+    const struct ast_node *body; // first command of the body for a repeat, NULL otherwise
+    double remaining;            // remaining iterations of the body
+};
+
+// explicit stack of sequences, so that commands do not grow the native C stack
+struct eval_stack {
+    struct eval_frame *frames;
+    size_t size;
+    size_t capacity;
+    size_t base;     // first frame owned by the running eval_cmds
+    size_t maxDepth; // maximum number of frames
+};
+
+// status of the evaluation
+enum eval_status {
+    EVAL_OK,
+    EVAL_ERR_ALLOC,  // an allocation failed
+    EVAL_ERR_VALUE,  // a value out of its domain (color, random, sqrt, pow)
+    EVAL_ERR_NAME,   // an unknown or already defined name
+    EVAL_ERR_DEPTH,  // the maximum depth of the evaluation stack is exceeded
+    EVAL_ERR_BUDGET, // a limit of the budget is exceeded
+};
+
+#define EVAL_ERROR_MAX 256
+
+// the integers up to 2^53 are exact in a double, so are their products below it
+#define EVAL_POW_EXACT 9007199254740992.0
+
+// the first error of the evaluation, with its location
+struct eval_error {
+    int line;                  // line of the command, 0 if unknown
+    char msg[EVAL_ERROR_MAX];  // the diagnostic
+};
+
+// the value of a loop-invariant expression in the running entry of its repeat
+struct hoisted_value {
+    const struct ast_node *node; // the expression, NULL until it is evaluated
+    double value;
+};
+
+struct checkpoint;
+struct budget;
+
 /*
  * the execution context
  */
 struct context {
-    bool stopProgram; // when non-compliance with preconditions
+    enum eval_status status;          // EVAL_OK until an error stops the program
+    struct eval_error error;          // the error, when status != EVAL_OK
+    const struct ast_node *current;   // the command being executed
 
     double x;
     double y;
@@ -164,13 +245,63 @@ struct context {
 
     // linked list to handle the variables
     struct var_handling* handlerForVar;
+
+    // stack of the command sequences being executed
+    struct eval_stack stack;
+
+    // where the primitives are written, NULL to evaluate without output
+    FILE *out;
+
+    // encoding of the primitives written to out
+    struct output output;
+
+    // state of the random generator
+    uint64_t seed;
+
+    // number of commands executed
+    uint64_t executed;
+
+    // periodic checkpoints of the context, NULL when disabled
+    struct checkpoint *checkpoint;
+
+    // resource limits of the evaluation, NULL without limits
+    struct budget *budget;
+
+    // number of threads for the big repeat loops, 1 to stay sequential
+    unsigned threads;
+
+    // compile the hot expressions to native code
+    bool jit;
+
+    // evaluate the steps marked by ast_fuse at once
+    bool fuse;
+
+    // evaluate the loop-invariant expressions found by ast_hoist once per entry of their repeat
+    bool hoist;
+
+    // values of the loop-invariant expressions, see hoist_enter
+    struct {
+        struct hoisted_value *values;
+        size_t size;
+    } hoisted;
+
+    // set by a sink to pause the evaluation before the next command of the
+    // top level run, the stack is kept and ast_eval_resume goes on from there
+    bool yield;
 };
 
 // create an initial context
 void context_create(struct context *self);
+void context_copy(struct context *dst, const struct context *src);
+double context_random(struct context *ctx);
 void handler_proc_push(struct context *ctx, const struct ast_node *self, struct ast_node *astNode);
 void handler_var_push(struct context *ctx, const struct ast_node *self, double value);
 void ctx_handler_destroy(struct context *ctx);
+void eval_stack_push(struct context *ctx, const struct ast_node *cmd, const struct ast_node *body, double remaining);
+
+// stop the evaluation, only the first error is kept
+void eval_error(struct context *ctx, enum eval_status status, const char *fmt, ...);
+void eval_error_print(const struct context *ctx);
 
 // create the default variable such as PI, SQRT2 and SQRT3
 void add_default_var(char* name, double value, struct context *ctx);
@@ -206,8 +337,13 @@ void print_unary_operand(const struct ast_node *self);
 void print_expr_block(const struct ast_node *self);
 
 // evaluate the tree and generate some basic primitives
-void ast_eval(const struct ast *self, struct context *ctx);
+enum eval_status ast_eval(const struct ast *self, struct context *ctx);
+enum eval_status ast_eval_resume(struct context *ctx);
 double ast_node_eval(const struct ast_node *self, struct context *ctx);
+void eval_cmds(const struct ast_node *self, struct context *ctx);
+void eval_cmd(const struct ast_node *self, struct context *ctx);
+void eval_cmd_single(const struct ast_node *self, struct context *ctx);
+void eval_repeat(const struct ast_node *self, double iter, struct context *ctx);
 
 // eval elements - commands, functions and operands
 void eval_cmd_forward(const struct ast_node *self, struct context *ctx);
@@ -230,6 +366,7 @@ double eval_func_tan(const struct ast_node *self, struct context *ctx);
 double eval_func_random(const struct ast_node *self, struct context *ctx);
 double eval_func_sqrt(const struct ast_node *self, struct context *ctx);
 double eval_binary_operand(const struct ast_node *self, struct context *ctx);
+double eval_pow(double base, double exponent);
 double eval_unary_operand(const struct ast_node *self, struct context *ctx);
 double eval_set_value(const struct ast_node *self, struct context *ctx);
 double eval_expr_block(const struct ast_node *self, struct context *ctx);
@@ -0,0 +1,141 @@
+#include "turtle-budget.h"
+
+#include <string.h>
+
+/**
+ * set the limits of a budget, without any limit
+ * @param self the budget
+ */
+void budget_create(struct budget *self) {
+    memset(self, 0, sizeof(struct budget));
+}
+
+/**
+ * tell if the evaluation has a limit, the memory of the tree aside
+ * @param self the budget
+ * @return true if a limit is set
+ */
+bool budget_limited(const struct budget *self) {
+    return self->commands || self->primitives || self->bytes || self->seconds > 0;
+}
+
+/**
+ * intern function to add the memory of the nodes of a sequence and their children
+ * @param self the first node
+ * @return the number of bytes
+ */
+static uint64_t budget_node_bytes(const struct ast_node *self) {
+    uint64_t bytes = 0;
+    for (; self; self = self->next) {
+        bytes += sizeof(struct ast_node);
+        if (self->kind == KIND_EXPR_NAME || self->kind == KIND_CMD_SET || self->kind == KIND_CMD_PROC) {
+            bytes += strlen(self->u.name) + 1;
+        }
+        for (size_t i = 0; i < self->children_count; ++i) {
+            bytes += budget_node_bytes(self->children[i]);
+        }
+    }
+    return bytes;
+}
+
+/**
+ * check the memory of a tree against the budget
+ * @param self the budget
+ * @param root the tree
+ * @param ctx the context, it gets the error
+ * @return 0 on success
+ */
+int budget_check_ast(const struct budget *self, const struct ast *root, struct context *ctx) {
+    if (!self->astBytes) {
+        return 0;
+    }
+
+    uint64_t bytes = budget_node_bytes(root->unit);
+    if (bytes > self->astBytes) {
+        eval_error(ctx, EVAL_ERR_BUDGET, "the tree of the program takes %llu bytes, more than the budget (%llu)",
+                   (unsigned long long) bytes, (unsigned long long) self->astBytes);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * intern function to bound the countdown by half of what is left of a limit
+ * @param countdown the countdown
+ * @param limit the limit, 0 for no limit
+ * @param used the amount used
+ * @param perCommand the most a command usually uses
+ */
+static void budget_bound(uint64_t *countdown, uint64_t limit, uint64_t used, uint64_t perCommand) {
+    if (!limit) {
+        return;
+    }
+    uint64_t left = used < limit ? (limit - used) / perCommand : 0;
+    if (left / 2 + 1 < *countdown) {
+        *countdown = left / 2 + 1;
+    }
+}
+
+/**
+ * intern function to get the number of commands before the next check,
+ * halved each time a limit gets nearer, so that the evaluation stops close to it
+ * @param self the budget
+ * @param ctx the context
+ */
+static void budget_countdown(struct budget *self, const struct context *ctx) {
+    self->countdown = BUDGET_POLL_STEPS;
+    budget_bound(&self->countdown, self->commands, ctx->executed - self->startCommands, 1);
+    budget_bound(&self->countdown, self->primitives, ctx->output.primitives - self->startPrimitives, 1);
+    budget_bound(&self->countdown, self->bytes, ctx->output.bytes - self->startBytes, BUDGET_BYTES_PER_COMMAND);
+}
+
+/**
+ * start the evaluation of a context with a budget, the counters of the
+ * context before the evaluation do not count
+ * @param self the budget
+ * @param ctx the context
+ */
+void budget_start(struct budget *self, struct context *ctx) {
+    self->startCommands = ctx->executed;
+    self->startPrimitives = ctx->output.primitives;
+    self->startBytes = ctx->output.bytes;
+    clock_gettime(CLOCK_MONOTONIC, &self->start);
+    budget_countdown(self, ctx);
+    ctx->budget = self;
+}
+
+/**
+ * check the limits of the evaluation
+ * @param self the budget
+ * @param ctx the context, it is stopped with EVAL_ERR_BUDGET if a limit is exceeded
+ */
+void budget_poll(struct budget *self, struct context *ctx) {
+    budget_countdown(self, ctx);
+
+    uint64_t commands = ctx->executed - self->startCommands;
+    if (self->commands && commands >= self->commands) {
+        eval_error(ctx, EVAL_ERR_BUDGET, "budget of %llu commands exceeded", (unsigned long long) self->commands);
+        return;
+    }
+
+    uint64_t primitives = ctx->output.primitives - self->startPrimitives;
+    if (self->primitives && primitives > self->primitives) {
+        eval_error(ctx, EVAL_ERR_BUDGET, "budget of %llu primitives exceeded", (unsigned long long) self->primitives);
+        return;
+    }
+
+    uint64_t bytes = ctx->output.bytes - self->startBytes;
+    if (self->bytes && bytes > self->bytes) {
+        eval_error(ctx, EVAL_ERR_BUDGET, "budget of %llu output bytes exceeded", (unsigned long long) self->bytes);
+        return;
+    }
+
+    if (self->seconds > 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double elapsed = (now.tv_sec - self->start.tv_sec) + (now.tv_nsec - self->start.tv_nsec) / 1e9;
+        if (elapsed > self->seconds) {
+            eval_error(ctx, EVAL_ERR_BUDGET, "budget of %g seconds exceeded", self->seconds);
+        }
+    }
+}
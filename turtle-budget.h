@@ -0,0 +1,54 @@
+#ifndef TURTLE_BUDGET_H
+#define TURTLE_BUDGET_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "turtle-ast.h"
+
+// number of commands between two checks of the budget
+#define BUDGET_POLL_STEPS 4096
+
+// bytes of a usual primitive in the text format, to check the output bytes in time
+#define BUDGET_BYTES_PER_COMMAND 64
+
+/*
+ * resource limits of an evaluation, 0 for no limit
+ * the evaluator only decrements a countdown for each command, the counters
+ * and the clock are checked every BUDGET_POLL_STEPS commands, and more often
+ * near a limit : a program which needs more commands than the limit stops
+ * there, the primitives and the bytes can go a little beyond their limit
+ * before the evaluation stops with EVAL_ERR_BUDGET
+ * the depth of the evaluation stack is limited by ctx->stack.maxDepth
+ */
+struct budget {
+    uint64_t commands;     // commands executed
+    uint64_t primitives;   // primitives written
+    uint64_t bytes;        // bytes of the encoded primitives
+    double seconds;        // wall-clock time of the evaluation
+    uint64_t astBytes;     // memory of the tree, checked before the evaluation
+
+    // state of the running evaluation, see budget_start
+    uint64_t countdown;    // commands before the next check
+    uint64_t startCommands;
+    uint64_t startPrimitives;
+    uint64_t startBytes;
+    struct timespec start;
+};
+
+// limits of a budget, without any limit
+void budget_create(struct budget *self);
+
+// true if a limit of the evaluation is set
+bool budget_limited(const struct budget *self);
+
+// check the memory of the tree, the error is written to ctx, returns 0 on success
+int budget_check_ast(const struct budget *self, const struct ast *root, struct context *ctx);
+
+// start the evaluation of ctx with the budget
+void budget_start(struct budget *self, struct context *ctx);
+
+// check the limits, stop the evaluation of ctx with EVAL_ERR_BUDGET if one is exceeded
+void budget_poll(struct budget *self, struct context *ctx);
+
+#endif /* TURTLE_BUDGET_H */
@@ -0,0 +1,421 @@
+#include "turtle-checkpoint.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHECKPOINT_MAGIC "TTCK"
+#define CHECKPOINT_VERSION 2
+
+/**
+ * intern function to add some bytes to the hash of the program (FNV-1a)
+ * @param hash the current hash
+ * @param data the bytes
+ * @param size the number of bytes
+ * @return the new hash
+ */
+static uint64_t checkpoint_hash(uint64_t hash, const void *data, size_t size) {
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+/**
+ * number the nodes of a sequence in preorder and hash them
+ * @param self the checkpoint
+ * @param node the first node of the sequence
+ * @param capacity the size of the array of nodes
+ */
+static void checkpoint_index_list(struct checkpoint *self, const struct ast_node *node, size_t *capacity) {
+    for (; node; node = node->next) {
+        if (self->count == *capacity) {
+            *capacity = *capacity ? 2 * *capacity : 256;
+            self->nodes = realloc(self->nodes, *capacity * sizeof(struct ast_node *));
+            assert(self->nodes);
+        }
+        self->nodes[self->count++] = node;
+
+        self->hash = checkpoint_hash(self->hash, &node->kind, sizeof(node->kind));
+        self->hash = checkpoint_hash(self->hash, &node->children_count, sizeof(node->children_count));
+        switch (node->kind) {
+            case KIND_CMD_SIMPLE:
+                self->hash = checkpoint_hash(self->hash, &node->u.cmd, sizeof(node->u.cmd));
+                break;
+            case KIND_EXPR_VALUE:
+                self->hash = checkpoint_hash(self->hash, &node->u.value, sizeof(node->u.value));
+                break;
+            case KIND_EXPR_UNOP:
+            case KIND_EXPR_BINOP:
+                self->hash = checkpoint_hash(self->hash, &node->u.op, sizeof(node->u.op));
+                break;
+            case KIND_EXPR_FUNC:
+                self->hash = checkpoint_hash(self->hash, &node->u.func, sizeof(node->u.func));
+                break;
+            case KIND_EXPR_NAME:
+            case KIND_CMD_PROC:
+            case KIND_CMD_SET:
+                self->hash = checkpoint_hash(self->hash, node->u.name, strlen(node->u.name) + 1);
+                break;
+            default:
+                break;
+        }
+
+        for (size_t i = 0; i < node->children_count; ++i) {
+            checkpoint_index_list(self, node->children[i], capacity);
+        }
+        // end of the children
+        self->hash = checkpoint_hash(self->hash, "}", 1);
+    }
+}
+
+/**
+ * intern function to sort the nodes by address
+ */
+static int checkpoint_index_compare(const void *a, const void *b) {
+    const struct ast_node *x = ((const struct checkpoint_index *) a)->node;
+    const struct ast_node *y = ((const struct checkpoint_index *) b)->node;
+    return (x > y) - (x < y);
+}
+
+/**
+ * prepare the checkpoints of the evaluation of a tree
+ * @param self the checkpoint to create
+ * @param root the tree evaluated
+ * @param path the file of the checkpoints, NULL to only restore
+ * @param interval the number of seconds between two checkpoints
+ */
+void checkpoint_create(struct checkpoint *self, const struct ast *root, const char *path, double interval) {
+    memset(self, 0, sizeof(struct checkpoint));
+    self->path = path;
+    self->interval = interval;
+    self->countdown = CHECKPOINT_POLL_STEPS;
+    self->hash = 0xCBF29CE484222325ULL;
+    clock_gettime(CLOCK_MONOTONIC, &self->last);
+
+    size_t capacity = 0;
+    checkpoint_index_list(self, root->unit, &capacity);
+
+    self->sorted = calloc(self->count + 1, sizeof(struct checkpoint_index));
+    assert(self->sorted);
+    for (uint32_t i = 0; i < self->count; ++i) {
+        self->sorted[i].node = self->nodes[i];
+        self->sorted[i].index = i;
+    }
+    qsort(self->sorted, self->count, sizeof(struct checkpoint_index), checkpoint_index_compare);
+}
+
+/**
+ * free the index of the nodes
+ * @param self the checkpoint
+ */
+void checkpoint_destroy(struct checkpoint *self) {
+    free(self->nodes);
+    free(self->sorted);
+}
+
+/**
+ * intern function to get the number of a node, 0 for NULL
+ * @param self the checkpoint
+ * @param node the node
+ * @return 1 + the number of the node in preorder
+ */
+static uint32_t checkpoint_node_index(const struct checkpoint *self, const struct ast_node *node) {
+    if (!node) {
+        return 0;
+    }
+
+    struct checkpoint_index key = { node, 0 };
+    const struct checkpoint_index *found = bsearch(&key, self->sorted, self->count, sizeof(struct checkpoint_index), checkpoint_index_compare);
+    assert(found);
+    return found->index + 1;
+}
+
+/**
+ * intern function to get a node from its number, see checkpoint_node_index
+ * @param self the checkpoint
+ * @param index the number of the node
+ * @param node the node found
+ * @return false if the number is not valid
+ */
+static bool checkpoint_node(const struct checkpoint *self, uint32_t index, const struct ast_node **node) {
+    if (index > self->count) {
+        return false;
+    }
+    *node = index ? self->nodes[index - 1] : NULL;
+    return true;
+}
+
+/**
+ * write a checkpoint if the interval is elapsed since the last one
+ * @param self the checkpoint
+ * @param ctx the context to save
+ */
+void checkpoint_poll(struct checkpoint *self, struct context *ctx) {
+    self->countdown = CHECKPOINT_POLL_STEPS;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec - self->last.tv_sec) + (now.tv_nsec - self->last.tv_nsec) / 1e9;
+    if (elapsed < self->interval) {
+        return;
+    }
+
+    checkpoint_write(self, ctx);
+    clock_gettime(CLOCK_MONOTONIC, &self->last);
+}
+
+/*
+ * the file holds the fields one after the other, in the byte order of the machine
+ */
+
+static void write_u32(FILE *file, uint32_t value) {
+    fwrite(&value, sizeof(value), 1, file);
+}
+static void write_u64(FILE *file, uint64_t value) {
+    fwrite(&value, sizeof(value), 1, file);
+}
+static void write_double(FILE *file, double value) {
+    fwrite(&value, sizeof(value), 1, file);
+}
+static void write_str(FILE *file, const char *str) {
+    uint32_t size = strlen(str);
+    write_u32(file, size);
+    fwrite(str, 1, size, file);
+}
+
+static bool read_u32(FILE *file, uint32_t *value) {
+    return fread(value, sizeof(*value), 1, file) == 1;
+}
+static bool read_u64(FILE *file, uint64_t *value) {
+    return fread(value, sizeof(*value), 1, file) == 1;
+}
+static bool read_double(FILE *file, double *value) {
+    return fread(value, sizeof(*value), 1, file) == 1;
+}
+static char *read_str(FILE *file) {
+    uint32_t size;
+    if (!read_u32(file, &size) || size > 4096) {
+        return NULL;
+    }
+    char *str = malloc(size + 1);
+    assert(str);
+    if (fread(str, 1, size, file) != size) {
+        free(str);
+        return NULL;
+    }
+    str[size] = '\0';
+    return str;
+}
+
+/**
+ * write a checkpoint of the context, the output is flushed first
+ * the file is replaced only when the new checkpoint is complete
+ * @param self the checkpoint
+ * @param ctx the context to save
+ * @return 0 on success
+ */
+int checkpoint_write(struct checkpoint *self, struct context *ctx) {
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", self->path);
+
+    FILE *file = fopen(tmp, "wb");
+    if (file == NULL) {
+        perror(tmp);
+        return -1;
+    }
+
+    fflush(ctx->out);
+    int64_t offset = ftello(ctx->out);
+
+    fwrite(CHECKPOINT_MAGIC, 1, 4, file);
+    write_u32(file, CHECKPOINT_VERSION);
+    write_u64(file, self->hash);
+    write_u64(file, (uint64_t) offset);
+    write_u64(file, ctx->executed);
+    write_u64(file, ctx->seed);
+
+    write_double(file, ctx->x);
+    write_double(file, ctx->y);
+    write_double(file, ctx->angle);
+    write_u32(file, ctx->up);
+    write_double(file, ctx->color.r);
+    write_double(file, ctx->color.g);
+    write_double(file, ctx->color.b);
+
+    write_u32(file, ctx->output.format);
+    write_u64(file, ctx->output.grid);
+    write_u32(file, ctx->output.pen);
+    write_u64(file, (uint64_t) ctx->output.x);
+    write_u64(file, (uint64_t) ctx->output.y);
+    write_u32(file, ctx->output.colored);
+    for (size_t i = 0; i < 3; ++i) {
+        write_u64(file, ctx->output.color[i]);
+    }
+
+    uint32_t count = 0;
+    for (const struct var_handling_node *curr = ctx->handlerForVar->first; curr; curr = curr->next) {
+        ++count;
+    }
+    write_u32(file, count);
+    for (const struct var_handling_node *curr = ctx->handlerForVar->first; curr; curr = curr->next) {
+        write_str(file, curr->name);
+        write_double(file, curr->value);
+    }
+
+    count = 0;
+    for (const struct proc_handling_node *curr = ctx->handlerForProc->first; curr; curr = curr->next) {
+        ++count;
+    }
+    write_u32(file, count);
+    for (const struct proc_handling_node *curr = ctx->handlerForProc->first; curr; curr = curr->next) {
+        write_str(file, curr->name);
+        write_u32(file, checkpoint_node_index(self, curr->astNode));
+    }
+
+    write_u32(file, ctx->stack.size);
+    for (size_t i = 0; i < ctx->stack.size; ++i) {
+        const struct eval_frame *frame = &ctx->stack.frames[i];
+        write_u32(file, checkpoint_node_index(self, frame->cmd));
+        write_u32(file, checkpoint_node_index(self, frame->body));
+        write_double(file, frame->remaining);
+    }
+
+    if (ferror(file) | fclose(file)) {
+        fprintf(stderr, "Error : the checkpoint %s could not be written\n", tmp);
+        return -1;
+    }
+    if (rename(tmp, self->path) != 0) {
+        perror(self->path);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * restore a context from a checkpoint of the same program
+ * @param self the checkpoint, created for the program
+ * @param path the checkpoint file
+ * @param ctx the context to restore, created before
+ * @param offset the size of the output when the checkpoint was written, -1 if unknown
+ * @return 0 on success
+ */
+int checkpoint_restore(const struct checkpoint *self, const char *path, struct context *ctx, int64_t *offset) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    char magic[4];
+    uint32_t version;
+    uint64_t hash;
+    if (fread(magic, 1, 4, file) != 4 || memcmp(magic, CHECKPOINT_MAGIC, 4) != 0
+        || !read_u32(file, &version) || version != CHECKPOINT_VERSION) {
+        fprintf(stderr, "Error : %s is not a checkpoint\n", path);
+        fclose(file);
+        return -1;
+    }
+    if (!read_u64(file, &hash) || hash != self->hash) {
+        fprintf(stderr, "Error : the checkpoint %s is not for this program\n", path);
+        fclose(file);
+        return -1;
+    }
+
+    // the context starts from nothing, but keeps its settings
+    ctx_handler_destroy(ctx);
+    ctx->handlerForProc = calloc(1, sizeof(struct proc_handling));
+    ctx->handlerForVar = calloc(1, sizeof(struct var_handling));
+    assert(ctx->handlerForProc && ctx->handlerForVar);
+    size_t maxDepth = ctx->stack.maxDepth;
+    memset(&ctx->stack, 0, sizeof(struct eval_stack));
+    ctx->stack.maxDepth = maxDepth;
+
+    uint64_t value;
+    uint32_t up;
+    bool ok = read_u64(file, &value);
+    *offset = (int64_t) value;
+    ok = ok && read_u64(file, &ctx->executed);
+    ok = ok && read_u64(file, &ctx->seed);
+    ok = ok && read_double(file, &ctx->x);
+    ok = ok && read_double(file, &ctx->y);
+    ok = ok && read_double(file, &ctx->angle);
+    ok = ok && read_u32(file, &up);
+    ctx->up = up;
+    ok = ok && read_double(file, &ctx->color.r);
+    ok = ok && read_double(file, &ctx->color.g);
+    ok = ok && read_double(file, &ctx->color.b);
+
+    // the state of the encoder, the output must have the same format
+    uint32_t format, pen, colored;
+    uint64_t grid, x, y;
+    ok = ok && read_u32(file, &format) && read_u64(file, &grid) && read_u32(file, &pen)
+        && read_u64(file, &x) && read_u64(file, &y) && read_u32(file, &colored);
+    for (size_t i = 0; ok && i < 3; ++i) {
+        ok = read_u64(file, &ctx->output.color[i]);
+    }
+    if (ok && (format != ctx->output.format || (format != OUTPUT_TEXT && grid != ctx->output.grid))) {
+        fprintf(stderr, "Error : the checkpoint %s was written with another output format\n", path);
+        fclose(file);
+        return -1;
+    }
+    ctx->output.pen = pen;
+    ctx->output.x = (int64_t) x;
+    ctx->output.y = (int64_t) y;
+    ctx->output.colored = colored;
+
+    uint32_t count = 0;
+    ok = ok && read_u32(file, &count);
+    struct var_handling_node **lastVar = &ctx->handlerForVar->first;
+    for (uint32_t i = 0; ok && i < count; ++i) {
+        struct var_handling_node *node = calloc(1, sizeof(struct var_handling_node));
+        assert(node);
+        node->name = read_str(file);
+        ok = node->name && read_double(file, &node->value);
+        *lastVar = node;
+        lastVar = &node->next;
+    }
+
+    count = 0;
+    ok = ok && read_u32(file, &count);
+    struct proc_handling_node **lastProc = &ctx->handlerForProc->first;
+    for (uint32_t i = 0; ok && i < count; ++i) {
+        struct proc_handling_node *node = calloc(1, sizeof(struct proc_handling_node));
+        assert(node);
+        uint32_t index;
+        const struct ast_node *body = NULL;
+        node->name = read_str(file);
+        ok = node->name && read_u32(file, &index) && checkpoint_node(self, index, &body) && body;
+        node->astNode = (struct ast_node *) body;
+        *lastProc = node;
+        lastProc = &node->next;
+    }
+
+    count = 0;
+    ok = ok && read_u32(file, &count) && count <= maxDepth;
+    if (ok && count > 0) {
+        ctx->stack.frames = calloc(count, sizeof(struct eval_frame));
+        assert(ctx->stack.frames);
+        ctx->stack.capacity = count;
+    }
+    for (uint32_t i = 0; ok && i < count; ++i) {
+        struct eval_frame *frame = &ctx->stack.frames[i];
+        uint32_t cmd, body;
+        ok = read_u32(file, &cmd) && read_u32(file, &body) && read_double(file, &frame->remaining)
+            && checkpoint_node(self, cmd, &frame->cmd) && checkpoint_node(self, body, &frame->body);
+        ctx->stack.size = i + 1;
+    }
+
+    fclose(file);
+
+    if (!ok) {
+        fprintf(stderr, "Error : the checkpoint %s is corrupted\n", path);
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,54 @@
+#ifndef TURTLE_CHECKPOINT_H
+#define TURTLE_CHECKPOINT_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "turtle-ast.h"
+
+// number of commands between two checks of the clock
+#define CHECKPOINT_POLL_STEPS 65536
+
+// default interval between two checkpoints, in seconds
+#define CHECKPOINT_INTERVAL_DEFAULT 60.0
+
+// a node of the tree with its number in preorder
+struct checkpoint_index {
+    const struct ast_node *node;
+    uint32_t index;
+};
+
+/*
+ * periodic checkpoints of a context : the pose, the pen, the color,
+ * the variables, the procedures, the random generator, the state of the
+ * output encoder and the evaluation stack are written to a file, so that
+ * the evaluation can be resumed
+ * the nodes of the tree are saved with their number in preorder
+ */
+struct checkpoint {
+    const char *path;              // the file to write, NULL to only restore
+    double interval;               // seconds between two checkpoints
+    struct timespec last;          // time of the last checkpoint
+    unsigned countdown;            // commands before the next check of the clock
+
+    uint64_t hash;                 // hash of the program
+    const struct ast_node **nodes; // the nodes in preorder
+    struct checkpoint_index *sorted; // the nodes sorted by address
+    uint32_t count;
+};
+
+// prepare the checkpoints of the evaluation of a tree
+void checkpoint_create(struct checkpoint *self, const struct ast *root, const char *path, double interval);
+void checkpoint_destroy(struct checkpoint *self);
+
+// write a checkpoint if the interval is elapsed
+void checkpoint_poll(struct checkpoint *self, struct context *ctx);
+
+// write a checkpoint now, returns 0 on success
+int checkpoint_write(struct checkpoint *self, struct context *ctx);
+
+// restore a context from a checkpoint file, returns 0 on success
+// offset is the size of the output when the checkpoint was written, -1 if unknown
+int checkpoint_restore(const struct checkpoint *self, const char *path, struct context *ctx, int64_t *offset);
+
+#endif /* TURTLE_CHECKPOINT_H */
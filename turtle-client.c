@@ -0,0 +1,288 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*
+ * client of the server mode of turtle :
+ *   turtle-client SOCKET [--seed N] [program.turtle]   evaluate a program (stdin by default)
+ *   turtle-client SOCKET --stats                       latency histogram of the server
+ *   turtle-client SOCKET --bench N [--concurrency C] program.turtle
+ *                                                      send N requests from C threads
+ */
+
+struct bench {
+    const char *socket;
+    const char *request;
+    size_t size;
+    size_t next;        // next request to send
+    size_t count;       // number of requests
+    size_t failed;
+    double *latencies;  // latency of each request in microseconds
+    pthread_mutex_t lock;
+};
+
+/**
+ * intern function to get the time in microseconds
+ */
+static double client_now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+/**
+ * connect to the server
+ * @param path the path of the socket
+ * @return the connection, -1 on error
+ */
+static int client_connect(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        perror(path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * send a request and read the response
+ * @param path the path of the socket
+ * @param request the request
+ * @param size the size of the request
+ * @param out where to copy the response, NULL to drop it
+ * @return 0 if the last line of the response is "Done"
+ */
+static int client_request(const char *path, const char *request, size_t size, FILE *out) {
+    int fd = client_connect(path);
+    if (fd < 0) {
+        return -1;
+    }
+
+    while (size > 0) {
+        ssize_t n = write(fd, request, size);
+        if (n <= 0) {
+            perror("write");
+            close(fd);
+            return -1;
+        }
+        request += n;
+        size -= n;
+    }
+    shutdown(fd, SHUT_WR);
+
+    // the last line of the response is kept to know if the program failed
+    char last[256] = "";
+    size_t lastSize = 0;
+    bool newLine = true;
+    char buf[65536];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        if (out) {
+            fwrite(buf, 1, n, out);
+        }
+        for (ssize_t i = 0; i < n; ++i) {
+            if (newLine) {
+                lastSize = 0;
+                newLine = false;
+            }
+            if (buf[i] == '\n') {
+                newLine = true;
+            } else if (lastSize < sizeof(last) - 1) {
+                last[lastSize++] = buf[i];
+            }
+        }
+    }
+    last[lastSize] = '\0';
+    close(fd);
+
+    return strcmp(last, "Done") == 0 ? 0 : -1;
+}
+
+/**
+ * read a whole file
+ * @param path the file, NULL for stdin
+ * @param prefix the command line put before the content
+ * @param size the size of the request
+ * @return the request
+ */
+static char *client_read(const char *path, const char *prefix, size_t *size) {
+    FILE *in = stdin;
+    if (path) {
+        in = fopen(path, "r");
+        if (in == NULL) {
+            perror(path);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    size_t capacity = 4096;
+    *size = strlen(prefix);
+    char *buf = malloc(capacity);
+    assert(buf);
+    memcpy(buf, prefix, *size);
+
+    for (;;) {
+        if (*size == capacity) {
+            capacity *= 2;
+            buf = realloc(buf, capacity);
+            assert(buf);
+        }
+        size_t n = fread(buf + *size, 1, capacity - *size, in);
+        if (n == 0) {
+            break;
+        }
+        *size += n;
+    }
+
+    if (path) {
+        fclose(in);
+    }
+    return buf;
+}
+
+/**
+ * thread of the benchmark : send requests until all are sent
+ * @param data the benchmark
+ */
+static void *client_bench_worker(void *data) {
+    struct bench *b = data;
+
+    for (;;) {
+        pthread_mutex_lock(&b->lock);
+        size_t i = b->next++;
+        pthread_mutex_unlock(&b->lock);
+        if (i >= b->count) {
+            break;
+        }
+
+        double start = client_now_us();
+        int ret = client_request(b->socket, b->request, b->size, NULL);
+        b->latencies[i] = client_now_us() - start;
+
+        if (ret != 0) {
+            pthread_mutex_lock(&b->lock);
+            b->failed++;
+            pthread_mutex_unlock(&b->lock);
+        }
+    }
+
+    return NULL;
+}
+
+static int client_compare(const void *lhs, const void *rhs) {
+    double a = *(const double *) lhs;
+    double b = *(const double *) rhs;
+    return (a > b) - (a < b);
+}
+
+/**
+ * send count requests from concurrency threads and display the throughput and latencies
+ */
+static int client_bench(struct bench *b, size_t concurrency) {
+    b->latencies = calloc(b->count, sizeof(double));
+    pthread_t *threads = calloc(concurrency, sizeof(pthread_t));
+    assert(b->latencies && threads);
+    pthread_mutex_init(&b->lock, NULL);
+
+    double start = client_now_us();
+    for (size_t i = 0; i < concurrency; ++i) {
+        pthread_create(&threads[i], NULL, client_bench_worker, b);
+    }
+    for (size_t i = 0; i < concurrency; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    double elapsed = (client_now_us() - start) / 1e6;
+
+    qsort(b->latencies, b->count, sizeof(double), client_compare);
+    printf("requests %zu\n", b->count);
+    printf("failed %zu\n", b->failed);
+    printf("seconds %.3f\n", elapsed);
+    printf("requests_per_second %.1f\n", b->count / elapsed);
+    printf("p50_us %.0f\n", b->latencies[b->count / 2]);
+    printf("p90_us %.0f\n", b->latencies[(size_t) (b->count * 0.90)]);
+    printf("p99_us %.0f\n", b->latencies[(size_t) (b->count * 0.99)]);
+    printf("max_us %.0f\n", b->latencies[b->count - 1]);
+
+    free(threads);
+    free(b->latencies);
+    return b->failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s SOCKET [--seed N] [program.turtle]\n", prog);
+    fprintf(stderr, "       %s SOCKET --stats\n", prog);
+    fprintf(stderr, "       %s SOCKET --bench N [--concurrency C] program.turtle\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const char *socket = argv[1];
+    const char *input = NULL;
+    const char *seed = NULL;
+    bool stats = false;
+    size_t bench = 0;
+    size_t concurrency = 1;
+
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = argv[++i];
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            stats = true;
+        } else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc) {
+            bench = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--concurrency") == 0 && i + 1 < argc) {
+            concurrency = strtoul(argv[++i], NULL, 10);
+        } else if (argv[i][0] != '-' && input == NULL) {
+            input = argv[i];
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (stats) {
+        return client_request(socket, "STATS\n", 6, stdout) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    char prefix[64];
+    snprintf(prefix, sizeof(prefix), seed ? "RUN %s\n" : "RUN\n", seed);
+
+    size_t size;
+    char *request = client_read(input, prefix, &size);
+
+    int ret;
+    if (bench > 0) {
+        struct bench b;
+        memset(&b, 0, sizeof(struct bench));
+        b.socket = socket;
+        b.request = request;
+        b.size = size;
+        b.count = bench;
+        ret = client_bench(&b, concurrency > 0 ? concurrency : 1);
+    } else {
+        // the response ends with "Done" or the error, the exit status tells which
+        ret = client_request(socket, request, size, stdout) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    free(request);
+    return ret;
+}
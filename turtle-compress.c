@@ -0,0 +1,485 @@
+#include "turtle-compress.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define COMPRESS_MAGIC "TTLZ"
+#define COMPRESS_INDEX_MAGIC "TTLX"
+#define COMPRESS_VERSION 1
+
+// flag of the blocks stored as is
+#define COMPRESS_STORED 0x80000000U
+
+#define LZ_HASH_BITS 14
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+
+static uint32_t lz_read32(const unsigned char *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t lz_hash(uint32_t value) {
+    return (value * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+/**
+ * intern function to write the extra bytes of a length
+ */
+static unsigned char *lz_length(unsigned char *op, size_t length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (unsigned char) length;
+    return op;
+}
+
+/**
+ * intern function to write a sequence
+ * @param op where to write
+ * @param literals the literals
+ * @param count the number of literals
+ * @param offset the offset of the match, 0 for the last sequence
+ * @param length the length of the match
+ * @return the end of the sequence
+ */
+static unsigned char *lz_sequence(unsigned char *op, const unsigned char *literals, size_t count, size_t offset, size_t length) {
+    unsigned char *token = op++;
+    *token = (count < 15 ? count : 15) << 4;
+    if (count >= 15) {
+        op = lz_length(op, count - 15);
+    }
+    memcpy(op, literals, count);
+    op += count;
+
+    if (offset == 0) {
+        return op;
+    }
+
+    *op++ = offset & 0xFF;
+    *op++ = offset >> 8;
+    length -= LZ_MIN_MATCH;
+    *token |= length < 15 ? length : 15;
+    if (length >= 15) {
+        op = lz_length(op, length - 15);
+    }
+    return op;
+}
+
+/**
+ * compress a block
+ * @param src the data
+ * @param size the size of the data
+ * @param dst the compressed data, with COMPRESS_BOUND(size) bytes
+ * @return the size of the compressed data
+ */
+size_t compress_block(const unsigned char *src, size_t size, unsigned char *dst) {
+    uint32_t table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    unsigned char *op = dst;
+    size_t anchor = 0;
+    size_t pos = 0;
+    while (pos + LZ_MIN_MATCH <= size) {
+        uint32_t sequence = lz_read32(src + pos);
+        uint32_t hash = lz_hash(sequence);
+        size_t candidate = table[hash];
+        table[hash] = pos;
+
+        if (candidate >= pos || pos - candidate > LZ_MAX_OFFSET || lz_read32(src + candidate) != sequence) {
+            // the longer nothing matches, the bigger the steps
+            pos += 1 + ((pos - anchor) >> 6);
+            continue;
+        }
+
+        size_t length = LZ_MIN_MATCH;
+        while (pos + length + 8 <= size && memcmp(src + candidate + length, src + pos + length, 8) == 0) {
+            length += 8;
+        }
+        while (pos + length < size && src[candidate + length] == src[pos + length]) {
+            ++length;
+        }
+
+        op = lz_sequence(op, src + anchor, pos - anchor, pos - candidate, length);
+        pos += length;
+        anchor = pos;
+    }
+
+    op = lz_sequence(op, src + anchor, size - anchor, 0, 0);
+    return op - dst;
+}
+
+/**
+ * intern function to read the extra bytes of a length
+ * @return false if the data ends before
+ */
+static bool lz_read_length(const unsigned char **ip, const unsigned char *end, size_t *length) {
+    unsigned char byte;
+    do {
+        if (*ip >= end) {
+            return false;
+        }
+        byte = *(*ip)++;
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+/**
+ * decompress a block
+ * @param src the compressed data
+ * @param size the size of the compressed data
+ * @param dst the data
+ * @param capacity the size of the data
+ * @return 0 on success, -1 if the compressed data is corrupted
+ */
+int decompress_block(const unsigned char *src, size_t size, unsigned char *dst, size_t capacity) {
+    const unsigned char *ip = src;
+    const unsigned char *end = src + size;
+    unsigned char *op = dst;
+    unsigned char *oend = dst + capacity;
+
+    while (ip < end) {
+        unsigned token = *ip++;
+
+        size_t count = token >> 4;
+        if (count == 15 && !lz_read_length(&ip, end, &count)) {
+            return -1;
+        }
+        if (count > (size_t) (end - ip) || count > (size_t) (oend - op)) {
+            return -1;
+        }
+        memcpy(op, ip, count);
+        ip += count;
+        op += count;
+
+        if (ip == end) {
+            break;
+        }
+
+        if (end - ip < 2) {
+            return -1;
+        }
+        size_t offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        size_t length = token & 15;
+        if (length == 15 && !lz_read_length(&ip, end, &length)) {
+            return -1;
+        }
+        length += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t) (op - dst) || length > (size_t) (oend - op)) {
+            return -1;
+        }
+
+        const unsigned char *match = op - offset;
+        if (offset >= length) {
+            memcpy(op, match, length);
+            op += length;
+        } else {
+            // the match overlaps what it writes
+            for (size_t i = 0; i < length; ++i) {
+                *op++ = match[i];
+            }
+        }
+    }
+
+    return op == oend ? 0 : -1;
+}
+
+static void write_le32(unsigned char *p, uint32_t value) {
+    p[0] = value & 0xFF;
+    p[1] = (value >> 8) & 0xFF;
+    p[2] = (value >> 16) & 0xFF;
+    p[3] = value >> 24;
+}
+
+static uint32_t read_le32(const unsigned char *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+/**
+ * intern function to fill a block from the pipe
+ * @return the size of the block, less than COMPRESS_BLOCK_SIZE at the end
+ */
+static size_t compress_fill(int fd, unsigned char *block) {
+    size_t size = 0;
+    while (size < COMPRESS_BLOCK_SIZE) {
+        ssize_t n = read(fd, block + size, COMPRESS_BLOCK_SIZE - size);
+        if (n == 0) {
+            break;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        size += n;
+    }
+    return size;
+}
+
+/**
+ * thread compressing the blocks read from the pipe
+ * @param data the compression
+ */
+static void *compress_worker(void *data) {
+    struct compress *self = data;
+    unsigned char *block = malloc(COMPRESS_BLOCK_SIZE);
+    unsigned char *packed = malloc(8 + COMPRESS_BOUND(COMPRESS_BLOCK_SIZE));
+    assert(block && packed);
+
+    for (;;) {
+        size_t size = compress_fill(self->fd, block);
+        if (size == 0) {
+            break;
+        }
+
+        size_t packedSize = compress_block(block, size, packed + 8);
+        uint32_t field = packedSize;
+        if (packedSize >= size) {
+            memcpy(packed + 8, block, size);
+            packedSize = size;
+            field = size | COMPRESS_STORED;
+        }
+        write_le32(packed, field);
+        write_le32(packed + 4, size);
+        fwrite(packed, 1, 8 + packedSize, self->dst);
+
+        if (self->count == self->capacity) {
+            self->capacity = self->capacity ? 2 * self->capacity : 64;
+            self->sizes = realloc(self->sizes, 2 * self->capacity * sizeof(uint32_t));
+            assert(self->sizes);
+        }
+        self->sizes[2 * self->count] = field;
+        self->sizes[2 * self->count + 1] = size;
+        self->count++;
+    }
+
+    free(block);
+    free(packed);
+    return NULL;
+}
+
+/**
+ * start the compression : what is written to the stream returned is
+ * compressed by a thread to dst
+ * @param self the compression
+ * @param dst the compressed output
+ * @return the stream to write to, NULL on error
+ */
+FILE *compress_open(struct compress *self, FILE *dst) {
+    memset(self, 0, sizeof(struct compress));
+    self->dst = dst;
+
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        return NULL;
+    }
+    self->fd = fds[0];
+
+    unsigned char header[9];
+    memcpy(header, COMPRESS_MAGIC, 4);
+    header[4] = COMPRESS_VERSION;
+    write_le32(header + 5, COMPRESS_BLOCK_SIZE);
+    fwrite(header, 1, sizeof(header), dst);
+
+    if (pthread_create(&self->thread, NULL, compress_worker, self) != 0) {
+        perror("pthread_create");
+        close(fds[0]);
+        close(fds[1]);
+        return NULL;
+    }
+
+    FILE *stream = fdopen(fds[1], "w");
+    assert(stream);
+    setvbuf(stream, NULL, _IOFBF, 65536);
+    return stream;
+}
+
+/**
+ * close the stream, wait for the last block and write the index
+ * @param self the compression
+ * @param stream the stream returned by compress_open
+ * @return 0 on success
+ */
+int compress_close(struct compress *self, FILE *stream) {
+    fclose(stream);
+    pthread_join(self->thread, NULL);
+    close(self->fd);
+
+    unsigned char buf[8];
+    write_le32(buf, 0);
+    write_le32(buf + 4, 0);
+    fwrite(buf, 1, 8, self->dst);
+
+    for (size_t i = 0; i < 2 * self->count; ++i) {
+        write_le32(buf, self->sizes[i]);
+        fwrite(buf, 1, 4, self->dst);
+    }
+    write_le32(buf, self->count);
+    memcpy(buf + 4, COMPRESS_INDEX_MAGIC, 4);
+    fwrite(buf, 1, 8, self->dst);
+
+    free(self->sizes);
+    fflush(self->dst);
+    return ferror(self->dst) ? -1 : 0;
+}
+
+// a block to decompress
+struct decompress_block {
+    pthread_t thread;
+    unsigned char *src;
+    size_t size;
+    bool stored;
+    unsigned char *dst;
+    size_t capacity;
+    int status;
+};
+
+static void *decompress_worker(void *data) {
+    struct decompress_block *block = data;
+    if (block->stored) {
+        memcpy(block->dst, block->src, block->capacity);
+        block->status = 0;
+    } else {
+        block->status = decompress_block(block->src, block->size, block->dst, block->capacity);
+    }
+    return NULL;
+}
+
+/**
+ * intern function to check the index at the end of a compressed file
+ * against the blocks read before it
+ * @param in the input, after the empty block
+ * @param sizes the size pairs of the blocks read
+ * @param count the number of blocks read
+ * @return 0 if the index matches and ends the file
+ */
+static int decompress_index(FILE *in, const uint32_t *sizes, size_t count) {
+    unsigned char buf[8];
+    for (size_t i = 0; i < count; ++i) {
+        if (fread(buf, 1, 8, in) != 8 || read_le32(buf) != sizes[2 * i] || read_le32(buf + 4) != sizes[2 * i + 1]) {
+            return -1;
+        }
+    }
+    if (fread(buf, 1, 8, in) != 8 || read_le32(buf) != count || memcmp(buf + 4, COMPRESS_INDEX_MAGIC, 4) != 0
+        || fgetc(in) != EOF) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * decompress a file, the blocks are read in order and decompressed
+ * by rounds of one block per thread
+ * @param in the compressed input
+ * @param out the output
+ * @param threads the number of threads
+ * @return 0 on success
+ */
+int decompress_file(FILE *in, FILE *out, unsigned threads) {
+    unsigned char header[9];
+    if (fread(header, 1, 9, in) != 9 || memcmp(header, COMPRESS_MAGIC, 4) != 0 || header[4] != COMPRESS_VERSION) {
+        fprintf(stderr, "Error : the input is not compressed\n");
+        return -1;
+    }
+    size_t blockSize = read_le32(header + 5);
+    if (blockSize == 0 || blockSize > 64 * COMPRESS_BLOCK_SIZE) {
+        fprintf(stderr, "Error : the compressed input is corrupted\n");
+        return -1;
+    }
+
+    threads = threads > 0 ? threads : 1;
+    struct decompress_block *blocks = calloc(threads, sizeof(struct decompress_block));
+    assert(blocks);
+    for (unsigned i = 0; i < threads; ++i) {
+        blocks[i].src = malloc(COMPRESS_BOUND(blockSize));
+        blocks[i].dst = malloc(blockSize);
+        assert(blocks[i].src && blocks[i].dst);
+    }
+
+    // the size pairs of the blocks read, to check the index
+    uint32_t *pairs = NULL;
+    size_t pairsCount = 0;
+    size_t pairsCapacity = 0;
+
+    int status = 0;
+    bool last = false;
+    while (!last && status == 0) {
+        unsigned count = 0;
+        while (count < threads) {
+            unsigned char sizes[8];
+            if (fread(sizes, 1, 8, in) != 8) {
+                status = -1;
+                break;
+            }
+            uint32_t field = read_le32(sizes);
+            struct decompress_block *block = &blocks[count];
+            block->stored = field & COMPRESS_STORED;
+            block->size = field & ~COMPRESS_STORED;
+            block->capacity = read_le32(sizes + 4);
+            if (block->size == 0 && block->capacity == 0) {
+                // the index follows
+                last = true;
+                break;
+            }
+            if (block->capacity > blockSize || block->size > COMPRESS_BOUND(blockSize)
+                || (block->stored && block->size != block->capacity)
+                || fread(block->src, 1, block->size, in) != block->size) {
+                status = -1;
+                break;
+            }
+            if (pairsCount == pairsCapacity) {
+                pairsCapacity = pairsCapacity ? 2 * pairsCapacity : 64;
+                pairs = realloc(pairs, 2 * pairsCapacity * sizeof(uint32_t));
+                assert(pairs);
+            }
+            pairs[2 * pairsCount] = field;
+            pairs[2 * pairsCount + 1] = block->capacity;
+            pairsCount++;
+            ++count;
+        }
+
+        for (unsigned i = 0; i < count; ++i) {
+            if (count == 1 || pthread_create(&blocks[i].thread, NULL, decompress_worker, &blocks[i]) != 0) {
+                decompress_worker(&blocks[i]);
+                blocks[i].thread = pthread_self();
+            }
+        }
+        for (unsigned i = 0; i < count; ++i) {
+            if (!pthread_equal(blocks[i].thread, pthread_self())) {
+                pthread_join(blocks[i].thread, NULL);
+            }
+            if (blocks[i].status != 0) {
+                status = -1;
+            }
+            if (status == 0) {
+                fwrite(blocks[i].dst, 1, blocks[i].capacity, out);
+            }
+        }
+    }
+
+    for (unsigned i = 0; i < threads; ++i) {
+        free(blocks[i].src);
+        free(blocks[i].dst);
+    }
+    free(blocks);
+
+    if (status == 0 && decompress_index(in, pairs, pairsCount) != 0) {
+        status = -1;
+    }
+    free(pairs);
+
+    if (status != 0) {
+        fprintf(stderr, "Error : the compressed input is corrupted\n");
+    }
+    return status;
+}
@@ -0,0 +1,59 @@
+#ifndef TURTLE_COMPRESS_H
+#define TURTLE_COMPRESS_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// size of the independent blocks of the output
+#define COMPRESS_BLOCK_SIZE (256 * 1024)
+
+// largest size of a compressed block of size bytes
+#define COMPRESS_BOUND(size) ((size) + (size) / 255 + 16)
+
+/*
+ * compression of the output with a LZ77 codec in the manner of LZ4
+ *
+ * the file starts with "TTLZ", a version byte and the size of the blocks (u32)
+ * then each block is its compressed size (u32, the high bit set if the block
+ * is stored as is), its size (u32) and its data. an empty block ends the
+ * blocks, followed by the index : the size pairs of the blocks again, their
+ * number (u32) and "TTLX". the integers are little endian
+ *
+ * the blocks are independent : with the index a reader can seek to a block
+ * and decompress the blocks in parallel. decompress_file reads the blocks in
+ * order and checks that the index matches them and ends the file
+ *
+ * a compressed block is a sequence of a token (literal length << 4 | match
+ * length - 4), the extra bytes of the literal length (255 while it goes on),
+ * the literals, the offset of the match (u16), the extra bytes of the match
+ * length. the last sequence has only literals
+ */
+
+// the thread compressing what is written to a pipe
+struct compress {
+    pthread_t thread;
+    int fd;                 // read end of the pipe
+    FILE *dst;              // the compressed output
+    uint32_t *sizes;        // size pairs of the blocks, for the index
+    size_t count;
+    size_t capacity;
+};
+
+// compress a block, returns the compressed size, dst must have COMPRESS_BOUND(size) bytes
+size_t compress_block(const unsigned char *src, size_t size, unsigned char *dst);
+
+// decompress a block of exactly capacity bytes, returns 0 on success
+int decompress_block(const unsigned char *src, size_t size, unsigned char *dst, size_t capacity);
+
+// start the compression to dst, returns the stream to write to
+FILE *compress_open(struct compress *self, FILE *dst);
+
+// close the stream returned by compress_open and finish the file, returns 0 on success
+int compress_close(struct compress *self, FILE *stream);
+
+// decompress a file with a number of threads, returns 0 on success
+int decompress_file(FILE *in, FILE *out, unsigned threads);
+
+#endif /* TURTLE_COMPRESS_H */
@@ -0,0 +1,368 @@
+#include "turtle-dedup.h"
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// sine of the angle under which two consecutive segments are merged
+#define DEDUP_MERGE_ANGLE 1e-9
+
+// what to do with a segment compared to the segments written
+enum dedup_result {
+    DEDUP_KEEP,
+    DEDUP_REMOVE,
+    DEDUP_TRIM,
+};
+
+/**
+ * intern function to pack a color as it is written in the text format
+ * @param color the components, between 0 and 1
+ * @return the color on 21 bits per component
+ */
+static uint64_t dedup_color(const double *color) {
+    uint64_t packed = 0;
+    for (size_t i = 0; i < 3; ++i) {
+        packed = packed << 21 | (uint64_t) llround(color[i] * 1e6);
+    }
+    return packed;
+}
+
+/**
+ * intern function to put a point on the grid
+ * @param self the stage
+ * @param x the abscissa
+ * @param y the ordinate
+ * @param q the point on the grid
+ * @return false if the point is too far or not a number
+ */
+static bool dedup_quantize(const struct dedup *self, double x, double y, int64_t *q) {
+    double qx = x * self->grid;
+    double qy = y * self->grid;
+    if (!(fabs(qx) < 4e18) || !(fabs(qy) < 4e18)) {
+        return false;
+    }
+    q[0] = llround(qx);
+    q[1] = llround(qy);
+    return true;
+}
+
+/**
+ * intern function to get the bucket of an end
+ * @param self the stage
+ * @param q the end on the grid
+ * @param color the color of the segment
+ * @return the first slot of the bucket
+ */
+static struct dedup_segment *dedup_bucket(const struct dedup *self, const int64_t *q, uint64_t color) {
+    uint64_t h = (uint64_t) q[0] * 0x9E3779B97F4A7C15ULL ^ (uint64_t) q[1] * 0xC2B2AE3D27D4EB4FULL ^ color * 0x165667B19E3779F9ULL;
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 32;
+    return &self->buckets[(h & (DEDUP_BUCKETS - 1)) * DEDUP_WAYS];
+}
+
+/**
+ * intern function to add a segment to a bucket, in place of the oldest one
+ * @param self the stage
+ * @param a the end of the bucket
+ * @param b the other end
+ * @param q a on the grid
+ * @param color the color of the segment
+ */
+static void dedup_insert(struct dedup *self, const double *a, const double *b, const int64_t *q, uint64_t color) {
+    struct dedup_segment *bucket = dedup_bucket(self, q, color);
+    uint8_t *next = &self->next[(bucket - self->buckets) / DEDUP_WAYS];
+    struct dedup_segment *segment = &bucket[*next];
+    *next = (*next + 1) % DEDUP_WAYS;
+    segment->x1 = a[0];
+    segment->y1 = a[1];
+    segment->x2 = b[0];
+    segment->y2 = b[1];
+    segment->color = color;
+}
+
+/**
+ * intern function to add a segment to the buckets of both its ends
+ * @param self the stage
+ * @param a the start of the segment
+ * @param b the end of the segment
+ * @param color the color of the segment
+ */
+static void dedup_index(struct dedup *self, const double *a, const double *b, uint64_t color) {
+    int64_t qa[2];
+    int64_t qb[2];
+    if (!dedup_quantize(self, a[0], a[1], qa) || !dedup_quantize(self, b[0], b[1], qb)) {
+        return;
+    }
+    dedup_insert(self, a, b, qa, color);
+    if (qa[0] != qb[0] || qa[1] != qb[1]) {
+        dedup_insert(self, b, a, qb, color);
+    }
+}
+
+/**
+ * intern function to write the LineTo kept to be merged
+ * the Color and the MoveTo are written first when they changed
+ * @param self the stage
+ */
+static void dedup_flush(struct dedup *self) {
+    if (!self->pending) {
+        return;
+    }
+    if (memcmp(self->pendingColor, self->writtenColor, sizeof(self->writtenColor)) != 0) {
+        output_color(&self->output, self->out, self->pendingColor[0], self->pendingColor[1], self->pendingColor[2]);
+        memcpy(self->writtenColor, self->pendingColor, sizeof(self->writtenColor));
+    }
+    if (!self->placed || self->written[0] != self->from[0] || self->written[1] != self->from[1]) {
+        output_point(&self->output, self->out, self->from[0], self->from[1], true);
+    }
+    output_point(&self->output, self->out, self->to[0], self->to[1], false);
+    memcpy(self->written, self->to, sizeof(self->written));
+
+    // the whole line covers the segments which start from one of its ends
+    if (self->pendingMerged) {
+        dedup_index(self, self->from, self->to, dedup_color(self->pendingColor));
+    }
+    self->placed = true;
+    self->pending = false;
+}
+
+/**
+ * intern function to keep a segment as the LineTo to be merged, or merge it
+ * with the previous one when it goes on in the same direction
+ * @param self the stage
+ * @param a the start of the segment
+ * @param b the end of the segment
+ */
+static void dedup_emit(struct dedup *self, const double *a, const double *b) {
+    if (self->pending && a[0] == self->to[0] && a[1] == self->to[1]
+        && memcmp(self->color, self->pendingColor, sizeof(self->color)) == 0) {
+        double ux = self->to[0] - self->from[0];
+        double uy = self->to[1] - self->from[1];
+        double vx = b[0] - a[0];
+        double vy = b[1] - a[1];
+        double dot = ux * vx + uy * vy;
+        if (dot > 0 && fabs(ux * vy - uy * vx) <= DEDUP_MERGE_ANGLE * hypot(ux, uy) * hypot(vx, vy)) {
+            memcpy(self->to, b, sizeof(self->to));
+            self->pendingMerged = true;
+            self->merged++;
+            return;
+        }
+    }
+    dedup_flush(self);
+    memcpy(self->from, a, sizeof(self->from));
+    memcpy(self->to, b, sizeof(self->to));
+    memcpy(self->pendingColor, self->color, sizeof(self->pendingColor));
+    self->pending = true;
+    self->pendingMerged = false;
+}
+
+/**
+ * intern function to compare a segment with a segment written from one of its ends
+ * @param self the stage
+ * @param end the end of the segment
+ * @param far the other end of the segment
+ * @param qend end on the grid
+ * @param qfar far on the grid
+ * @param p1 the start of the segment written
+ * @param p2 the end of the segment written
+ * @param covered the length of the segment already drawn from end, updated on DEDUP_TRIM
+ *                when the segment written covers more of it
+ * @param cut the end of the part not drawn yet, updated with covered
+ * @return what to do with the segment
+ */
+static enum dedup_result dedup_overlap(const struct dedup *self, const double *end, const double *far,
+                                       const int64_t *qend, const int64_t *qfar, const double *p1, const double *p2,
+                                       double *covered, double *cut) {
+    int64_t q1[2];
+    int64_t q2[2];
+    if (!dedup_quantize(self, p1[0], p1[1], q1) || q1[0] != qend[0] || q1[1] != qend[1]
+        || !dedup_quantize(self, p2[0], p2[1], q2)) {
+        return DEDUP_KEEP;
+    }
+    if (q2[0] == qfar[0] && q2[1] == qfar[1]) {
+        return DEDUP_REMOVE;
+    }
+
+    // the segment written goes from the end in the same direction
+    double ux = p2[0] - end[0];
+    double uy = p2[1] - end[1];
+    double vx = far[0] - end[0];
+    double vy = far[1] - end[1];
+    double lu = hypot(ux, uy);
+    double lv = hypot(vx, vy);
+    if (ux * vx + uy * vy <= 0 || fabs(ux * vy - uy * vx) > fmin(lu, lv) / self->grid) {
+        return DEDUP_KEEP;
+    }
+    if (lv <= lu) {
+        return DEDUP_REMOVE;
+    }
+    if (lu <= *covered) {
+        return DEDUP_KEEP;
+    }
+    *covered = lu;
+    cut[0] = p2[0];
+    cut[1] = p2[1];
+    return DEDUP_TRIM;
+}
+
+/**
+ * intern function to compare a segment with the segments written from its ends,
+ * and with the LineTo being merged
+ * @param self the stage
+ * @param a the start of the segment, the end of the part not drawn yet on DEDUP_TRIM
+ * @param b the end of the segment, the end of the part not drawn yet on DEDUP_TRIM
+ * @param color the color of the segment
+ * @return what to do with the segment
+ */
+static enum dedup_result dedup_compare(const struct dedup *self, double *a, double *b, uint64_t color) {
+    int64_t qa[2];
+    int64_t qb[2];
+    dedup_quantize(self, a[0], a[1], qa);
+    dedup_quantize(self, b[0], b[1], qb);
+    bool run = self->pendingMerged && dedup_color(self->pendingColor) == color;
+
+    // the segment is cut by the written segment which covers most of it
+    enum dedup_result result = DEDUP_KEEP;
+    for (int side = 0; side < 2 && result == DEDUP_KEEP; ++side) {
+        double *end = side ? b : a;
+        const double *far = side ? a : b;
+        const int64_t *qend = side ? qb : qa;
+        const int64_t *qfar = side ? qa : qb;
+        const struct dedup_segment *bucket = dedup_bucket(self, qend, color);
+        double covered = 0.0;
+        double cut[2];
+        for (size_t i = 0; i < DEDUP_WAYS + 2 * run; ++i) {
+            enum dedup_result overlap = DEDUP_KEEP;
+            if (i < DEDUP_WAYS && bucket[i].color == color) {
+                double p1[2] = { bucket[i].x1, bucket[i].y1 };
+                double p2[2] = { bucket[i].x2, bucket[i].y2 };
+                overlap = dedup_overlap(self, end, far, qend, qfar, p1, p2, &covered, cut);
+            } else if (i >= DEDUP_WAYS) {
+                const double *p1 = i == DEDUP_WAYS ? self->from : self->to;
+                const double *p2 = i == DEDUP_WAYS ? self->to : self->from;
+                overlap = dedup_overlap(self, end, far, qend, qfar, p1, p2, &covered, cut);
+            }
+            if (overlap == DEDUP_REMOVE) {
+                return DEDUP_REMOVE;
+            }
+            if (overlap == DEDUP_TRIM) {
+                result = DEDUP_TRIM;
+            }
+        }
+        if (result == DEDUP_TRIM) {
+            end[0] = cut[0];
+            end[1] = cut[1];
+        }
+    }
+    return result;
+}
+
+/**
+ * intern function to receive a point from the evaluator
+ * @param data the stage
+ * @param x the abscissa
+ * @param y the ordinate
+ * @param move true for MoveTo, false for LineTo
+ */
+static void dedup_point(void *data, double x, double y, bool move) {
+    struct dedup *self = data;
+    double a[2] = { self->x, self->y };
+    double b[2] = { x, y };
+    self->x = x;
+    self->y = y;
+    if (move) {
+        return;
+    }
+
+    self->segments++;
+    int64_t qa[2];
+    int64_t qb[2];
+    if (!dedup_quantize(self, a[0], a[1], qa) || !dedup_quantize(self, b[0], b[1], qb)) {
+        // nothing to compare with, it is written as is
+        dedup_emit(self, a, b);
+        dedup_flush(self);
+        return;
+    }
+
+    uint64_t color = dedup_color(self->color);
+    bool trimmed = false;
+    for (int i = 0; i < DEDUP_TRIMS; ++i) {
+        enum dedup_result result = dedup_compare(self, a, b, color);
+        if (result == DEDUP_REMOVE) {
+            self->removed++;
+            return;
+        }
+        if (result == DEDUP_KEEP) {
+            break;
+        }
+        trimmed = true;
+    }
+    self->trimmed += trimmed;
+
+    dedup_index(self, a, b, color);
+    dedup_emit(self, a, b);
+}
+
+/**
+ * intern function to receive a color from the evaluator
+ * @param data the stage
+ * @param r the red component
+ * @param g the green component
+ * @param b the blue component
+ */
+static void dedup_color_set(void *data, double r, double g, double b) {
+    struct dedup *self = data;
+    self->color[0] = r;
+    self->color[1] = g;
+    self->color[2] = b;
+}
+
+/**
+ * start the stage, the primitives written with output go through it
+ * @param self the stage
+ * @param output the encoder of the evaluator, its state goes to the stage
+ * @param out where the stage writes
+ * @param grid grid steps per unit to compare the ends of the segments
+ * @return 0 on success
+ */
+int dedup_open(struct dedup *self, struct output *output, FILE *out, uint64_t grid) {
+    memset(self, 0, sizeof(struct dedup));
+    self->buckets = malloc(DEDUP_BUCKETS * DEDUP_WAYS * sizeof(struct dedup_segment));
+    self->next = calloc(DEDUP_BUCKETS, sizeof(uint8_t));
+    if (!self->buckets || !self->next) {
+        free(self->buckets);
+        free(self->next);
+        return -1;
+    }
+    for (size_t i = 0; i < DEDUP_BUCKETS * DEDUP_WAYS; ++i) {
+        self->buckets[i].color = UINT64_MAX;
+    }
+    self->grid = grid;
+
+    // the viewer starts at the origin, in black
+    self->placed = true;
+    self->out = out;
+    self->output = *output;
+    self->output.sink = NULL;
+    self->sink.point = dedup_point;
+    self->sink.color = dedup_color_set;
+    self->sink.data = self;
+    output->sink = &self->sink;
+    return 0;
+}
+
+/**
+ * write the last segment, report the segments removed and stop the stage
+ * @param self the stage
+ * @param output the encoder of the evaluator, it gets the state of the stage back
+ */
+void dedup_close(struct dedup *self, struct output *output) {
+    dedup_flush(self);
+    fprintf(stderr, "segments : %" PRIu64 " drawn, %" PRIu64 " removed, %" PRIu64 " cut, %" PRIu64 " merged\n",
+            self->segments, self->removed, self->trimmed, self->merged);
+    *output = self->output;
+    free(self->buckets);
+    free(self->next);
+}
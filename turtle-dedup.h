@@ -0,0 +1,80 @@
+#ifndef TURTLE_DEDUP_H
+#define TURTLE_DEDUP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "turtle-output.h"
+
+// default number of grid steps per unit to compare the ends of the segments
+#define DEDUP_GRID_DEFAULT 1000
+
+// buckets of the spatial hash, a power of 2, and segments kept per bucket
+#define DEDUP_BUCKETS (1 << 17)
+#define DEDUP_WAYS 4
+
+// times a segment is cut by the segments it overlaps before it is kept as is
+#define DEDUP_TRIMS 8
+
+// a segment written, its ends as given by the evaluator
+struct dedup_segment {
+    double x1;              // the end of the bucket
+    double y1;
+    double x2;              // the other end
+    double y2;
+    uint64_t color;         // the color, see dedup_color, UINT64_MAX for an empty slot
+};
+
+/*
+ * output stage which removes the segments drawn again : the evaluator gives
+ * the primitives to the stage, which writes them with its own encoder
+ * - a segment whose ends fall in the same grid steps as a segment written
+ *   before, in the same color and in either direction, is removed
+ * - a segment which goes on in the same direction from an end of a collinear
+ *   segment written before is cut to the part which is not drawn yet, and
+ *   removed when it is all drawn
+ * - the consecutive collinear segments in the same direction are merged in a
+ *   single LineTo, which is compared with the next segments as a whole
+ * the segments written are kept in a spatial hash keyed by their ends on the
+ * grid : each bucket holds DEDUP_WAYS segments, the oldest one is replaced.
+ * the memory is bounded, a segment forgotten is only not compared anymore
+ * the MoveTo and Color are written when a segment needs them
+ */
+struct dedup {
+    double grid;                        // grid steps per unit
+    struct dedup_segment *buckets;      // DEDUP_BUCKETS * DEDUP_WAYS segments
+    uint8_t *next;                      // slot replaced next in each bucket
+
+    double x;                           // position of the evaluator
+    double y;
+    double color[3];                    // color of the evaluator
+
+    bool pending;                       // a LineTo is kept to be merged
+    double from[2];                     // its start
+    double to[2];                       // its end
+    double pendingColor[3];
+    bool pendingMerged;                 // it was merged with the next segments
+
+    bool placed;                        // the last point written is known
+    double written[2];                  // the last point written
+    double writtenColor[3];             // the last color written
+
+    uint64_t segments;                  // segments given by the evaluator
+    uint64_t removed;                   // segments all drawn before
+    uint64_t trimmed;                   // segments cut
+    uint64_t merged;                    // segments merged with the previous one
+
+    FILE *out;
+    struct output output;               // the encoder of the stage
+    struct output_sink sink;            // the evaluator side
+};
+
+// start the stage, the primitives of output go to out through it
+// returns 0 on success
+int dedup_open(struct dedup *self, struct output *output, FILE *out, uint64_t grid);
+
+// write the last segment, report the segments removed to stderr and give back the encoder state
+void dedup_close(struct dedup *self, struct output *output);
+
+#endif /* TURTLE_DEDUP_H */
@@ -0,0 +1,603 @@
+#include "turtle-emit.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the runtime before the program
+static const char *emit_prelude =
+    "#define _POSIX_C_SOURCE 200809L\n"
+    "\n"
+    "#include <math.h>\n"
+    "#include <pthread.h>\n"
+    "#include <stdarg.h>\n"
+    "#include <stdbool.h>\n"
+    "#include <stdint.h>\n"
+    "#include <stdio.h>\n"
+    "#include <stdlib.h>\n"
+    "#include <string.h>\n"
+    "#include <time.h>\n"
+    "\n"
+    "static double rt_x;\n"
+    "static double rt_y;\n"
+    "static double rt_angle;\n"
+    "static bool rt_up;\n"
+    "static double rt_r;\n"
+    "static double rt_g;\n"
+    "static double rt_b;\n"
+    "static uint64_t rt_seed;\n"
+    "static size_t rt_max_depth = %d;\n"
+    "\n"
+    "static inline void rt_error(int line, int status, const char *fmt, ...) {\n"
+    "    char msg[%d];\n"
+    "    va_list ap;\n"
+    "    va_start(ap, fmt);\n"
+    "    vsnprintf(msg, sizeof(msg), fmt, ap);\n"
+    "    va_end(ap);\n"
+    "    if (line > 0) {\n"
+    "        fprintf(stderr, \"Error : line %%d : %%s\\n\", line, msg);\n"
+    "    } else {\n"
+    "        fprintf(stderr, \"Error : %%s\\n\", msg);\n"
+    "    }\n"
+    "    exit(status);\n"
+    "}\n"
+    "\n"
+    "static inline double rt_no_var(int line, const char *name) {\n"
+    "    rt_error(line, %d, \"no variable with the name %%s\", name);\n"
+    "    return -1;\n"
+    "}\n"
+    "\n"
+    "static inline double rt_random(void) {\n"
+    "    uint64_t z = (rt_seed += 0x9E3779B97F4A7C15ULL);\n"
+    "    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;\n"
+    "    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;\n"
+    "    z = z ^ (z >> 31);\n"
+    "    return (double) (z >> 11) * (1.0 / 9007199254740992.0);\n"
+    "}\n"
+    "\n"
+    "static inline double rt_pow(double base, double exponent) {\n"
+    "    if (exponent < 0 || exponent >= 32 || exponent != floor(exponent)\n"
+    "            || base != floor(base) || fabs(base) > 9007199254740992.0) {\n"
+    "        return pow(base, exponent);\n"
+    "    }\n"
+    "    unsigned n = (unsigned) exponent;\n"
+    "    double res = 1.0;\n"
+    "    double square = base;\n"
+    "    while (n) {\n"
+    "        if (n & 1) {\n"
+    "            res *= square;\n"
+    "            if (fabs(res) > 9007199254740992.0) {\n"
+    "                return pow(base, exponent);\n"
+    "            }\n"
+    "        }\n"
+    "        n >>= 1;\n"
+    "        if (n) {\n"
+    "            square *= square;\n"
+    "            if (square > 9007199254740992.0) {\n"
+    "                return pow(base, exponent);\n"
+    "            }\n"
+    "        }\n"
+    "    }\n"
+    "    return res;\n"
+    "}\n"
+    "\n"
+    "static inline void rt_right(double value) {\n"
+    "    rt_angle -= value;\n"
+    "    if (rt_angle > 360) {\n"
+    "        rt_angle -= 360;\n"
+    "    }\n"
+    "    if (rt_angle < 0) {\n"
+    "        rt_angle += 360;\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "static inline void rt_left(double value) {\n"
+    "    rt_angle += value;\n"
+    "    if (rt_angle > 360) {\n"
+    "        rt_angle -= 360;\n"
+    "    }\n"
+    "    if (rt_angle < 0) {\n"
+    "        rt_angle += 360;\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "static inline void rt_point(bool move) {\n"
+    "    printf(move ? \"MoveTo %%f %%f\\n\" : \"LineTo %%f %%f\\n\", rt_x, rt_y);\n"
+    "}\n"
+    "\n"
+    "static inline void rt_color(int line, double r, double g, double b) {\n"
+    "    rt_r = r;\n"
+    "    rt_g = g;\n"
+    "    rt_b = b;\n"
+    "    if (r < 0 || r > 1 || g < 0 || g > 1 || b < 0 || b > 1) {\n"
+    "        rt_error(line, %d, \"color values must be in [0 - 1] interval\");\n"
+    "    }\n"
+    "    printf(\"Color %%f %%f %%f\\n\", r, g, b);\n"
+    "}\n"
+    "\n"
+    "static inline void rt_home(void) {\n"
+    "    rt_x = 0.0;\n"
+    "    rt_y = 0.0;\n"
+    "    rt_angle = 0.0;\n"
+    "    rt_up = false;\n"
+    "    rt_r = 0.0;\n"
+    "    rt_g = 0.0;\n"
+    "    rt_b = 0.0;\n"
+    "}\n"
+    "\n"
+    "static inline void rt_depth(int line, size_t depth) {\n"
+    "    if (depth > rt_max_depth) {\n"
+    "        rt_error(line, %d, \"maximum recursion depth (%%zu) exceeded\", rt_max_depth);\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "static void program(void);\n"
+    "\n";
+
+// the entry point after the program
+static const char *emit_postlude =
+    "\n"
+    "static void *rt_run(void *data) {\n"
+    "    program();\n"
+    "    return NULL;\n"
+    "}\n"
+    "\n"
+    "int main(int argc, char *argv[]) {\n"
+    "    rt_seed = time(NULL);\n"
+    "    for (int i = 1; i + 1 < argc; i += 2) {\n"
+    "        if (strcmp(argv[i], \"--seed\") == 0) {\n"
+    "            rt_seed = strtoull(argv[i + 1], NULL, 10);\n"
+    "        } else if (strcmp(argv[i], \"--max-depth\") == 0) {\n"
+    "            rt_max_depth = strtoul(argv[i + 1], NULL, 10);\n"
+    "        }\n"
+    "    }\n"
+    "    static char buf[65536];\n"
+    "    setvbuf(stdout, buf, _IOFBF, sizeof(buf));\n"
+    "\n"
+    "    // the calls are native, the stack grows with the depth\n"
+    "    pthread_attr_t attr;\n"
+    "    pthread_t thread;\n"
+    "    pthread_attr_init(&attr);\n"
+    "    pthread_attr_setstacksize(&attr, ((size_t) 64 << 20) + rt_max_depth * 512);\n"
+    "    if (pthread_create(&thread, &attr, rt_run, NULL) == 0) {\n"
+    "        pthread_join(thread, NULL);\n"
+    "    } else {\n"
+    "        program();\n"
+    "    }\n"
+    "    return 0;\n"
+    "}\n";
+
+struct emit {
+    FILE *out;
+    unsigned next;                  // number of the next C variable
+
+    const struct ast_node **procs;  // the proc commands, proc_K is the K-th
+    size_t procsCount;
+    size_t procsCapacity;
+
+    const char **vars;              // the names of the variables
+    size_t varsCount;
+    size_t varsCapacity;
+
+    const char **names;             // the names of the procedures
+    size_t namesCount;
+    size_t namesCapacity;
+};
+
+/**
+ * intern function to add a name to a set
+ */
+static void emit_name_add(const char ***names, size_t *count, size_t *capacity, const char *name) {
+    for (size_t i = 0; i < *count; ++i) {
+        if (strcmp((*names)[i], name) == 0) {
+            return;
+        }
+    }
+    if (*count == *capacity) {
+        *capacity = *capacity ? 2 * *capacity : 16;
+        *names = realloc(*names, *capacity * sizeof(const char *));
+        assert(*names);
+    }
+    (*names)[(*count)++] = name;
+}
+
+/**
+ * find the procedures and the names of a sequence
+ * @param e the translation
+ * @param self the first node of the sequence
+ */
+static void emit_collect(struct emit *e, const struct ast_node *self) {
+    for (; self; self = self->next) {
+        switch (self->kind) {
+            case KIND_CMD_PROC:
+                if (e->procsCount == e->procsCapacity) {
+                    e->procsCapacity = e->procsCapacity ? 2 * e->procsCapacity : 16;
+                    e->procs = realloc(e->procs, e->procsCapacity * sizeof(struct ast_node *));
+                    assert(e->procs);
+                }
+                e->procs[e->procsCount++] = self;
+                emit_name_add(&e->names, &e->namesCount, &e->namesCapacity, self->u.name);
+                break;
+            case KIND_CMD_CALL:
+                emit_name_add(&e->names, &e->namesCount, &e->namesCapacity, self->children[0]->u.name);
+                continue;
+            case KIND_CMD_SET:
+            case KIND_EXPR_NAME:
+                emit_name_add(&e->vars, &e->varsCount, &e->varsCapacity, self->u.name);
+                break;
+            default:
+                break;
+        }
+
+        for (size_t i = 0; i < self->children_count; ++i) {
+            emit_collect(e, self->children[i]);
+        }
+    }
+}
+
+/**
+ * intern function to get the number of a proc command
+ */
+static size_t emit_proc_index(const struct emit *e, const struct ast_node *self) {
+    for (size_t i = 0; i < e->procsCount; ++i) {
+        if (e->procs[i] == self) {
+            return i;
+        }
+    }
+    assert(false);
+    return 0;
+}
+
+/**
+ * intern function to write the indentation of a line
+ */
+static void emit_indent(const struct emit *e, int indent) {
+    fprintf(e->out, "%*s", 4 * indent, "");
+}
+
+/**
+ * intern function to write an exact double constant
+ */
+static void emit_double(const struct emit *e, double value) {
+    if (isinf(value)) {
+        fprintf(e->out, value > 0 ? "INFINITY" : "-INFINITY");
+    } else if (isnan(value)) {
+        fprintf(e->out, "NAN");
+    } else {
+        fprintf(e->out, "%a", value);
+    }
+}
+
+/**
+ * translate an expression, its operands are evaluated from left to right
+ * in C variables, as in the interpreter
+ * @param e the translation
+ * @param self the expression
+ * @param line the line of the command, for the errors
+ * @param indent the indentation
+ * @return the number of the C variable holding the value
+ */
+static unsigned emit_expr(struct emit *e, const struct ast_node *self, int line, int indent) {
+    unsigned lhs = 0;
+    unsigned rhs = 0;
+    if (self->children_count > 0) {
+        lhs = emit_expr(e, self->children[0], line, indent);
+    }
+    if (self->children_count > 1) {
+        rhs = emit_expr(e, self->children[1], line, indent);
+    }
+
+    unsigned t = e->next++;
+    switch (self->kind) {
+        case KIND_EXPR_VALUE:
+            emit_indent(e, indent);
+            fprintf(e->out, "double t%u = ", t);
+            emit_double(e, self->u.value);
+            fprintf(e->out, ";\n");
+            break;
+        case KIND_EXPR_NAME:
+            emit_indent(e, indent);
+            fprintf(e->out, "double t%u = d_%s ? v_%s : rt_no_var(%d, \"%s\");\n", t, self->u.name, self->u.name, line, self->u.name);
+            break;
+        case KIND_EXPR_BLOCK:
+            return lhs;
+        case KIND_EXPR_UNOP:
+            emit_indent(e, indent);
+            fprintf(e->out, "double t%u = %st%u;\n", t, self->u.op == '-' ? "-" : "", lhs);
+            break;
+        case KIND_EXPR_BINOP:
+            emit_indent(e, indent);
+            if (self->u.op == '^') {
+                fprintf(e->out, "if (t%u >= 32) rt_error(%d, %d, \"pow arguments too big\");\n", rhs, line, EVAL_ERR_VALUE);
+                emit_indent(e, indent);
+                fprintf(e->out, "double t%u = rt_pow(t%u, t%u);\n", t, lhs, rhs);
+            } else {
+                fprintf(e->out, "double t%u = t%u %c t%u;\n", t, lhs, self->u.op, rhs);
+            }
+            break;
+        case KIND_EXPR_FUNC:
+            emit_indent(e, indent);
+            switch (self->u.func) {
+                case FUNC_SIN:
+                    fprintf(e->out, "double t%u = sin(t%u);\n", t, lhs);
+                    break;
+                case FUNC_COS:
+                    fprintf(e->out, "double t%u = cos(t%u);\n", t, lhs);
+                    break;
+                case FUNC_TAN:
+                    fprintf(e->out, "double t%u = tan(t%u);\n", t, lhs);
+                    break;
+                case FUNC_SQRT:
+                    fprintf(e->out, "if (t%u < 0) rt_error(%d, %d, \"the value to put in the square root is negative\");\n", lhs, line, EVAL_ERR_VALUE);
+                    emit_indent(e, indent);
+                    fprintf(e->out, "double t%u = sqrt(t%u);\n", t, lhs);
+                    break;
+                case FUNC_RANDOM:
+                    fprintf(e->out, "if (t%u < t%u) rt_error(%d, %d, \"the lower limit must be lesser than the upper limit\");\n", rhs, lhs, line, EVAL_ERR_VALUE);
+                    emit_indent(e, indent);
+                    fprintf(e->out, "double t%u = t%u + rt_random() * (t%u - t%u);\n", t, lhs, rhs, lhs);
+                    break;
+            }
+            break;
+        default:
+            assert(false);
+    }
+    return t;
+}
+
+/**
+ * translate the push of a sequence on the evaluation stack of the interpreter :
+ * the frame of the current sequence is reused if the command is its last one,
+ * at the last iteration for a repeat, so the depths are the same
+ * @param e the translation
+ * @param self the command opening the sequence
+ * @param depth the C variable of the depth of the current sequence
+ * @param last the C condition of the last iteration of the current sequence
+ * @param indent the indentation
+ * @return the C variable of the depth of the new sequence
+ */
+static unsigned emit_push(struct emit *e, const struct ast_node *self, unsigned depth, const char *last, int indent) {
+    unsigned d = e->next++;
+    emit_indent(e, indent);
+    if (self->next) {
+        fprintf(e->out, "size_t d%u = d%u + 1;\n", d, depth);
+    } else if (strcmp(last, "1") == 0) {
+        fprintf(e->out, "size_t d%u = d%u;\n", d, depth);
+    } else {
+        fprintf(e->out, "size_t d%u = %s ? d%u : d%u + 1;\n", d, last, depth, depth);
+    }
+    emit_indent(e, indent);
+    fprintf(e->out, "rt_depth(%d, d%u);\n", self->line, d);
+    emit_indent(e, indent);
+    fprintf(e->out, "(void) d%u;\n", d);
+    return d;
+}
+
+static void emit_cmds(struct emit *e, const struct ast_node *self, unsigned depth, const char *last, int indent);
+
+/**
+ * translate a command
+ * @param e the translation
+ * @param self the command
+ * @param depth the C variable of the depth of its sequence
+ * @param last the C condition of the last iteration of its sequence
+ * @param indent the indentation
+ */
+static void emit_cmd(struct emit *e, const struct ast_node *self, unsigned depth, const char *last, int indent) {
+    int line = self->line;
+    unsigned a, b, c;
+
+    emit_indent(e, indent);
+    fprintf(e->out, "{\n");
+    ++indent;
+
+    switch (self->kind) {
+        case KIND_CMD_SIMPLE:
+            switch (self->u.cmd) {
+                case CMD_UP:
+                    emit_indent(e, indent);
+                    fprintf(e->out, "rt_up = true;\n");
+                    break;
+                case CMD_DOWN:
+                    emit_indent(e, indent);
+                    fprintf(e->out, "rt_up = false;\n");
+                    break;
+                case CMD_RIGHT:
+                case CMD_LEFT:
+                    a = emit_expr(e, self->children[0], line, indent);
+                    emit_indent(e, indent);
+                    fprintf(e->out, "rt_%s(t%u);\n", self->u.cmd == CMD_RIGHT ? "right" : "left", a);
+                    break;
+                case CMD_HEADING:
+                    emit_indent(e, indent);
+                    fprintf(e->out, "rt_angle = 0;\n");
+                    break;
+                case CMD_FORWARD:
+                case CMD_BACKWARD:
+                    b = e->next++;
+                    emit_indent(e, indent);
+                    fprintf(e->out, "double a%u = rt_angle * (", b);
+                    emit_double(e, 3.141592653589793);
+                    fprintf(e->out, " / 180);\n");
+                    a = emit_expr(e, self->children[0], line, indent);
+                    emit_indent(e, indent);
+                    fprintf(e->out, "rt_x %s= sin(a%u) * t%u;\n", self->u.cmd == CMD_FORWARD ? "-" : "+", b, a);
+                    emit_indent(e, indent);
+                    fprintf(e->out, "rt_y %s= cos(a%u) * t%u;\n", self->u.cmd == CMD_FORWARD ? "-" : "+", b, a);
+                    emit_indent(e, indent);
+                    fprintf(e->out, "rt_point(rt_up);\n");
+                    break;
+                case CMD_POSITION:
+                    a = emit_expr(e, self->children[0], line, indent);
+                    b = emit_expr(e, self->children[1], line, indent);
+                    emit_indent(e, indent);
+                    fprintf(e->out, "rt_x = t%u;\n", a);
+                    emit_indent(e, indent);
+                    fprintf(e->out, "rt_y = t%u;\n", b);
+                    emit_indent(e, indent);
+                    fprintf(e->out, "rt_point(true);\n");
+                    break;
+                case CMD_HOME:
+                    emit_indent(e, indent);
+                    fprintf(e->out, "rt_home();\n");
+                    break;
+                case CMD_COLOR:
+                    a = emit_expr(e, self->children[0], line, indent);
+                    b = emit_expr(e, self->children[1], line, indent);
+                    c = emit_expr(e, self->children[2], line, indent);
+                    emit_indent(e, indent);
+                    fprintf(e->out, "rt_color(%d, t%u, t%u, t%u);\n", line, a, b, c);
+                    break;
+                case CMD_PRINT:
+                    // as the interpreter, print the value field of the command
+                    emit_indent(e, indent);
+                    fprintf(e->out, "fprintf(stderr, \"%%f\\n\", ");
+                    emit_double(e, self->u.value);
+                    fprintf(e->out, ");\n");
+                    break;
+            }
+            break;
+        case KIND_CMD_REPEAT: {
+            a = emit_expr(e, self->children[0], line, indent);
+            b = e->next++;
+            emit_indent(e, indent);
+            fprintf(e->out, "double n%u = floor(t%u);\n", b, a);
+            emit_indent(e, indent);
+            fprintf(e->out, "if (n%u >= 1) {\n", b);
+            unsigned d = emit_push(e, self, depth, last, indent + 1);
+            emit_indent(e, indent + 1);
+            fprintf(e->out, "double r%u = n%u - 1;\n", b, b);
+            emit_indent(e, indent + 1);
+            fprintf(e->out, "for (;;) {\n");
+            char condition[32];
+            snprintf(condition, sizeof(condition), "r%u < 1", b);
+            emit_cmds(e, self->children[1], d, condition, indent + 2);
+            emit_indent(e, indent + 2);
+            fprintf(e->out, "if (r%u >= 1) {\n", b);
+            emit_indent(e, indent + 3);
+            fprintf(e->out, "r%u -= 1;\n", b);
+            emit_indent(e, indent + 2);
+            fprintf(e->out, "} else {\n");
+            emit_indent(e, indent + 3);
+            fprintf(e->out, "break;\n");
+            emit_indent(e, indent + 2);
+            fprintf(e->out, "}\n");
+            emit_indent(e, indent + 1);
+            fprintf(e->out, "}\n");
+            emit_indent(e, indent);
+            fprintf(e->out, "}\n");
+            break;
+        }
+        case KIND_CMD_BLOCK: {
+            unsigned d = emit_push(e, self, depth, last, indent);
+            emit_cmds(e, self->children[0], d, "1", indent);
+            break;
+        }
+        case KIND_CMD_PROC:
+            emit_indent(e, indent);
+            fprintf(e->out, "if (p_%s) rt_error(%d, %d, \"procedure %%s is already created\", \"%s\");\n",
+                self->u.name, line, EVAL_ERR_NAME, self->u.name);
+            emit_indent(e, indent);
+            fprintf(e->out, "p_%s = proc_%zu;\n", self->u.name, emit_proc_index(e, self));
+            break;
+        case KIND_CMD_CALL: {
+            const char *name = self->children[0]->u.name;
+            emit_indent(e, indent);
+            fprintf(e->out, "if (!p_%s) rt_error(%d, %d, \"no procedure with the name %%s\", \"%s\");\n",
+                name, line, EVAL_ERR_NAME, name);
+            unsigned d = emit_push(e, self, depth, last, indent);
+            emit_indent(e, indent);
+            fprintf(e->out, "p_%s(d%u);\n", name, d);
+            break;
+        }
+        case KIND_CMD_SET:
+            a = emit_expr(e, self->children[0], line, indent);
+            emit_indent(e, indent);
+            fprintf(e->out, "v_%s = t%u;\n", self->u.name, a);
+            emit_indent(e, indent);
+            fprintf(e->out, "d_%s = true;\n", self->u.name);
+            break;
+        default:
+            break;
+    }
+
+    --indent;
+    emit_indent(e, indent);
+    fprintf(e->out, "}\n");
+}
+
+/**
+ * translate a sequence of commands
+ * @param e the translation
+ * @param self the first command
+ * @param depth the C variable of the depth of the sequence
+ * @param last the C condition of the last iteration of the sequence
+ * @param indent the indentation
+ */
+static void emit_cmds(struct emit *e, const struct ast_node *self, unsigned depth, const char *last, int indent) {
+    for (; self; self = self->next) {
+        emit_cmd(e, self, depth, last, indent);
+    }
+}
+
+/**
+ * write the C translation of a tree
+ * @param root the tree
+ * @param out where to write the C code
+ * @return 0 on success
+ */
+int emit_c(const struct ast *root, FILE *out) {
+    struct emit e;
+    memset(&e, 0, sizeof(struct emit));
+    e.out = out;
+    emit_collect(&e, root->unit);
+
+    fprintf(out, "/* generated by turtle --emit-c */\n\n");
+    fprintf(out, emit_prelude, EVAL_DEPTH_DEFAULT, EVAL_ERROR_MAX, EVAL_ERR_NAME, EVAL_ERR_VALUE, EVAL_ERR_DEPTH);
+
+    // the default variables are the ones of a new context
+    struct context ctx;
+    context_create(&ctx);
+    for (size_t i = 0; i < e.varsCount; ++i) {
+        const struct var_handling_node *curr = ctx.handlerForVar->first;
+        while (curr && strcmp(curr->name, e.vars[i]) != 0) {
+            curr = curr->next;
+        }
+        fprintf(out, "static double v_%s = ", e.vars[i]);
+        emit_double(&e, curr ? curr->value : 0.0);
+        fprintf(out, ";\nstatic bool d_%s = %s;\n", e.vars[i], curr ? "true" : "false");
+    }
+    ctx_handler_destroy(&ctx);
+    fprintf(out, "\n");
+
+    for (size_t i = 0; i < e.namesCount; ++i) {
+        fprintf(out, "static void (*p_%s)(size_t);\n", e.names[i]);
+    }
+    for (size_t i = 0; i < e.procsCount; ++i) {
+        fprintf(out, "static void proc_%zu(size_t d);\n", i);
+    }
+
+    for (size_t i = 0; i < e.procsCount; ++i) {
+        unsigned d = e.next++;
+        fprintf(out, "\n// proc %s, line %d\n", e.procs[i]->u.name, e.procs[i]->line);
+        fprintf(out, "static void proc_%zu(size_t d%u) {\n", i, d);
+        fprintf(out, "    (void) d%u;\n", d);
+        emit_cmds(&e, e.procs[i]->children[0], d, "1", 1);
+        fprintf(out, "}\n");
+    }
+
+    unsigned d = e.next++;
+    fprintf(out, "\nstatic void program(void) {\n");
+    fprintf(out, "    size_t d%u = 1;\n", d);
+    fprintf(out, "    (void) d%u;\n", d);
+    emit_cmds(&e, root->unit, d, "1", 1);
+    fprintf(out, "}\n");
+
+    fprintf(out, "%s", emit_postlude);
+
+    free(e.procs);
+    free(e.vars);
+    free(e.names);
+    return ferror(out) ? -1 : 0;
+}
@@ -0,0 +1,22 @@
+#ifndef TURTLE_EMIT_H
+#define TURTLE_EMIT_H
+
+#include <stdio.h>
+
+#include "turtle-ast.h"
+
+/*
+ * ahead-of-time translation of a turtle program to a C translation unit
+ * repeat becomes a for loop, proc a static function, the variables static
+ * globals, and the primitives go to a small runtime written in the unit
+ *
+ * the executable writes the same primitives as the interpreter, with the
+ * same random generator (--seed N), the same errors and the same exit status
+ * it must be compiled without contraction of the floating point operations :
+ *   cc -std=c99 -O2 program.c -lm -lpthread
+ */
+
+// write the C translation of a tree, returns 0 on success
+int emit_c(const struct ast *root, FILE *out);
+
+#endif /* TURTLE_EMIT_H */
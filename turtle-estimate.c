@@ -0,0 +1,473 @@
+#include "turtle-estimate.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+// a variable, with the range of its value
+struct estimate_var {
+    const char *name;
+    struct estimate_range value;
+    struct estimate_var *next;
+};
+
+// a procedure, active while its body is analysed
+struct estimate_proc {
+    const char *name;
+    const struct ast_node *body;
+    bool active;
+    struct estimate_proc *next;
+};
+
+struct estimator {
+    struct estimate_var *vars;
+    struct estimate_proc *procs;
+    uint64_t steps;     // commands analysed
+    bool stopped;       // the evaluation does not go further
+    size_t warnings;
+};
+
+/**
+ * intern function to make a range, NaN bounds are unknown
+ * @param lo the lower bound
+ * @param hi the upper bound
+ * @return the range
+ */
+static struct estimate_range estimate_range(double lo, double hi) {
+    struct estimate_range range = { isnan(lo) ? -INFINITY : lo, isnan(hi) ? INFINITY : hi };
+    return range;
+}
+
+/**
+ * intern function to tell if a range is a single value
+ */
+static bool estimate_exact(struct estimate_range range) {
+    return range.lo == range.hi && isfinite(range.lo);
+}
+
+/**
+ * intern function to multiply two bounds, an unknown bound times 0 is 0
+ */
+static double estimate_mul(double a, double b) {
+    return a == 0 || b == 0 ? 0 : a * b;
+}
+
+/**
+ * intern function to get the range of a product
+ */
+static struct estimate_range estimate_range_mul(struct estimate_range a, struct estimate_range b) {
+    double corners[4] = {
+        estimate_mul(a.lo, b.lo), estimate_mul(a.lo, b.hi),
+        estimate_mul(a.hi, b.lo), estimate_mul(a.hi, b.hi),
+    };
+    double lo = corners[0];
+    double hi = corners[0];
+    for (size_t i = 1; i < 4; ++i) {
+        lo = fmin(lo, corners[i]);
+        hi = fmax(hi, corners[i]);
+    }
+    return estimate_range(lo, hi);
+}
+
+/**
+ * intern function to write a warning
+ * @param e the estimator
+ * @param node the command, for its line
+ * @param fmt the message, as for printf
+ */
+static void estimate_warning(struct estimator *e, const struct ast_node *node, const char *fmt, ...) {
+    if (node && node->line > 0) {
+        fprintf(stderr, "Warning : line %d : ", node->line);
+    } else {
+        fprintf(stderr, "Warning : ");
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fprintf(stderr, "\n");
+    e->warnings++;
+}
+
+/**
+ * intern function to find a variable
+ * @param e the estimator
+ * @param name the name of the variable
+ * @return the variable, NULL if it is not set
+ */
+static struct estimate_var *estimate_var(struct estimator *e, const char *name) {
+    for (struct estimate_var *var = e->vars; var; var = var->next) {
+        if (strcmp(var->name, name) == 0) {
+            return var;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * intern function to set a variable
+ * @param e the estimator
+ * @param name the name of the variable
+ * @param value the range of its value
+ */
+static void estimate_var_set(struct estimator *e, const char *name, struct estimate_range value) {
+    struct estimate_var *var = estimate_var(e, name);
+    if (!var) {
+        var = calloc(1, sizeof(struct estimate_var));
+        assert(var);
+        var->name = name;
+        var->next = e->vars;
+        e->vars = var;
+    }
+    var->value = value;
+}
+
+/**
+ * intern function to find a procedure
+ * @param e the estimator
+ * @param name the name of the procedure
+ * @return the procedure, NULL if it is not defined
+ */
+static struct estimate_proc *estimate_proc(struct estimator *e, const char *name) {
+    for (struct estimate_proc *proc = e->procs; proc; proc = proc->next) {
+        if (strcmp(proc->name, name) == 0) {
+            return proc;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * intern function to get the range of an expression
+ * @param e the estimator
+ * @param self the expression
+ * @return the range of its value
+ */
+static struct estimate_range estimate_expr(struct estimator *e, const struct ast_node *self) {
+    struct estimate_range unknown = { -INFINITY, INFINITY };
+    if (!self) {
+        return unknown;
+    }
+
+    switch (self->kind) {
+        case KIND_EXPR_VALUE:
+            return estimate_range(self->u.value, self->u.value);
+        case KIND_EXPR_NAME: {
+            struct estimate_var *var = estimate_var(e, self->u.name);
+            return var ? var->value : unknown;
+        }
+        case KIND_EXPR_BLOCK:
+            return estimate_expr(e, self->children[0]);
+        case KIND_EXPR_UNOP: {
+            struct estimate_range value = estimate_expr(e, self->children[0]);
+            return self->u.op == '-' ? estimate_range(-value.hi, -value.lo) : value;
+        }
+        case KIND_EXPR_BINOP: {
+            struct estimate_range lhs = estimate_expr(e, self->children[0]);
+            struct estimate_range rhs = estimate_expr(e, self->children[1]);
+            switch (self->u.op) {
+                case '+':
+                    return estimate_range(lhs.lo + rhs.lo, lhs.hi + rhs.hi);
+                case '-':
+                    return estimate_range(lhs.lo - rhs.hi, lhs.hi - rhs.lo);
+                case '*':
+                    return estimate_range_mul(lhs, rhs);
+                case '/':
+                    if (rhs.lo <= 0 && rhs.hi >= 0) {
+                        return unknown;
+                    }
+                    return estimate_range_mul(lhs, estimate_range(1 / rhs.hi, 1 / rhs.lo));
+                case '^':
+                    if (estimate_exact(lhs) && estimate_exact(rhs) && rhs.lo < 32) {
+                        double value = eval_pow(lhs.lo, rhs.lo);
+                        return estimate_range(value, value);
+                    }
+                    return unknown;
+            }
+            return unknown;
+        }
+        case KIND_EXPR_FUNC: {
+            struct estimate_range value = estimate_expr(e, self->children[0]);
+            switch (self->u.func) {
+                case FUNC_SIN:
+                    return estimate_exact(value) ? estimate_range(sin(value.lo), sin(value.lo)) : estimate_range(-1, 1);
+                case FUNC_COS:
+                    return estimate_exact(value) ? estimate_range(cos(value.lo), cos(value.lo)) : estimate_range(-1, 1);
+                case FUNC_TAN:
+                    return estimate_exact(value) ? estimate_range(tan(value.lo), tan(value.lo)) : unknown;
+                case FUNC_SQRT:
+                    return estimate_range(sqrt(fmax(value.lo, 0)), sqrt(fmax(value.hi, 0)));
+                case FUNC_RANDOM: {
+                    struct estimate_range upper = estimate_expr(e, self->children[1]);
+                    return estimate_range(value.lo, upper.hi);
+                }
+            }
+            return unknown;
+        }
+        default:
+            return unknown;
+    }
+}
+
+/**
+ * intern function to forget the value of the variables set in a sequence,
+ * and in the procedures it calls, before it is repeated
+ * @param e the estimator
+ * @param self the first command of the sequence
+ */
+static void estimate_forget(struct estimator *e, const struct ast_node *self) {
+    struct estimate_range unknown = { -INFINITY, INFINITY };
+    for (; self && e->steps < ESTIMATE_STEPS_MAX; self = self->next) {
+        e->steps++;
+        switch (self->kind) {
+            case KIND_CMD_SET:
+                estimate_var_set(e, self->u.name, unknown);
+                break;
+            case KIND_CMD_REPEAT:
+                estimate_forget(e, self->children[1]);
+                break;
+            case KIND_CMD_BLOCK:
+                estimate_forget(e, self->children[0]);
+                break;
+            case KIND_CMD_CALL: {
+                struct estimate_proc *proc = estimate_proc(e, self->children[0]->u.name);
+                if (proc && !proc->active) {
+                    proc->active = true;
+                    estimate_forget(e, proc->body);
+                    proc->active = false;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+}
+
+static void estimate_cmds(struct estimator *e, const struct ast_node *self, struct estimate_cost *cost);
+
+/**
+ * intern function to add the cost of a repeat
+ * @param e the estimator
+ * @param self the repeat command
+ * @param cost the cost, updated
+ */
+static void estimate_repeat(struct estimator *e, const struct ast_node *self, struct estimate_cost *cost) {
+    // the body is evaluated floor(count) times, none under 1 or for a count which is not a number
+    struct estimate_range count = estimate_expr(e, self->children[0]);
+    struct estimate_range iter = estimate_range(!(count.lo >= 1) ? 0 : floor(count.lo), !(count.hi >= 1) ? 0 : floor(count.hi));
+    if (iter.hi == 0) {
+        return;
+    }
+    if (isinf(iter.hi)) {
+        estimate_warning(e, self, "the count of the repeat has no upper bound");
+    }
+
+    if (iter.hi > 1) {
+        estimate_forget(e, self->children[1]);
+    }
+
+    // when the body may not run, the variables keep their range before it too
+    struct estimate_var *known = e->vars;
+    struct estimate_range *before = NULL;
+    if (iter.lo == 0) {
+        size_t count = 0;
+        for (struct estimate_var *var = known; var; var = var->next) {
+            count++;
+        }
+        before = calloc(count + 1, sizeof(struct estimate_range));
+        assert(before);
+        count = 0;
+        for (struct estimate_var *var = known; var; var = var->next) {
+            before[count++] = var->value;
+        }
+    }
+
+    struct estimate_cost body = { { 0, 0 }, { 0, 0 } };
+    estimate_cmds(e, self->children[1], &body);
+
+    if (before) {
+        // the new variables are only set in the body, they may not be defined
+        for (struct estimate_var *var = e->vars; var != known; var = var->next) {
+            var->value = estimate_range(-INFINITY, INFINITY);
+        }
+        size_t i = 0;
+        for (struct estimate_var *var = known; var; var = var->next, ++i) {
+            var->value = estimate_range(fmin(before[i].lo, var->value.lo), fmax(before[i].hi, var->value.hi));
+        }
+        free(before);
+    }
+    body.commands = estimate_range_mul(iter, body.commands);
+    body.primitives = estimate_range_mul(iter, body.primitives);
+    cost->commands.lo += body.commands.lo;
+    cost->commands.hi += body.commands.hi;
+    cost->primitives.lo += body.primitives.lo;
+    cost->primitives.hi += body.primitives.hi;
+}
+
+/**
+ * intern function to add the cost of a call
+ * @param e the estimator
+ * @param self the call command
+ * @param cost the cost, updated
+ */
+static void estimate_call(struct estimator *e, const struct ast_node *self, struct estimate_cost *cost) {
+    const char *name = self->children[0]->u.name;
+    struct estimate_proc *proc = estimate_proc(e, name);
+    if (!proc) {
+        estimate_warning(e, self, "no procedure with the name %s, the evaluation stops there", name);
+        e->stopped = true;
+        return;
+    }
+    if (proc->active) {
+        // nothing stops a recursion : it runs until the maximum depth or forever
+        estimate_warning(e, self, "unbounded recursion through %s", name);
+        cost->commands.hi = INFINITY;
+        cost->primitives.hi = INFINITY;
+        e->stopped = true;
+        return;
+    }
+
+    proc->active = true;
+    estimate_cmds(e, proc->body, cost);
+    proc->active = false;
+}
+
+/**
+ * intern function to add the cost of a sequence of commands
+ * @param e the estimator
+ * @param self the first command
+ * @param cost the cost, updated
+ */
+static void estimate_cmds(struct estimator *e, const struct ast_node *self, struct estimate_cost *cost) {
+    for (; self && !e->stopped; self = self->next) {
+        if (++e->steps > ESTIMATE_STEPS_MAX) {
+            estimate_warning(e, self, "the program is too big to be analysed, no upper bound");
+            cost->commands.hi = INFINITY;
+            cost->primitives.hi = INFINITY;
+            e->stopped = true;
+            return;
+        }
+
+        cost->commands.lo += 1;
+        cost->commands.hi += 1;
+        switch (self->kind) {
+            case KIND_CMD_SIMPLE:
+                switch (self->u.cmd) {
+                    case CMD_FORWARD:
+                    case CMD_BACKWARD:
+                    case CMD_POSITION:
+                    case CMD_COLOR:
+                        cost->primitives.lo += 1;
+                        cost->primitives.hi += 1;
+                        break;
+                    default:
+                        break;
+                }
+                break;
+            case KIND_CMD_REPEAT:
+                estimate_repeat(e, self, cost);
+                break;
+            case KIND_CMD_BLOCK:
+                estimate_cmds(e, self->children[0], cost);
+                break;
+            case KIND_CMD_PROC:
+                if (!estimate_proc(e, self->u.name)) {
+                    struct estimate_proc *proc = calloc(1, sizeof(struct estimate_proc));
+                    assert(proc);
+                    proc->name = self->u.name;
+                    proc->body = self->children[0];
+                    proc->next = e->procs;
+                    e->procs = proc;
+                }
+                break;
+            case KIND_CMD_CALL:
+                estimate_call(e, self, cost);
+                break;
+            case KIND_CMD_SET:
+                estimate_var_set(e, self->u.name, estimate_expr(e, self->children[0]));
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/**
+ * estimate the cost of a program without running it
+ * @param root the tree of the program
+ * @param cost the number of commands and primitives, with their bounds
+ * @return the number of warnings, written to stderr
+ */
+size_t ast_estimate(const struct ast *root, struct estimate_cost *cost) {
+    struct estimator e;
+    memset(&e, 0, sizeof(struct estimator));
+    memset(cost, 0, sizeof(struct estimate_cost));
+
+    // the default variables, as in a new context
+    struct context ctx;
+    context_create(&ctx);
+    for (const struct var_handling_node *var = ctx.handlerForVar->first; var; var = var->next) {
+        estimate_var_set(&e, var->name, estimate_range(var->value, var->value));
+    }
+
+    estimate_cmds(&e, root->unit, cost);
+
+    ctx_handler_destroy(&ctx);
+    while (e.vars) {
+        struct estimate_var *next = e.vars->next;
+        free(e.vars);
+        e.vars = next;
+    }
+    while (e.procs) {
+        struct estimate_proc *next = e.procs->next;
+        free(e.procs);
+        e.procs = next;
+    }
+    return e.warnings;
+}
+
+/**
+ * intern function to write a range
+ * @param out the output
+ * @param name the name of the line
+ * @param range the range
+ * @param format the format of a bound
+ */
+static void estimate_print_range(FILE *out, const char *name, struct estimate_range range, const char *format) {
+    fprintf(out, "%s ", name);
+    fprintf(out, format, range.lo);
+    if (range.hi != range.lo) {
+        fprintf(out, " - ");
+        if (isinf(range.hi)) {
+            fprintf(out, "unbounded");
+        } else {
+            fprintf(out, format, range.hi);
+        }
+    }
+    fprintf(out, "\n");
+}
+
+/**
+ * write the estimate of the cost of a program : the commands, the primitives
+ * and the time of the evaluation with the text format
+ * @param root the tree of the program
+ * @param out the output
+ * @return 0 on success
+ */
+int estimate_print(const struct ast *root, FILE *out) {
+    struct estimate_cost cost;
+    ast_estimate(root, &cost);
+
+    struct estimate_range seconds = {
+        (cost.commands.lo * ESTIMATE_COMMAND_NS + cost.primitives.lo * ESTIMATE_PRIMITIVE_NS) / 1e9,
+        (cost.commands.hi * ESTIMATE_COMMAND_NS + cost.primitives.hi * ESTIMATE_PRIMITIVE_NS) / 1e9,
+    };
+
+    estimate_print_range(out, "commands", cost.commands, "%.0f");
+    estimate_print_range(out, "primitives", cost.primitives, "%.0f");
+    estimate_print_range(out, "seconds", seconds, "%.3g");
+    return ferror(out) ? -1 : 0;
+}
@@ -0,0 +1,47 @@
+#ifndef TURTLE_ESTIMATE_H
+#define TURTLE_ESTIMATE_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "turtle-ast.h"
+
+// most commands analysed, beyond the upper bounds are unknown
+#define ESTIMATE_STEPS_MAX 10000000
+
+// cost of a command and of a primitive in the text format, in nanoseconds
+#define ESTIMATE_COMMAND_NS 20.0
+#define ESTIMATE_PRIMITIVE_NS 550.0
+
+// bounds of a value, an unknown bound is infinite
+struct estimate_range {
+    double lo;
+    double hi;
+};
+
+// cost of a program, or of a part of it
+struct estimate_cost {
+    struct estimate_range commands;   // commands executed
+    struct estimate_range primitives; // primitives written
+};
+
+/*
+ * static estimate of the cost of a program, without running it : the
+ * expressions are evaluated as ranges, the counts of the repeats are
+ * multiplied through the bodies and the calls are followed in the
+ * procedures
+ * a variable set in the body of a repeat is unknown in the body, after a
+ * repeat which may not run it keeps its range before the repeat too, the
+ * counts which depend on random or on unknown variables give bounds, a
+ * recursion (there is no condition to stop it) makes the upper bounds
+ * unbounded
+ * the errors of the evaluation other than the calls to unknown
+ * procedures are not foreseen, the program may stop before
+ * the warnings are written to stderr, returns the number of warnings
+ */
+size_t ast_estimate(const struct ast *root, struct estimate_cost *cost);
+
+// write the estimate of a program, returns 0 on success
+int estimate_print(const struct ast *root, FILE *out);
+
+#endif /* TURTLE_ESTIMATE_H */
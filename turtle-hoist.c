@@ -0,0 +1,467 @@
+#include "turtle-hoist.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// a variable set by a part of the program
+struct hoist_name {
+    const char *name;
+    struct hoist_name *next;
+};
+
+// the variables set by a part of the program
+struct hoist_writes {
+    struct hoist_name *names;
+    bool all;  // a call to an unknown procedure may set any variable
+};
+
+// a procedure of the tree, the procedures with the same name are merged
+struct hoist_proc {
+    const char *name;
+    struct hoist_writes writes;
+    struct hoist_proc *next;
+};
+
+// a repeat of the tree, in the order of the walk
+struct hoist_loop {
+    struct ast_node *node;
+    struct hoist_writes writes;  // the variables set by its body
+    size_t count;                // number of hoisted expressions
+};
+
+// a hoisted expression, with the index of its repeat
+struct hoist_expr {
+    struct ast_node *node;
+    size_t loop;
+};
+
+struct hoister {
+    struct hoist_proc *procs;
+    bool changed;               // a set of a procedure got a new variable
+
+    struct hoist_loop *loops;
+    size_t loopsCount;
+    size_t loopsCapacity;
+
+    struct hoist_expr *exprs;
+    size_t exprsCount;
+    size_t exprsCapacity;
+
+    size_t *enclosing;          // the repeats around the command being walked, the outermost first
+    size_t enclosingCapacity;
+};
+
+/**
+ * intern function to make room for one more element of an array
+ * @param array the array
+ * @param capacity the number of elements allocated, updated
+ * @param count the number of elements used
+ * @param size the size of an element
+ * @return the array, maybe moved
+ */
+static void *hoist_grow(void *array, size_t *capacity, size_t count, size_t size) {
+    if (count < *capacity) {
+        return array;
+    }
+    *capacity = *capacity ? 2 * *capacity : 16;
+    array = realloc(array, *capacity * size);
+    assert(array);
+    return array;
+}
+
+/**
+ * intern function to tell if a variable is in a set
+ */
+static bool hoist_writes_has(const struct hoist_writes *self, const char *name) {
+    if (self->all) {
+        return true;
+    }
+    for (const struct hoist_name *curr = self->names; curr; curr = curr->next) {
+        if (strcmp(curr->name, name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * intern function to add a variable to a set
+ * @return true if the set did not have it
+ */
+static bool hoist_writes_add(struct hoist_writes *self, const char *name) {
+    if (hoist_writes_has(self, name)) {
+        return false;
+    }
+    struct hoist_name *node = malloc(sizeof(struct hoist_name));
+    assert(node);
+    node->name = name;
+    node->next = self->names;
+    self->names = node;
+    return true;
+}
+
+/**
+ * intern function to add the variables of a set to another
+ * @return true if the set got a new variable
+ */
+static bool hoist_writes_merge(struct hoist_writes *self, const struct hoist_writes *other) {
+    if (self->all) {
+        return false;
+    }
+    if (other->all) {
+        self->all = true;
+        return true;
+    }
+    bool added = false;
+    for (const struct hoist_name *curr = other->names; curr; curr = curr->next) {
+        added = hoist_writes_add(self, curr->name) || added;
+    }
+    return added;
+}
+
+/**
+ * intern function to release a set
+ */
+static void hoist_writes_destroy(struct hoist_writes *self) {
+    while (self->names) {
+        struct hoist_name *next = self->names->next;
+        free(self->names);
+        self->names = next;
+    }
+}
+
+/**
+ * intern function to find a procedure by its name
+ * @return the procedure, NULL if the tree does not define it
+ */
+static struct hoist_proc *hoist_proc(struct hoister *h, const char *name) {
+    for (struct hoist_proc *curr = h->procs; curr; curr = curr->next) {
+        if (strcmp(curr->name, name) == 0) {
+            return curr;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * intern function to list the procedures of a tree, with empty sets
+ * @param h the hoister
+ * @param self the first command of the sequence
+ */
+static void hoist_procs_list(struct hoister *h, const struct ast_node *self) {
+    for (; self; self = self->next) {
+        switch (self->kind) {
+            case KIND_CMD_REPEAT:
+                hoist_procs_list(h, self->children[1]);
+                break;
+            case KIND_CMD_BLOCK:
+                hoist_procs_list(h, self->children[0]);
+                break;
+            case KIND_CMD_PROC:
+                if (!hoist_proc(h, self->u.name)) {
+                    struct hoist_proc *proc = calloc(1, sizeof(struct hoist_proc));
+                    assert(proc);
+                    proc->name = self->u.name;
+                    proc->next = h->procs;
+                    h->procs = proc;
+                }
+                hoist_procs_list(h, self->children[0]);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/**
+ * intern function to add the variables set by a sequence to a set : the
+ * variables of its set commands, of the bodies of its repeats and blocks,
+ * and of the procedures it calls, as known so far
+ * the definitions of procedures do not set anything
+ * @param h the hoister
+ * @param self the first command of the sequence
+ * @param writes the set, updated
+ * @return true if the set got a new variable
+ */
+static bool hoist_writes(struct hoister *h, const struct ast_node *self, struct hoist_writes *writes) {
+    bool added = false;
+    for (; self && !writes->all; self = self->next) {
+        switch (self->kind) {
+            case KIND_CMD_SET:
+                added = hoist_writes_add(writes, self->u.name) || added;
+                break;
+            case KIND_CMD_REPEAT:
+                added = hoist_writes(h, self->children[1], writes) || added;
+                break;
+            case KIND_CMD_BLOCK:
+                added = hoist_writes(h, self->children[0], writes) || added;
+                break;
+            case KIND_CMD_CALL: {
+                struct hoist_proc *proc = hoist_proc(h, self->children[0]->u.name);
+                if (proc) {
+                    added = hoist_writes_merge(writes, &proc->writes) || added;
+                } else {
+                    writes->all = true;
+                    added = true;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    return added;
+}
+
+/**
+ * intern function to update the sets of the procedures defined in a sequence
+ * with what their bodies set, h->changed tells if a set got a new variable
+ * @param h the hoister
+ * @param self the first command of the sequence
+ */
+static void hoist_procs_update(struct hoister *h, const struct ast_node *self) {
+    for (; self; self = self->next) {
+        switch (self->kind) {
+            case KIND_CMD_REPEAT:
+                hoist_procs_update(h, self->children[1]);
+                break;
+            case KIND_CMD_BLOCK:
+                hoist_procs_update(h, self->children[0]);
+                break;
+            case KIND_CMD_PROC:
+                if (hoist_writes(h, self->children[0], &hoist_proc(h, self->u.name)->writes)) {
+                    h->changed = true;
+                }
+                hoist_procs_update(h, self->children[0]);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/**
+ * intern function to tell if an expression has the same value for a whole
+ * entry of a repeat
+ * @param self the expression
+ * @param writes the variables set by the body of the repeat
+ * @return true if the expression does not use random nor a variable of writes
+ */
+static bool hoist_invariant(const struct ast_node *self, const struct hoist_writes *writes) {
+    if (self->kind == KIND_EXPR_FUNC && self->u.func == FUNC_RANDOM) {
+        return false;
+    }
+    if (self->kind == KIND_EXPR_NAME) {
+        return !hoist_writes_has(writes, self->u.name);
+    }
+    for (size_t i = 0; i < self->children_count; ++i) {
+        if (self->children[i] && !hoist_invariant(self->children[i], writes)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * intern function to hoist an expression and its operands
+ * the expression goes to the outermost repeat of h->enclosing[base..depth[
+ * for which it is invariant, its operands can only go further out
+ * @param h the hoister
+ * @param self the expression
+ * @param base the first repeat around the expression in the same body of procedure
+ * @param depth the number of repeats around the expression
+ */
+static void hoist_expr(struct hoister *h, struct ast_node *self, size_t base, size_t depth) {
+    if (!self) {
+        return;
+    }
+
+    self->slot = 0;
+    if (self->kind != KIND_EXPR_VALUE) {
+        size_t i = base;
+        while (i < depth && !hoist_invariant(self, &h->loops[h->enclosing[i]].writes)) {
+            ++i;
+        }
+        if (i < depth) {
+            h->exprs = hoist_grow(h->exprs, &h->exprsCapacity, h->exprsCount, sizeof(struct hoist_expr));
+            h->exprs[h->exprsCount].node = self;
+            h->exprs[h->exprsCount].loop = h->enclosing[i];
+            h->exprsCount++;
+            h->loops[h->enclosing[i]].count++;
+            depth = i;
+        }
+    }
+
+    for (size_t i = 0; i < self->children_count; ++i) {
+        hoist_expr(h, self->children[i], base, depth);
+    }
+}
+
+/**
+ * intern function to hoist the expressions of a sequence of commands
+ * the body of a procedure runs where it is called, not in the repeats
+ * around its definition
+ * @param h the hoister
+ * @param self the first command of the sequence
+ * @param base the first repeat around the sequence in the same body of procedure
+ * @param depth the number of repeats around the sequence
+ */
+static void hoist_cmds(struct hoister *h, struct ast_node *self, size_t base, size_t depth) {
+    for (; self; self = self->next) {
+        switch (self->kind) {
+            case KIND_CMD_SIMPLE:
+            case KIND_CMD_SET:
+                for (size_t i = 0; i < self->children_count; ++i) {
+                    hoist_expr(h, self->children[i], base, depth);
+                }
+                break;
+            case KIND_CMD_REPEAT: {
+                // the count is evaluated once per entry, in the repeats around
+                hoist_expr(h, self->children[0], base, depth);
+
+                h->loops = hoist_grow(h->loops, &h->loopsCapacity, h->loopsCount, sizeof(struct hoist_loop));
+                size_t loop = h->loopsCount++;
+                memset(&h->loops[loop], 0, sizeof(struct hoist_loop));
+                h->loops[loop].node = self;
+                hoist_writes(h, self->children[1], &h->loops[loop].writes);
+
+                h->enclosing = hoist_grow(h->enclosing, &h->enclosingCapacity, depth, sizeof(size_t));
+                h->enclosing[depth] = loop;
+                hoist_cmds(h, self->children[1], base, depth + 1);
+                break;
+            }
+            case KIND_CMD_BLOCK:
+                hoist_cmds(h, self->children[0], base, depth);
+                break;
+            case KIND_CMD_PROC:
+                hoist_cmds(h, self->children[0], depth, depth);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/**
+ * find the loop-invariant expressions of the repeats of a tree and give them
+ * their slots : the slots of a repeat follow each other from node->slot,
+ * node->slots is their number
+ * @param unit the first command of the tree
+ * @return the number of slots
+ */
+size_t ast_hoist(struct ast_node *unit) {
+    struct hoister h;
+    memset(&h, 0, sizeof(struct hoister));
+
+    // the sets of the procedures grow until they are complete, for the recursions
+    hoist_procs_list(&h, unit);
+    do {
+        h.changed = false;
+        hoist_procs_update(&h, unit);
+    } while (h.changed);
+
+    hoist_cmds(&h, unit, 0, 0);
+
+    // the slots of each repeat, in the order of the walk
+    size_t first = 0;
+    for (size_t i = 0; i < h.loopsCount; ++i) {
+        h.loops[i].node->slot = first;
+        h.loops[i].node->slots = h.loops[i].count;
+        first += h.loops[i].count;
+        h.loops[i].count = 0;
+    }
+    for (size_t i = 0; i < h.exprsCount; ++i) {
+        struct hoist_loop *loop = &h.loops[h.exprs[i].loop];
+        h.exprs[i].node->slot = loop->node->slot + loop->count + 1;
+        loop->count++;
+    }
+
+    for (size_t i = 0; i < h.loopsCount; ++i) {
+        hoist_writes_destroy(&h.loops[i].writes);
+    }
+    while (h.procs) {
+        struct hoist_proc *next = h.procs->next;
+        hoist_writes_destroy(&h.procs->writes);
+        free(h.procs);
+        h.procs = next;
+    }
+    free(h.loops);
+    free(h.exprs);
+    free(h.enclosing);
+    return first;
+}
+
+/**
+ * forget the values of the hoisted expressions of a repeat being entered,
+ * they are evaluated again when they are needed
+ * @param self the repeat
+ * @param ctx the context
+ */
+void hoist_enter(const struct ast_node *self, struct context *ctx) {
+    size_t size = self->slot + self->slots;
+    if (size > ctx->hoisted.size) {
+        struct hoisted_value *values = realloc(ctx->hoisted.values, size * sizeof(struct hoisted_value));
+        if (values == NULL) {
+            eval_error(ctx, EVAL_ERR_ALLOC, "allocation");
+            return;
+        }
+        // the slots of the repeats not entered in this context have no value either
+        for (size_t i = ctx->hoisted.size; i < self->slot; ++i) {
+            values[i].node = NULL;
+        }
+        ctx->hoisted.values = values;
+        ctx->hoisted.size = size;
+    }
+    for (size_t i = self->slot; i < size; ++i) {
+        ctx->hoisted.values[i].node = NULL;
+    }
+}
+
+/**
+ * intern function to write the hoisted expressions of a repeat found in a
+ * tree, without going into the bodies of procedures
+ * @param self the node
+ * @param repeat the repeat
+ */
+static void hoist_dump_exprs(const struct ast_node *self, const struct ast_node *repeat) {
+    for (; self; self = self->next) {
+        if (self->kind == KIND_CMD_PROC) {
+            continue;
+        }
+        if (self->kind >= KIND_EXPR_FUNC && self->slot > repeat->slot && self->slot <= repeat->slot + repeat->slots) {
+            fprintf(stderr, "    ");
+            ast_node_print(self);
+            fprintf(stderr, "\n");
+        }
+        for (size_t i = 0; i < self->children_count; ++i) {
+            hoist_dump_exprs(self->children[i], repeat);
+        }
+    }
+}
+
+/**
+ * write the hoisted expressions of the repeats of a tree to stderr,
+ * grouped by the repeat which evaluates them
+ * @param unit the first command of the tree
+ */
+void hoist_dump(const struct ast_node *unit) {
+    for (const struct ast_node *self = unit; self; self = self->next) {
+        switch (self->kind) {
+            case KIND_CMD_REPEAT:
+                if (self->slots > 0) {
+                    fprintf(stderr, "line %d : repeat, %zu hoisted expressions\n", self->line, self->slots);
+                    hoist_dump_exprs(self->children[1], self);
+                }
+                hoist_dump(self->children[1]);
+                break;
+            case KIND_CMD_BLOCK:
+            case KIND_CMD_PROC:
+                hoist_dump(self->children[0]);
+                break;
+            default:
+                break;
+        }
+    }
+}
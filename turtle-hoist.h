@@ -0,0 +1,28 @@
+#ifndef TURTLE_HOIST_H
+#define TURTLE_HOIST_H
+
+#include <stddef.h>
+
+#include "turtle-ast.h"
+
+/*
+ * loop-invariant code motion for the repeats
+ * an expression in the body of a repeat is invariant when the body, and the
+ * procedures it calls, do not set its variables and it does not use random :
+ * it has the same value in every iteration. it gets a slot (node->slot) of
+ * the outermost repeat for which it is invariant, and is evaluated once per
+ * entry of this repeat, the first time it is needed, so that an error is
+ * reported by the same command as without hoisting
+ * a call to a procedure which is not defined in the tree, as a procedure of
+ * a library, may set any variable
+ * returns the number of slots
+ */
+size_t ast_hoist(struct ast_node *unit);
+
+// forget the values of the hoisted expressions of a repeat being entered
+void hoist_enter(const struct ast_node *self, struct context *ctx);
+
+// write the hoisted expressions of the repeats of a tree to stderr, for debug
+void hoist_dump(const struct ast_node *unit);
+
+#endif /* TURTLE_HOIST_H */
@@ -0,0 +1,350 @@
+// MAP_ANONYMOUS is not in POSIX
+#define _DEFAULT_SOURCE
+
+#include "turtle-jit.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if JIT_AVAILABLE
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+// marks an expression that can not be compiled
+static struct jit_code jit_none;
+
+// largest code of an expression
+#define JIT_CODE_MAX 65536
+
+// size of the frame of the compiled function : the spilled operands, and
+// 8 more bytes so that the stack is aligned on 16 bytes for the calls
+#define JIT_FRAME (8 * JIT_DEPTH_MAX + 8)
+
+// the code being generated
+struct jit_buffer {
+    unsigned char *bytes;
+    size_t size;
+    bool overflow;
+    size_t fails[JIT_CODE_MAX / 16]; // offsets of the jumps to the failure
+    size_t failsCount;
+    struct jit_code *code;
+};
+
+/**
+ * intern function to append some bytes to the code
+ */
+static void jit_bytes(struct jit_buffer *buf, const void *data, size_t size) {
+    if (buf->size + size > JIT_CODE_MAX) {
+        buf->overflow = true;
+        return;
+    }
+    memcpy(buf->bytes + buf->size, data, size);
+    buf->size += size;
+}
+
+#define JIT_EMIT(buf, ...) do { \
+    const unsigned char bytes[] = { __VA_ARGS__ }; \
+    jit_bytes(buf, bytes, sizeof(bytes)); \
+} while (0)
+
+/**
+ * intern function to append a 32 bits integer, little endian
+ */
+static void jit_u32(struct jit_buffer *buf, uint32_t value) {
+    JIT_EMIT(buf, value, value >> 8, value >> 16, value >> 24);
+}
+
+/**
+ * intern function to load a 64 bits integer in rax
+ */
+static void jit_rax(struct jit_buffer *buf, uint64_t value) {
+    JIT_EMIT(buf, 0x48, 0xB8);  // mov rax, imm64
+    jit_u32(buf, (uint32_t) value);
+    jit_u32(buf, (uint32_t) (value >> 32));
+}
+
+/**
+ * intern function to load a double in xmm0 (reg 0) or xmm1 (reg 1)
+ */
+static void jit_constant(struct jit_buffer *buf, double value, int reg) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    jit_rax(buf, bits);
+    JIT_EMIT(buf, 0x66, 0x48, 0x0F, 0x6E, 0xC0 | reg << 3); // movq xmmN, rax
+}
+
+/**
+ * intern function to call a function of a double, the argument and the
+ * result in xmm0
+ */
+static void jit_call(struct jit_buffer *buf, double (*fn)(double)) {
+    jit_rax(buf, (uintptr_t) fn);
+    JIT_EMIT(buf, 0xFF, 0xD0); // call rax
+}
+
+/**
+ * intern function to jump to the failure if the flags match
+ * @param cc the condition of the jump (0x87 ja, 0x83 jae)
+ */
+static void jit_fail_if(struct jit_buffer *buf, unsigned char cc) {
+    JIT_EMIT(buf, 0x0F, cc);
+    if (buf->failsCount == sizeof(buf->fails) / sizeof(buf->fails[0])) {
+        buf->overflow = true;
+        return;
+    }
+    buf->fails[buf->failsCount++] = buf->size;
+    jit_u32(buf, 0);
+}
+
+/**
+ * intern function to get the slot of a variable
+ * @return the slot, -1 if there are too many variables
+ */
+static int jit_var(struct jit_code *code, const char *name) {
+    for (size_t i = 0; i < code->varsCount; ++i) {
+        if (strcmp(code->vars[i], name) == 0) {
+            return i;
+        }
+    }
+    if (code->varsCount == JIT_VARS_MAX) {
+        return -1;
+    }
+    code->vars[code->varsCount] = name;
+    return code->varsCount++;
+}
+
+/**
+ * compile an expression, its value goes to xmm0
+ * @param buf the code being generated
+ * @param self the expression
+ * @param depth the first free slot of the frame
+ * @return false if the expression can not be compiled
+ */
+static bool jit_expr(struct jit_buffer *buf, const struct ast_node *self, unsigned depth) {
+    switch (self->kind) {
+        case KIND_EXPR_VALUE:
+            jit_constant(buf, self->u.value, 0);
+            return true;
+        case KIND_EXPR_NAME: {
+            int slot = jit_var(buf->code, self->u.name);
+            if (slot < 0) {
+                return false;
+            }
+            JIT_EMIT(buf, 0xF2, 0x0F, 0x10, 0x83); // movsd xmm0, [rbx + disp32]
+            jit_u32(buf, 8 * slot);
+            return true;
+        }
+        case KIND_EXPR_BLOCK:
+            return jit_expr(buf, self->children[0], depth);
+        case KIND_EXPR_UNOP:
+            if (!jit_expr(buf, self->children[0], depth)) {
+                return false;
+            }
+            if (self->u.op == '-') {
+                jit_constant(buf, -0.0, 1);
+                JIT_EMIT(buf, 0x66, 0x0F, 0x57, 0xC1); // xorpd xmm0, xmm1
+            }
+            return true;
+        case KIND_EXPR_BINOP:
+            if (depth == JIT_DEPTH_MAX || !jit_expr(buf, self->children[0], depth)) {
+                return false;
+            }
+            JIT_EMIT(buf, 0xF2, 0x0F, 0x11, 0x84, 0x24); // movsd [rsp + disp32], xmm0
+            jit_u32(buf, 8 * depth);
+            if (!jit_expr(buf, self->children[1], depth + 1)) {
+                return false;
+            }
+            JIT_EMIT(buf, 0x66, 0x0F, 0x28, 0xC8);       // movapd xmm1, xmm0
+            JIT_EMIT(buf, 0xF2, 0x0F, 0x10, 0x84, 0x24); // movsd xmm0, [rsp + disp32]
+            jit_u32(buf, 8 * depth);
+            switch (self->u.op) {
+                case '+':
+                    JIT_EMIT(buf, 0xF2, 0x0F, 0x58, 0xC1); // addsd xmm0, xmm1
+                    return true;
+                case '-':
+                    JIT_EMIT(buf, 0xF2, 0x0F, 0x5C, 0xC1); // subsd xmm0, xmm1
+                    return true;
+                case '*':
+                    JIT_EMIT(buf, 0xF2, 0x0F, 0x59, 0xC1); // mulsd xmm0, xmm1
+                    return true;
+                case '/':
+                    JIT_EMIT(buf, 0xF2, 0x0F, 0x5E, 0xC1); // divsd xmm0, xmm1
+                    return true;
+                case '^':
+                    // the exponent is checked as in the interpreter
+                    jit_rax(buf, 0x4040000000000000ULL);         // 32.0
+                    JIT_EMIT(buf, 0x66, 0x48, 0x0F, 0x6E, 0xD0); // movq xmm2, rax
+                    JIT_EMIT(buf, 0x66, 0x0F, 0x2E, 0xCA);       // ucomisd xmm1, xmm2
+                    jit_fail_if(buf, 0x83);                      // jae failure
+                    jit_rax(buf, (uintptr_t) eval_pow);
+                    JIT_EMIT(buf, 0xFF, 0xD0);                   // call rax
+                    return true;
+            }
+            return false;
+        case KIND_EXPR_FUNC:
+            if (self->u.func == FUNC_RANDOM || !jit_expr(buf, self->children[0], depth)) {
+                return false;
+            }
+            switch (self->u.func) {
+                case FUNC_SIN:
+                    jit_call(buf, sin);
+                    return true;
+                case FUNC_COS:
+                    jit_call(buf, cos);
+                    return true;
+                case FUNC_TAN:
+                    jit_call(buf, tan);
+                    return true;
+                case FUNC_SQRT:
+                    JIT_EMIT(buf, 0x66, 0x0F, 0x57, 0xC9); // xorpd xmm1, xmm1
+                    JIT_EMIT(buf, 0x66, 0x0F, 0x2E, 0xC8); // ucomisd xmm1, xmm0
+                    jit_fail_if(buf, 0x87);                // ja failure, 0 > value
+                    JIT_EMIT(buf, 0xF2, 0x0F, 0x51, 0xC0); // sqrtsd xmm0, xmm0
+                    return true;
+                default:
+                    return false;
+            }
+        default:
+            return false;
+    }
+}
+
+/**
+ * compile an expression to a function bool fn(const double *vars, double *result)
+ * @param self the expression
+ * @return the compiled code, &jit_none if the expression can not be compiled
+ */
+static struct jit_code *jit_compile(const struct ast_node *self) {
+    struct jit_code *code = calloc(1, sizeof(struct jit_code));
+    struct jit_buffer *buf = calloc(1, sizeof(struct jit_buffer));
+    unsigned char *bytes = malloc(JIT_CODE_MAX);
+    if (!code || !buf || !bytes) {
+        free(code);
+        free(buf);
+        free(bytes);
+        return &jit_none;
+    }
+    buf->bytes = bytes;
+    buf->code = code;
+
+    // prologue : rbx holds the variables, r12 the result
+    JIT_EMIT(buf, 0x53);                    // push rbx
+    JIT_EMIT(buf, 0x41, 0x54);              // push r12
+    JIT_EMIT(buf, 0x48, 0x81, 0xEC);        // sub rsp, imm32
+    jit_u32(buf, JIT_FRAME);
+    JIT_EMIT(buf, 0x48, 0x89, 0xFB);        // mov rbx, rdi
+    JIT_EMIT(buf, 0x49, 0x89, 0xF4);        // mov r12, rsi
+
+    bool ok = jit_expr(buf, self, 0);
+
+    JIT_EMIT(buf, 0xF2, 0x41, 0x0F, 0x11, 0x04, 0x24); // movsd [r12], xmm0
+    JIT_EMIT(buf, 0xB8, 1, 0, 0, 0);                   // mov eax, 1
+    size_t epilogue = buf->size;
+    JIT_EMIT(buf, 0x48, 0x81, 0xC4);                   // add rsp, imm32
+    jit_u32(buf, JIT_FRAME);
+    JIT_EMIT(buf, 0x41, 0x5C);                         // pop r12
+    JIT_EMIT(buf, 0x5B);                               // pop rbx
+    JIT_EMIT(buf, 0xC3);                               // ret
+
+    // failure : return false
+    size_t failure = buf->size;
+    JIT_EMIT(buf, 0x31, 0xC0);                         // xor eax, eax
+    JIT_EMIT(buf, 0xE9);                               // jmp epilogue
+    jit_u32(buf, epilogue - (buf->size + 4));
+
+    if (!ok || buf->overflow) {
+        free(bytes);
+        free(buf);
+        free(code);
+        return &jit_none;
+    }
+    for (size_t i = 0; i < buf->failsCount; ++i) {
+        uint32_t rel = failure - (buf->fails[i] + 4);
+        memcpy(bytes + buf->fails[i], &rel, sizeof(rel));
+    }
+
+    // the page is written, then made executable
+    long page = sysconf(_SC_PAGESIZE);
+    code->size = (buf->size + page - 1) / page * page;
+    void *mem = mmap(NULL, code->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        free(bytes);
+        free(buf);
+        free(code);
+        return &jit_none;
+    }
+    memcpy(mem, bytes, buf->size);
+    free(bytes);
+    free(buf);
+    if (mprotect(mem, code->size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(mem, code->size);
+        free(code);
+        return &jit_none;
+    }
+
+    *(void **) &code->fn = mem;
+    return code;
+}
+
+/**
+ * evaluate an expression with its compiled code, compiling it when it gets hot
+ * the counter and the code of the node are shared by the threads
+ * @param self the expression
+ * @param ctx the current context
+ * @param value where to write the value
+ * @return false if the expression has to be interpreted
+ */
+bool jit_eval(const struct ast_node *self, struct context *ctx, double *value) {
+    struct ast_node *node = (struct ast_node *) self;
+    struct jit_code *code = __atomic_load_n(&node->jit, __ATOMIC_ACQUIRE);
+    if (!code) {
+        // only the thread reaching the threshold compiles
+        if (__atomic_add_fetch(&node->hits, 1, __ATOMIC_RELAXED) != JIT_THRESHOLD) {
+            return false;
+        }
+        code = jit_compile(self);
+        __atomic_store_n(&node->jit, code, __ATOMIC_RELEASE);
+    }
+    if (code == &jit_none) {
+        return false;
+    }
+
+    double vars[JIT_VARS_MAX];
+    for (size_t i = 0; i < code->varsCount; ++i) {
+        const struct var_handling_node *curr = ctx->handlerForVar->first;
+        while (curr && strcmp(curr->name, code->vars[i]) != 0) {
+            curr = curr->next;
+        }
+        if (!curr) {
+            return false;
+        }
+        vars[i] = curr->value;
+    }
+    return code->fn(vars, value);
+}
+
+/**
+ * release the compiled code of a node
+ * @param code the code, NULL if the node was not compiled
+ */
+void jit_release(struct jit_code *code) {
+    if (!code || code == &jit_none) {
+        return;
+    }
+    munmap(*(void **) &code->fn, code->size);
+    free(code);
+}
+
+#else
+
+bool jit_eval(const struct ast_node *self, struct context *ctx, double *value) {
+    return false;
+}
+
+void jit_release(struct jit_code *code) {
+}
+
+#endif
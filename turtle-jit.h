@@ -0,0 +1,46 @@
+#ifndef TURTLE_JIT_H
+#define TURTLE_JIT_H
+
+#include <stdbool.h>
+
+#include "turtle-ast.h"
+
+// number of evaluations of an expression before it is compiled
+#define JIT_THRESHOLD 64
+
+// limits of the compiled expressions
+#define JIT_VARS_MAX 16   // distinct variables
+#define JIT_DEPTH_MAX 32  // nested binary operators
+
+// the JIT is only available on x86-64, elsewhere the expressions are interpreted
+#if defined(__x86_64__) && defined(__GNUC__) && defined(__unix__)
+#define JIT_AVAILABLE 1
+#else
+#define JIT_AVAILABLE 0
+#endif
+
+/*
+ * compilation of the hot expressions to SSE2 code
+ * an expression evaluated JIT_THRESHOLD times is compiled into an executable
+ * mmaped page : the operators are SSE2 instructions, sin, cos, tan and pow
+ * are calls to the same functions as the interpreter, so the values are
+ * exactly the same. the variables are read by the caller into an array.
+ * random is not compiled. on an error (a missing variable, a negative square
+ * root, a too big exponent) the compiled code gives up and the expression is
+ * interpreted, which reports the error
+ */
+struct jit_code {
+    bool (*fn)(const double *vars, double *result);
+    size_t size;                        // size of the mapping
+    size_t varsCount;
+    const char *vars[JIT_VARS_MAX];     // the names of the variables, in the tree
+};
+
+// evaluate an expression with its compiled code, compiling it when it gets hot
+// returns false if the expression has to be interpreted
+bool jit_eval(const struct ast_node *self, struct context *ctx, double *value);
+
+// release the compiled code of a node
+void jit_release(struct jit_code *code);
+
+#endif /* TURTLE_JIT_H */
@@ -0,0 +1,249 @@
+#include "turtle-lib.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * intern function to pause the evaluation once the caller has its primitives
+ * @param self the sink
+ */
+static void turtle_sink_yield(struct turtle_sink *self) {
+    if (self->given == self->wanted) {
+        self->ctx->yield = true;
+    }
+}
+
+/**
+ * intern function to give a primitive to the sink
+ * @param self the sink
+ * @param primitive the primitive
+ */
+static void turtle_sink_put(struct turtle_sink *self, const struct turtle_primitive *primitive) {
+    if (self->primitive) {
+        self->primitive(self->data, primitive);
+        return;
+    }
+    if (self->pulled) {
+        if (self->given < self->wanted) {
+            self->pulled[self->given++] = *primitive;
+            turtle_sink_yield(self);
+            return;
+        }
+        // a command gave more than asked, the rest waits for the next pull
+        if (self->count == self->capacity) {
+            size_t capacity = self->capacity ? 2 * self->capacity : 64;
+            struct turtle_primitive *buffer = realloc(self->buffer, capacity * sizeof(struct turtle_primitive));
+            if (!buffer) {
+                eval_error(self->ctx, EVAL_ERR_ALLOC, "allocation");
+                return;
+            }
+            self->buffer = buffer;
+            self->capacity = capacity;
+        }
+        self->buffer[self->count++] = *primitive;
+        return;
+    }
+    self->buffer[self->count++] = *primitive;
+    if (self->count == self->capacity) {
+        self->batch(self->data, self->buffer, self->count);
+        self->count = 0;
+    }
+}
+
+/**
+ * intern function to receive a point from the evaluator
+ * @param data the sink
+ * @param x the abscissa
+ * @param y the ordinate
+ * @param move true for MoveTo, false for LineTo
+ */
+static void turtle_sink_point(void *data, double x, double y, bool move) {
+    struct turtle_primitive primitive = { move ? TURTLE_MOVE_TO : TURTLE_LINE_TO, { x, y, 0.0 } };
+    turtle_sink_put(data, &primitive);
+}
+
+/**
+ * intern function to receive a color from the evaluator
+ * @param data the sink
+ * @param r the red component
+ * @param g the green component
+ * @param b the blue component
+ */
+static void turtle_sink_color(void *data, double r, double g, double b) {
+    struct turtle_primitive primitive = { TURTLE_COLOR, { r, g, b } };
+    turtle_sink_put(data, &primitive);
+}
+
+/**
+ * intern function to give the last primitives of a batch
+ * @param data the sink
+ */
+static void turtle_sink_flush(void *data) {
+    struct turtle_sink *self = data;
+    if (self->batch && self->count > 0) {
+        self->batch(self->data, self->buffer, self->count);
+        self->count = 0;
+    }
+}
+
+/**
+ * intern function to register a sink in a context
+ * @param self the sink
+ * @param ctx the context
+ */
+static void turtle_sink_register(struct turtle_sink *self, struct context *ctx) {
+    self->sink.point = turtle_sink_point;
+    self->sink.color = turtle_sink_color;
+    self->sink.flush = turtle_sink_flush;
+    self->sink.data = self;
+    ctx->output.sink = &self->sink;
+}
+
+/**
+ * parse a program from memory
+ * @param buf the text of the program
+ * @param size the size of the text
+ * @param root the tree of the program
+ * @return 0 on success
+ */
+int turtle_parse(const char *buf, size_t size, struct ast *root) {
+    return parse_buffer(buf, size, root);
+}
+
+/**
+ * initialize a context without output
+ * @param ctx the context
+ * @param seed the seed of random
+ */
+void turtle_context_create(struct context *ctx, uint64_t seed) {
+    context_create(ctx);
+    ctx->out = NULL;
+    ctx->seed = seed;
+}
+
+/**
+ * release the procedures and variables of a context
+ * @param ctx the context
+ */
+void turtle_context_destroy(struct context *ctx) {
+    ctx_handler_destroy(ctx);
+}
+
+/**
+ * send the primitives of a context to a callback, one by one
+ * @param self the sink, it must live as long as the context is evaluated
+ * @param ctx the context
+ * @param fn the callback
+ * @param data the first argument of the callback
+ */
+void turtle_sink_callback(struct turtle_sink *self, struct context *ctx, turtle_primitive_fn fn, void *data) {
+    memset(self, 0, sizeof(struct turtle_sink));
+    self->primitive = fn;
+    self->data = data;
+    turtle_sink_register(self, ctx);
+}
+
+/**
+ * send the primitives of a context to a callback, by batches
+ * @param self the sink, it must live as long as the context is evaluated
+ * @param ctx the context
+ * @param fn the callback
+ * @param data the first argument of the callback
+ * @param capacity the number of primitives of a batch
+ * @return 0 on success
+ */
+int turtle_sink_batch(struct turtle_sink *self, struct context *ctx, turtle_batch_fn fn, void *data, size_t capacity) {
+    memset(self, 0, sizeof(struct turtle_sink));
+    if (capacity == 0) {
+        return -1;
+    }
+    self->buffer = malloc(capacity * sizeof(struct turtle_primitive));
+    if (!self->buffer) {
+        return -1;
+    }
+    self->batch = fn;
+    self->data = data;
+    self->capacity = capacity;
+    turtle_sink_register(self, ctx);
+    return 0;
+}
+
+/**
+ * let the caller pull the primitives of a program with turtle_next_batch
+ * @param self the sink, it must live as long as the context is evaluated
+ * @param ctx the context
+ * @param root the tree of the program
+ */
+void turtle_sink_pull(struct turtle_sink *self, struct context *ctx, const struct ast *root) {
+    memset(self, 0, sizeof(struct turtle_sink));
+    self->ctx = ctx;
+    self->root = root;
+    turtle_sink_register(self, ctx);
+    self->sink.flush = NULL;
+}
+
+/**
+ * evaluate the program of a context prepared by turtle_sink_pull until
+ * n primitives are ready : the evaluation stack is kept between two calls,
+ * with the positions inside the nested repeats, blocks and calls
+ * @param ctx the context
+ * @param buf where to write the primitives
+ * @param n the number of primitives wanted
+ * @return the number of primitives written, less than n only at the end
+ * of the program or on an error, kept in ctx->status and ctx->error
+ */
+size_t turtle_next_batch(struct context *ctx, struct turtle_primitive *buf, size_t n) {
+    struct turtle_sink *self = ctx->output.sink->data;
+
+    // the primitives left by the last command of the previous pull
+    size_t given = 0;
+    while (given < n && self->first < self->count) {
+        buf[given++] = self->buffer[self->first++];
+    }
+    if (self->first == self->count) {
+        self->first = 0;
+        self->count = 0;
+    }
+    if (given == n || self->done) {
+        return given;
+    }
+
+    self->pulled = buf;
+    self->wanted = n;
+    self->given = given;
+    ctx->yield = false;
+    if (!self->started) {
+        self->started = true;
+        ast_eval(self->root, ctx);
+    } else {
+        ast_eval_resume(ctx);
+    }
+    self->done = !ctx->yield || ctx->status != EVAL_OK;
+    self->pulled = NULL;
+    return self->given;
+}
+
+/**
+ * release the buffer of a sink
+ * @param self the sink
+ */
+void turtle_sink_destroy(struct turtle_sink *self) {
+    free(self->buffer);
+    self->buffer = NULL;
+}
+
+/**
+ * evaluate a program, then give the last batch to the sink
+ * the primitives written before an error are given too
+ * @param root the tree of the program
+ * @param ctx the context
+ * @return the status of the evaluation, the error is in ctx->error
+ */
+enum eval_status turtle_eval(const struct ast *root, struct context *ctx) {
+    enum eval_status status = ast_eval(root, ctx);
+    const struct output_sink *sink = ctx->output.sink;
+    if (sink && sink->flush) {
+        sink->flush(sink->data);
+    }
+    return status;
+}
@@ -0,0 +1,108 @@
+#ifndef TURTLE_LIB_H
+#define TURTLE_LIB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "turtle-ast.h"
+#include "turtle-parse.h"
+
+/*
+ * C API of libturtle, to draw without the turtle executable :
+ *
+ *   struct ast root;
+ *   struct context ctx;
+ *   struct turtle_sink sink;
+ *   if (turtle_parse(buf, size, &root) == 0) {
+ *       turtle_context_create(&ctx, seed);
+ *       turtle_sink_batch(&sink, &ctx, draw, data, 4096);
+ *       if (turtle_eval(&root, &ctx) != EVAL_OK) {
+ *           ... ctx.error.line, ctx.error.msg
+ *       }
+ *       turtle_sink_destroy(&sink);
+ *       turtle_context_destroy(&ctx);
+ *       ast_destroy(&root);
+ *   }
+ *
+ * or, to evaluate lazily, only as far as the primitives are needed :
+ *
+ *   turtle_sink_pull(&sink, &ctx, &root);
+ *   while ((n = turtle_next_batch(&ctx, buf, 4096)) > 0) {
+ *       ... buf[0] to buf[n - 1]
+ *   }
+ *
+ * the tree, the context and the sink belong to the caller, and several
+ * programs can be parsed and evaluated at the same time in different threads
+ */
+
+// kind of a primitive
+enum turtle_primitive_kind {
+    TURTLE_MOVE_TO,   // values : x, y
+    TURTLE_LINE_TO,   // values : x, y
+    TURTLE_COLOR,     // values : r, g, b
+};
+
+// a primitive, as the evaluator computes it
+struct turtle_primitive {
+    enum turtle_primitive_kind kind;
+    double values[3];
+};
+
+// called for each primitive
+typedef void (*turtle_primitive_fn)(void *data, const struct turtle_primitive *primitive);
+
+// called for each full batch of primitives, then for the rest at the end of turtle_eval
+typedef void (*turtle_batch_fn)(void *data, const struct turtle_primitive *primitives, size_t count);
+
+// receiver of the primitives of a context
+struct turtle_sink {
+    struct output_sink sink;
+    turtle_primitive_fn primitive;
+    turtle_batch_fn batch;
+    void *data;
+    struct turtle_primitive *buffer;  // the batch, or the primitives pending for the next pull
+    size_t count;
+    size_t capacity;
+
+    // pull, see turtle_next_batch
+    struct context *ctx;
+    const struct ast *root;
+    size_t first;                     // first pending primitive
+    struct turtle_primitive *pulled;  // the array of the caller
+    size_t wanted;
+    size_t given;
+    bool started;
+    bool done;
+};
+
+// parse a program from memory, returns 0 on success
+int turtle_parse(const char *buf, size_t size, struct ast *root);
+
+// initialize a context without output, with a seed for random
+void turtle_context_create(struct context *ctx, uint64_t seed);
+
+// release the procedures and variables of a context
+void turtle_context_destroy(struct context *ctx);
+
+// send the primitives of ctx to a callback, one by one
+void turtle_sink_callback(struct turtle_sink *self, struct context *ctx, turtle_primitive_fn fn, void *data);
+
+// send the primitives of ctx to a callback, by batches of capacity primitives
+// returns 0 on success
+int turtle_sink_batch(struct turtle_sink *self, struct context *ctx, turtle_batch_fn fn, void *data, size_t capacity);
+
+// let the caller pull the primitives of root with turtle_next_batch,
+// the evaluation runs only inside turtle_next_batch
+void turtle_sink_pull(struct turtle_sink *self, struct context *ctx, const struct ast *root);
+
+// evaluate until n primitives are in buf, or until the end of the program
+// returns the number of primitives, 0 once the program is over (see ctx->status)
+size_t turtle_next_batch(struct context *ctx, struct turtle_primitive *buf, size_t n);
+
+// release the buffer of a sink
+void turtle_sink_destroy(struct turtle_sink *self);
+
+// evaluate a program in ctx, the primitives go to its sink
+enum eval_status turtle_eval(const struct ast *root, struct context *ctx);
+
+#endif /* TURTLE_LIB_H */
@@ -0,0 +1,465 @@
+#include "turtle-optimize.h"
+#include "turtle-hoist.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// a name of variable
+struct optimize_name {
+    const char *name;
+    struct optimize_name *next;
+};
+
+// a definition of procedure
+struct optimize_proc {
+    const struct ast_node *node;
+    size_t definitions;  // number of definitions with the same name
+    bool called;         // a call which may be evaluated names it
+    bool scanned;        // the calls of its body are known
+    struct optimize_proc *next;
+};
+
+// a set command, with what is known of its value
+struct optimize_store {
+    const struct ast_node *node;
+    bool safe;           // the value can be dropped
+    struct optimize_store *next;
+};
+
+struct optimizer {
+    struct optimize_proc *procs;
+    struct optimize_store *stores;
+    struct optimize_name *defined;  // the variables surely defined before the command being walked
+    struct optimize_name *read;     // the variables read by the commands which are kept
+    struct ast_node *removed;       // the commands removed, destroyed at the end
+    size_t removedCount;
+};
+
+/**
+ * intern function to tell if a name is in a list
+ */
+static bool optimize_has(const struct optimize_name *list, const char *name) {
+    for (; list; list = list->next) {
+        if (strcmp(list->name, name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * intern function to add a name in front of a list
+ * @return true if the list did not have it
+ */
+static bool optimize_push(struct optimize_name **list, const char *name) {
+    if (optimize_has(*list, name)) {
+        return false;
+    }
+    struct optimize_name *node = malloc(sizeof(struct optimize_name));
+    assert(node);
+    node->name = name;
+    node->next = *list;
+    *list = node;
+    return true;
+}
+
+/**
+ * intern function to remove the names in front of a list, up to a mark
+ * @param list the list
+ * @param mark the first name to keep
+ */
+static void optimize_pop(struct optimize_name **list, struct optimize_name *mark) {
+    while (*list != mark) {
+        struct optimize_name *next = (*list)->next;
+        free(*list);
+        *list = next;
+    }
+}
+
+/**
+ * intern function to unlink a command from its sequence, it is destroyed at the end
+ * @param o the optimizer
+ * @param link the link to the command
+ */
+static void optimize_remove(struct optimizer *o, struct ast_node **link) {
+    struct ast_node *node = *link;
+    *link = node->next;
+    node->next = o->removed;
+    o->removed = node;
+    o->removedCount++;
+}
+
+/**
+ * intern function to list the definitions of procedures of a sequence
+ * @param o the optimizer
+ * @param self the first command of the sequence
+ */
+static void optimize_procs_list(struct optimizer *o, const struct ast_node *self) {
+    for (; self; self = self->next) {
+        switch (self->kind) {
+            case KIND_CMD_REPEAT:
+                optimize_procs_list(o, self->children[1]);
+                break;
+            case KIND_CMD_BLOCK:
+                optimize_procs_list(o, self->children[0]);
+                break;
+            case KIND_CMD_PROC: {
+                struct optimize_proc *proc = calloc(1, sizeof(struct optimize_proc));
+                assert(proc);
+                proc->node = self;
+                proc->next = o->procs;
+                o->procs = proc;
+                optimize_procs_list(o, self->children[0]);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+}
+
+/**
+ * intern function to mark the procedures called by a sequence, without
+ * going into the bodies of the procedures it defines
+ * @param o the optimizer
+ * @param self the first command of the sequence
+ */
+static void optimize_calls(struct optimizer *o, const struct ast_node *self) {
+    for (; self; self = self->next) {
+        switch (self->kind) {
+            case KIND_CMD_REPEAT:
+                optimize_calls(o, self->children[1]);
+                break;
+            case KIND_CMD_BLOCK:
+                optimize_calls(o, self->children[0]);
+                break;
+            case KIND_CMD_CALL:
+                for (struct optimize_proc *proc = o->procs; proc; proc = proc->next) {
+                    if (strcmp(proc->node->u.name, self->children[0]->u.name) == 0) {
+                        proc->called = true;
+                    }
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/**
+ * intern function to remove the definitions of the procedures which are never
+ * called, from the sequences evaluated once : the top level and its blocks
+ * @param o the optimizer
+ * @param link the link to the first command of the sequence
+ */
+static void optimize_procs_remove(struct optimizer *o, struct ast_node **link) {
+    while (*link) {
+        struct ast_node *node = *link;
+        if (node->kind == KIND_CMD_PROC) {
+            struct optimize_proc *proc = o->procs;
+            while (proc->node != node) {
+                proc = proc->next;
+            }
+            if (!proc->called && proc->definitions == 1) {
+                optimize_remove(o, link);
+                continue;
+            }
+        }
+        if (node->kind == KIND_CMD_BLOCK) {
+            optimize_procs_remove(o, &node->children[0]);
+        }
+        link = &node->next;
+    }
+}
+
+/**
+ * intern function to remove the procedures which are never called
+ * @param o the optimizer
+ * @param self the tree
+ */
+static void optimize_procs(struct optimizer *o, struct ast *self) {
+    optimize_procs_list(o, self->unit);
+    for (struct optimize_proc *proc = o->procs; proc; proc = proc->next) {
+        for (const struct optimize_proc *other = o->procs; other; other = other->next) {
+            if (strcmp(proc->node->u.name, other->node->u.name) == 0) {
+                proc->definitions++;
+            }
+        }
+    }
+
+    // the calls of the top level, then the calls of the procedures called
+    optimize_calls(o, self->unit);
+    bool changed;
+    do {
+        changed = false;
+        for (struct optimize_proc *proc = o->procs; proc; proc = proc->next) {
+            if (proc->called && !proc->scanned) {
+                proc->scanned = true;
+                optimize_calls(o, proc->node->children[0]);
+                changed = true;
+            }
+        }
+    } while (changed);
+
+    optimize_procs_remove(o, &self->unit);
+}
+
+/**
+ * intern function to add the variables of an expression to the variables read
+ * @param o the optimizer
+ * @param self the expression
+ * @return true if a variable was not read before
+ */
+static bool optimize_reads(struct optimizer *o, const struct ast_node *self) {
+    if (!self) {
+        return false;
+    }
+    if (self->kind == KIND_EXPR_NAME) {
+        return optimize_push(&o->read, self->u.name);
+    }
+    bool added = false;
+    for (size_t i = 0; i < self->children_count; ++i) {
+        added = optimize_reads(o, self->children[i]) || added;
+    }
+    return added;
+}
+
+/**
+ * intern function to add the variables read by the commands of a sequence,
+ * the set commands aside
+ * @param o the optimizer
+ * @param self the first command of the sequence
+ */
+static void optimize_cmds_reads(struct optimizer *o, const struct ast_node *self) {
+    for (; self; self = self->next) {
+        switch (self->kind) {
+            case KIND_CMD_SIMPLE:
+                for (size_t i = 0; i < self->children_count; ++i) {
+                    optimize_reads(o, self->children[i]);
+                }
+                break;
+            case KIND_CMD_REPEAT:
+                optimize_reads(o, self->children[0]);
+                optimize_cmds_reads(o, self->children[1]);
+                break;
+            case KIND_CMD_BLOCK:
+            case KIND_CMD_PROC:
+                optimize_cmds_reads(o, self->children[0]);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/**
+ * intern function to tell if the value of an expression can be dropped :
+ * it does not use random and it can not stop the evaluation with an error
+ * @param o the optimizer, with the variables surely defined
+ * @param self the expression
+ * @return true if the expression can be dropped
+ */
+static bool optimize_safe(const struct optimizer *o, const struct ast_node *self) {
+    switch (self->kind) {
+        case KIND_EXPR_VALUE:
+            return true;
+        case KIND_EXPR_NAME:
+            return optimize_has(o->defined, self->u.name);
+        case KIND_EXPR_FUNC:
+            if (self->u.func == FUNC_RANDOM || self->u.func == FUNC_SQRT) {
+                return false;
+            }
+            break;
+        case KIND_EXPR_BINOP:
+            if (self->u.op == '^' && !(self->children[1]->kind == KIND_EXPR_VALUE && self->children[1]->u.value < 32)) {
+                return false;
+            }
+            break;
+        default:
+            break;
+    }
+    for (size_t i = 0; i < self->children_count; ++i) {
+        if (!optimize_safe(o, self->children[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void optimize_stores_body(struct optimizer *o, struct ast_node *body, bool remove);
+
+/**
+ * intern function to walk the set commands of a sequence in the order of the
+ * evaluation, with the variables surely defined before them : a first walk
+ * lists them, a second one removes the dead ones
+ * a variable set in a repeat or a procedure is only surely defined inside it
+ * @param o the optimizer
+ * @param link the link to the first command of the sequence
+ * @param remove false to list the set commands, true to remove them
+ * @param removable false if the command is the body of a repeat or a procedure
+ */
+static void optimize_stores(struct optimizer *o, struct ast_node **link, bool remove, bool removable) {
+    while (*link) {
+        struct ast_node *node = *link;
+        switch (node->kind) {
+            case KIND_CMD_SET: {
+                bool safe = removable && optimize_safe(o, node->children[0]);
+                if (!remove) {
+                    struct optimize_store *store = malloc(sizeof(struct optimize_store));
+                    assert(store);
+                    store->node = node;
+                    store->safe = safe;
+                    store->next = o->stores;
+                    o->stores = store;
+                } else if (safe && !optimize_has(o->read, node->u.name)) {
+                    // the node lives until the end, its name stays defined for the walk
+                    optimize_push(&o->defined, node->u.name);
+                    optimize_remove(o, link);
+                    continue;
+                }
+                optimize_push(&o->defined, node->u.name);
+                break;
+            }
+            case KIND_CMD_REPEAT:
+                optimize_stores_body(o, node->children[1], remove);
+                break;
+            case KIND_CMD_BLOCK:
+                optimize_stores(o, &node->children[0], remove, true);
+                break;
+            case KIND_CMD_PROC:
+                optimize_stores_body(o, node->children[0], remove);
+                break;
+            default:
+                break;
+        }
+        link = &node->next;
+    }
+}
+
+/**
+ * intern function to walk the set commands of the body of a repeat or a procedure
+ * @param o the optimizer
+ * @param body the body, a single command
+ * @param remove false to list the set commands, true to remove them
+ */
+static void optimize_stores_body(struct optimizer *o, struct ast_node *body, bool remove) {
+    struct optimize_name *mark = o->defined;
+    if (body->kind == KIND_CMD_BLOCK) {
+        optimize_stores(o, &body->children[0], remove, true);
+    } else {
+        optimize_stores(o, &body, remove, false);
+    }
+    optimize_pop(&o->defined, mark);
+}
+
+/**
+ * intern function to remove the set commands of the variables never read
+ * @param o the optimizer
+ * @param self the tree
+ */
+static void optimize_dead_stores(struct optimizer *o, struct ast *self) {
+    // the default variables are always defined
+    struct context ctx;
+    context_create(&ctx);
+    for (const struct var_handling_node *curr = ctx.handlerForVar->first; curr; curr = curr->next) {
+        optimize_push(&o->defined, curr->name);
+    }
+    struct optimize_name *defaults = o->defined;
+
+    optimize_stores(o, &self->unit, false, true);
+    optimize_pop(&o->defined, defaults);
+
+    // the variables read by the commands, then by the set commands which are kept
+    optimize_cmds_reads(o, self->unit);
+    bool changed;
+    do {
+        changed = false;
+        for (const struct optimize_store *store = o->stores; store; store = store->next) {
+            if (!store->safe || optimize_has(o->read, store->node->u.name)) {
+                changed = optimize_reads(o, store->node->children[0]) || changed;
+            }
+        }
+    } while (changed);
+
+    optimize_stores(o, &self->unit, true, true);
+    optimize_pop(&o->defined, NULL);
+    ctx_handler_destroy(&ctx);
+}
+
+/**
+ * intern function to tell if a command is a move or a turn
+ */
+static bool optimize_travel_cmd(const struct ast_node *self) {
+    return self && self->kind == KIND_CMD_SIMPLE && (self->u.cmd == CMD_FORWARD || self->u.cmd == CMD_BACKWARD
+        || self->u.cmd == CMD_LEFT || self->u.cmd == CMD_RIGHT);
+}
+
+/**
+ * intern function to mark the runs of moves and turns with at least two moves
+ * @param self the first command of the sequence
+ */
+static void optimize_travels(struct ast_node *self) {
+    for (; self; self = self->next) {
+        if (optimize_travel_cmd(self)) {
+            struct ast_node *last = self;
+            size_t moves = 0;
+            for (struct ast_node *curr = self; optimize_travel_cmd(curr); curr = curr->next) {
+                if (curr->u.cmd == CMD_FORWARD || curr->u.cmd == CMD_BACKWARD) {
+                    moves++;
+                }
+                last = curr;
+            }
+            if (moves >= 2) {
+                self->step = STEP_TRAVEL;
+            }
+            self = last;
+            continue;
+        }
+
+        switch (self->kind) {
+            case KIND_CMD_REPEAT:
+                optimize_travels(self->children[1]);
+                break;
+            case KIND_CMD_BLOCK:
+            case KIND_CMD_PROC:
+                optimize_travels(self->children[0]);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/**
+ * optimize a program : remove the procedures never called and the set
+ * commands of the variables never read, then mark the steps, the travels
+ * with the pen up and the loop-invariant expressions
+ * @param self the tree
+ * @return the number of commands removed
+ */
+size_t ast_optimize(struct ast *self) {
+    struct optimizer o;
+    memset(&o, 0, sizeof(struct optimizer));
+
+    optimize_procs(&o, self);
+    optimize_dead_stores(&o, self);
+
+    ast_fuse(self->unit);
+    optimize_travels(self->unit);
+    ast_hoist(self->unit);
+
+    while (o.procs) {
+        struct optimize_proc *next = o.procs->next;
+        free(o.procs);
+        o.procs = next;
+    }
+    while (o.stores) {
+        struct optimize_store *next = o.stores->next;
+        free(o.stores);
+        o.stores = next;
+    }
+    optimize_pop(&o.read, NULL);
+    ast_node_destroy(o.removed);
+    return o.removedCount;
+}
@@ -0,0 +1,25 @@
+#ifndef TURTLE_OPTIMIZE_H
+#define TURTLE_OPTIMIZE_H
+
+#include <stddef.h>
+
+#include "turtle-ast.h"
+
+/*
+ * optimization of a whole program, the drawing stays the same
+ * - the procedures which are never called are removed, unless their
+ *   definition is in a repeat or a procedure, or their name is defined twice :
+ *   the evaluation would stop there with an error
+ * - the set commands of the variables which are never read are removed,
+ *   unless their value uses random, or may stop the evaluation with an error
+ *   (square root, power, variable which may not be defined yet)
+ * - the runs of moves and turns are marked as STEP_TRAVEL : with the pen up,
+ *   only the last position is written, a single MoveTo instead of one per move
+ * the steps and the loop-invariant expressions are marked again
+ * the procedures and variables of other trees (libraries) are not known,
+ * a tree which defines them for another one must not be optimized
+ * returns the number of commands removed
+ */
+size_t ast_optimize(struct ast *self);
+
+#endif /* TURTLE_OPTIMIZE_H */
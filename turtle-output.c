@@ -0,0 +1,341 @@
+#include "turtle-output.h"
+
+#include <math.h>
+#include <string.h>
+
+#define OUTPUT_MAGIC "TTOB"
+#define OUTPUT_VERSION 1
+
+// largest value on the grid, so that the deltas of x shifted by one bit fit in 64 bits
+#define OUTPUT_LIMIT 2305843009213693952.0
+
+// largest text line of OUTPUT_OP_TEXT
+#define OUTPUT_TEXT_MAX 1024
+
+/**
+ * initialize the encoder
+ * @param self the encoder
+ * @param format the format of the primitives
+ * @param grid the number of grid steps per unit, for the binary format
+ */
+void output_create(struct output *self, enum output_format format, uint64_t grid) {
+    memset(self, 0, sizeof(struct output));
+    self->format = format;
+    self->grid = grid;
+    self->pen = OUTPUT_PEN_NONE;
+}
+
+static uint64_t output_zigzag(int64_t value) {
+    return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+static int64_t output_unzigzag(uint64_t value) {
+    return (int64_t) ((value >> 1) ^ -(value & 1));
+}
+
+/**
+ * intern function to add a varint to a record
+ * @param buf the record
+ * @param size the size of the record
+ * @param value the value to add
+ * @return the new size of the record
+ */
+static size_t output_varint(unsigned char *buf, size_t size, uint64_t value) {
+    while (value >= 0x80) {
+        buf[size++] = (unsigned char) (value | 0x80);
+        value >>= 7;
+    }
+    buf[size++] = (unsigned char) value;
+    return size;
+}
+
+/**
+ * intern function to round a value to the grid, halfway away from zero
+ * @param self the encoder
+ * @param value the value
+ * @param q the value on the grid
+ * @param zero true if the value is rounded to a negative zero
+ * @return false if the value can not be on the grid (nan, inf, too big)
+ */
+static bool output_quantize(const struct output *self, double value, int64_t *q, bool *zero) {
+    double scaled = value * self->grid;
+    if (!(fabs(scaled) < OUTPUT_LIMIT)) {
+        return false;
+    }
+    *q = llround(scaled);
+    *zero = *q == 0 && signbit(value);
+    return true;
+}
+
+/**
+ * intern function to write a text line as a record
+ * @param out the output
+ * @param line the text line, with its end of line
+ * @return the number of bytes of the record
+ */
+static size_t output_text(FILE *out, const char *line) {
+    unsigned char buf[16];
+    size_t size = strlen(line);
+    size_t n = output_varint(buf, 0, 2 * OUTPUT_OP_TEXT + 1);
+    n = output_varint(buf, n, size);
+    fwrite(buf, 1, n, out);
+    fwrite(line, 1, size, out);
+    return n + size;
+}
+
+/**
+ * write the header of the format
+ * @param self the encoder
+ * @param out the output
+ */
+void output_header(const struct output *self, FILE *out) {
+    if (self->format == OUTPUT_TEXT) {
+        return;
+    }
+
+    unsigned char buf[16];
+    memcpy(buf, OUTPUT_MAGIC, 4);
+    buf[4] = OUTPUT_VERSION;
+    size_t n = output_varint(buf, 5, self->grid);
+    fwrite(buf, 1, n, out);
+}
+
+/**
+ * write a point : MoveTo or LineTo
+ * @param self the encoder
+ * @param out the output, NULL to only update the state
+ * @param x the abscissa
+ * @param y the ordinate
+ * @param move true for MoveTo, false for LineTo
+ */
+void output_point(struct output *self, FILE *out, double x, double y, bool move) {
+    self->primitives++;
+    if (self->sink) {
+        self->sink->point(self->sink->data, x, y, move);
+        return;
+    }
+    if (self->format == OUTPUT_TEXT) {
+        if (out) {
+            int n = fprintf(out, move ? "MoveTo %f %f\n" : "LineTo %f %f\n", x, y);
+            self->bytes += n > 0 ? n : 0;
+        }
+        return;
+    }
+
+    int64_t qx, qy;
+    bool zx, zy;
+    if (!output_quantize(self, x, &qx, &zx) || !output_quantize(self, y, &qy, &zy)) {
+        if (out) {
+            char line[OUTPUT_TEXT_MAX];
+            snprintf(line, sizeof(line), move ? "MoveTo %f %f\n" : "LineTo %f %f\n", x, y);
+            self->bytes += output_text(out, line);
+        }
+        return;
+    }
+
+    unsigned char buf[32];
+    size_t n = 0;
+    enum output_pen pen = move ? OUTPUT_PEN_MOVE : OUTPUT_PEN_LINE;
+    if (pen != self->pen) {
+        n = output_varint(buf, n, 2 * (move ? OUTPUT_OP_MOVE : OUTPUT_OP_LINE) + 1);
+        self->pen = pen;
+    }
+    if (zx || zy) {
+        enum output_op op = zx && zy ? OUTPUT_OP_ZERO_XY : (zx ? OUTPUT_OP_ZERO_X : OUTPUT_OP_ZERO_Y);
+        n = output_varint(buf, n, 2 * op + 1);
+    }
+    n = output_varint(buf, n, output_zigzag(qx - self->x) << 1);
+    n = output_varint(buf, n, output_zigzag(qy - self->y));
+    self->x = qx;
+    self->y = qy;
+
+    if (out) {
+        fwrite(buf, 1, n, out);
+        self->bytes += n;
+    }
+}
+
+/**
+ * write a color
+ * @param self the encoder
+ * @param out the output, NULL to only update the state
+ * @param r the red component
+ * @param g the green component
+ * @param b the blue component
+ */
+void output_color(struct output *self, FILE *out, double r, double g, double b) {
+    self->primitives++;
+    if (self->sink) {
+        self->sink->color(self->sink->data, r, g, b);
+        return;
+    }
+    if (self->format == OUTPUT_TEXT) {
+        if (out) {
+            int n = fprintf(out, "Color %f %f %f\n", r, g, b);
+            self->bytes += n > 0 ? n : 0;
+        }
+        return;
+    }
+
+    double components[3] = { r, g, b };
+    uint64_t color[3];
+    for (size_t i = 0; i < 3; ++i) {
+        int64_t q;
+        bool zero;
+        if (!output_quantize(self, components[i], &q, &zero)) {
+            if (out) {
+                char line[OUTPUT_TEXT_MAX];
+                snprintf(line, sizeof(line), "Color %f %f %f\n", r, g, b);
+                self->bytes += output_text(out, line);
+            }
+            return;
+        }
+        color[i] = output_zigzag(q) << 1 | zero;
+    }
+
+    unsigned char buf[48];
+    size_t n = 0;
+    if (self->colored && memcmp(color, self->color, sizeof(color)) == 0) {
+        n = output_varint(buf, n, 2 * OUTPUT_OP_COLOR_AGAIN + 1);
+    } else {
+        n = output_varint(buf, n, 2 * OUTPUT_OP_COLOR + 1);
+        for (size_t i = 0; i < 3; ++i) {
+            n = output_varint(buf, n, color[i]);
+        }
+        memcpy(self->color, color, sizeof(color));
+        self->colored = true;
+    }
+
+    if (out) {
+        fwrite(buf, 1, n, out);
+        self->bytes += n;
+    }
+}
+
+/**
+ * intern function to read a varint
+ * @param in the input
+ * @param value the value read
+ * @return 1 on success, 0 at the end of the input, -1 if the varint is cut or too long
+ */
+static int output_read_varint(FILE *in, uint64_t *value) {
+    *value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        int c = getc(in);
+        if (c == EOF) {
+            return shift == 0 ? 0 : -1;
+        }
+        *value |= (uint64_t) (c & 0x7F) << shift;
+        if (!(c & 0x80)) {
+            return 1;
+        }
+    }
+    return -1;
+}
+
+/**
+ * intern function to get a value back from the grid
+ */
+static double output_value(uint64_t grid, int64_t q, bool zero) {
+    return zero ? -0.0 : q / (double) grid;
+}
+
+/**
+ * decode the binary format back to the text format
+ * @param in the binary primitives
+ * @param out where to write the text primitives
+ * @return 0 on success
+ */
+int output_decode(FILE *in, FILE *out) {
+    unsigned char magic[5];
+    uint64_t grid;
+    if (fread(magic, 1, 5, in) != 5 || memcmp(magic, OUTPUT_MAGIC, 4) != 0 || magic[4] != OUTPUT_VERSION
+        || output_read_varint(in, &grid) != 1 || grid == 0) {
+        fprintf(stderr, "Error : the input is not in the binary format\n");
+        return -1;
+    }
+
+    enum output_pen pen = OUTPUT_PEN_NONE;
+    int64_t x = 0;
+    int64_t y = 0;
+    bool zx = false;
+    bool zy = false;
+    bool colored = false;
+    uint64_t color[3] = { 0, 0, 0 };
+
+    for (;;) {
+        uint64_t h;
+        int ret = output_read_varint(in, &h);
+        if (ret == 0) {
+            return 0;
+        }
+        if (ret < 0) {
+            break;
+        }
+
+        if (!(h & 1)) {
+            uint64_t dy;
+            if (pen == OUTPUT_PEN_NONE || output_read_varint(in, &dy) != 1) {
+                break;
+            }
+            x += output_unzigzag(h >> 1);
+            y += output_unzigzag(dy);
+            fprintf(out, pen == OUTPUT_PEN_MOVE ? "MoveTo %f %f\n" : "LineTo %f %f\n",
+                output_value(grid, x, zx), output_value(grid, y, zy));
+            zx = false;
+            zy = false;
+            continue;
+        }
+
+        switch (h >> 1) {
+            case OUTPUT_OP_LINE:
+                pen = OUTPUT_PEN_LINE;
+                break;
+            case OUTPUT_OP_MOVE:
+                pen = OUTPUT_PEN_MOVE;
+                break;
+            case OUTPUT_OP_COLOR:
+                for (size_t i = 0; i < 3; ++i) {
+                    if (output_read_varint(in, &color[i]) != 1) {
+                        goto corrupted;
+                    }
+                }
+                colored = true;
+                // fall through
+            case OUTPUT_OP_COLOR_AGAIN:
+                if (!colored) {
+                    goto corrupted;
+                }
+                fprintf(out, "Color %f %f %f\n",
+                    output_value(grid, output_unzigzag(color[0] >> 1), color[0] & 1),
+                    output_value(grid, output_unzigzag(color[1] >> 1), color[1] & 1),
+                    output_value(grid, output_unzigzag(color[2] >> 1), color[2] & 1));
+                break;
+            case OUTPUT_OP_ZERO_X:
+                zx = true;
+                break;
+            case OUTPUT_OP_ZERO_Y:
+                zy = true;
+                break;
+            case OUTPUT_OP_ZERO_XY:
+                zx = true;
+                zy = true;
+                break;
+            case OUTPUT_OP_TEXT: {
+                uint64_t size;
+                char line[OUTPUT_TEXT_MAX];
+                if (output_read_varint(in, &size) != 1 || size > sizeof(line) || fread(line, 1, size, in) != size) {
+                    goto corrupted;
+                }
+                fwrite(line, 1, size, out);
+                break;
+            }
+            default:
+                goto corrupted;
+        }
+    }
+
+corrupted:
+    fprintf(stderr, "Error : the binary input is corrupted\n");
+    return -1;
+}
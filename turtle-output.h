@@ -0,0 +1,84 @@
+#ifndef TURTLE_OUTPUT_H
+#define TURTLE_OUTPUT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// default number of grid steps per unit of the binary format
+#define OUTPUT_GRID_DEFAULT 1000
+
+// format of the primitives
+enum output_format {
+    OUTPUT_TEXT,    // the lines MoveTo, LineTo and Color
+    OUTPUT_BINARY,  // the compact encoding below
+};
+
+/*
+ * the binary format starts with "TTOB", a version byte and the grid as a varint
+ * the coordinates and colors are rounded to the grid (1 / grid unit), then
+ * each record is a varint h :
+ *   h even : a point, h / 2 is the zigzag delta of x from the last point,
+ *            then the zigzag delta of y, with the pen of the last OP_LINE or OP_MOVE
+ *   h odd  : the operation h / 2, see enum output_op
+ * the decoder prints the rounded values with %f, the sign of the zeros is kept
+ * the values are rounded with llround, halfway away from zero, while %f rounds
+ * the exact value halfway to even : even with a grid of 1000000, a decoded
+ * value may differ from the text format by one in the last digit
+ */
+enum output_op {
+    OUTPUT_OP_LINE,        // the next points are LineTo
+    OUTPUT_OP_MOVE,        // the next points are MoveTo
+    OUTPUT_OP_COLOR,       // Color, then the 3 components as varints (zigzag << 1 | negative zero)
+    OUTPUT_OP_COLOR_AGAIN, // the last Color again
+    OUTPUT_OP_ZERO_X,      // x of the next point is -0
+    OUTPUT_OP_ZERO_Y,      // y of the next point is -0
+    OUTPUT_OP_ZERO_XY,     // x and y of the next point are -0
+    OUTPUT_OP_TEXT,        // a text line, the length as varint then the bytes (nan, inf, huge values)
+};
+
+// pen of the last point written
+enum output_pen {
+    OUTPUT_PEN_NONE,
+    OUTPUT_PEN_LINE,
+    OUTPUT_PEN_MOVE,
+};
+
+// receiver of the primitives in place of the encoder, flush may be NULL
+struct output_sink {
+    void (*point)(void *data, double x, double y, bool move);
+    void (*color)(void *data, double r, double g, double b);
+    void (*flush)(void *data);
+    void *data;
+};
+
+// state of the encoder, part of the context
+struct output {
+    enum output_format format;
+    uint64_t grid;          // grid steps per unit
+    enum output_pen pen;    // pen of the last point
+    int64_t x;              // last point, on the grid
+    int64_t y;
+    bool colored;           // true once a color was written
+    uint64_t color[3];      // last color, encoded
+    const struct output_sink *sink; // when set, the primitives go to the sink, not to out
+    uint64_t primitives;    // primitives written
+    uint64_t bytes;         // bytes written to out
+};
+
+// initialize the encoder
+void output_create(struct output *self, enum output_format format, uint64_t grid);
+
+// write the header of the format, at the start of the output
+void output_header(const struct output *self, FILE *out);
+
+// write a point, out may be NULL to only update the state
+void output_point(struct output *self, FILE *out, double x, double y, bool move);
+
+// write a color, out may be NULL to only update the state
+void output_color(struct output *self, FILE *out, double r, double g, double b);
+
+// decode the binary format back to the text format, returns 0 on success
+int output_decode(FILE *in, FILE *out);
+
+#endif /* TURTLE_OUTPUT_H */
@@ -0,0 +1,242 @@
+#include "turtle-parallel.h"
+
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// a chunk of iterations evaluated by a thread
+struct parallel_chunk {
+    pthread_t thread;
+    const struct ast_node *body;
+    const struct context *ctx; // the context of the loop, for the variables
+    double count;              // number of iterations
+
+    // pose at the start of the chunk
+    double x;
+    double y;
+    double angle;
+    bool up;
+    double r;
+    double g;
+    double b;
+    struct output output; // state of the encoder
+
+    // output of the chunk
+    char *buf;
+    size_t size;
+};
+
+static bool parallel_pure_expr(const struct ast_node *self) {
+    switch (self->kind) {
+        case KIND_EXPR_VALUE:
+        case KIND_EXPR_NAME:
+            return true;
+        case KIND_EXPR_FUNC:
+            if (self->u.func == FUNC_RANDOM) {
+                return false;
+            }
+            break;
+        case KIND_EXPR_UNOP:
+        case KIND_EXPR_BINOP:
+        case KIND_EXPR_BLOCK:
+            break;
+        default:
+            return false;
+    }
+
+    for (size_t i = 0; i < self->children_count; ++i) {
+        if (!parallel_pure_expr(self->children[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * check that a sequence of commands is deterministic motion :
+ * no set, proc, call, print or random
+ * @param self the first command of the sequence
+ * @return true if the iterations can be evaluated in any thread
+ */
+bool parallel_repeat_pure(const struct ast_node *self) {
+    for (; self; self = self->next) {
+        switch (self->kind) {
+            case KIND_CMD_SIMPLE:
+                if (self->u.cmd == CMD_PRINT) {
+                    return false;
+                }
+                for (size_t i = 0; i < self->children_count; ++i) {
+                    if (!parallel_pure_expr(self->children[i])) {
+                        return false;
+                    }
+                }
+                break;
+            case KIND_CMD_REPEAT:
+                if (!parallel_pure_expr(self->children[0]) || !parallel_repeat_pure(self->children[1])) {
+                    return false;
+                }
+                break;
+            case KIND_CMD_BLOCK:
+                if (!parallel_repeat_pure(self->children[0])) {
+                    return false;
+                }
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+static void parallel_pose_get(struct parallel_chunk *chunk, const struct context *ctx) {
+    chunk->x = ctx->x;
+    chunk->y = ctx->y;
+    chunk->angle = ctx->angle;
+    chunk->up = ctx->up;
+    chunk->r = ctx->color.r;
+    chunk->g = ctx->color.g;
+    chunk->b = ctx->color.b;
+    chunk->output = ctx->output;
+}
+
+static void parallel_pose_set(struct context *ctx, const struct parallel_chunk *chunk) {
+    ctx->x = chunk->x;
+    ctx->y = chunk->y;
+    ctx->angle = chunk->angle;
+    ctx->up = chunk->up;
+    ctx->color.r = chunk->r;
+    ctx->color.g = chunk->g;
+    ctx->color.b = chunk->b;
+    ctx->output = chunk->output;
+}
+
+/**
+ * evaluate a chunk of iterations in its own context and output buffer
+ * @param data the chunk
+ */
+static void *parallel_worker(void *data) {
+    struct parallel_chunk *chunk = data;
+
+    struct context ctx;
+    context_copy(&ctx, chunk->ctx);
+    ctx.threads = 1;
+    ctx.checkpoint = NULL;
+    parallel_pose_set(&ctx, chunk);
+
+    ctx.out = open_memstream(&chunk->buf, &chunk->size);
+    assert(ctx.out);
+    eval_repeat(chunk->body, chunk->count, &ctx);
+    fclose(ctx.out);
+
+    ctx_handler_destroy(&ctx);
+    return NULL;
+}
+
+/**
+ * compute the start pose of the chunks of a round with the context without output
+ * @param chunks the chunks to plan
+ * @param n the number of chunks of a round
+ * @param self the body of the loop
+ * @param remaining the number of iterations not planned yet
+ * @param dry the context without output
+ * @return the number of chunks planned, the next one fails if dry has an error
+ */
+static size_t parallel_plan(struct parallel_chunk *chunks, size_t n, const struct ast_node *self, double *remaining, struct context *dry) {
+    size_t i;
+    for (i = 0; i < n && *remaining >= 1; ++i) {
+        double count = fmin(ceil(*remaining / n), PARALLEL_CHUNK_ITERATIONS);
+
+        chunks[i].body = self;
+        chunks[i].count = count;
+        parallel_pose_get(&chunks[i], dry);
+
+        eval_repeat(self, count, dry);
+        if (dry->status != EVAL_OK) {
+            break;
+        }
+        *remaining -= count;
+    }
+    return i;
+}
+
+/**
+ * evaluate a body iter times, the output split in chunks between ctx->threads
+ * threads by rounds : the start poses of the chunks come from the sequential
+ * evaluation without output, and while the threads format the chunks of a
+ * round, this evaluation plans the chunks of the next round
+ * @param self the body of the loop
+ * @param iter the number of iterations
+ * @param ctx the context of the loop
+ */
+void parallel_repeat(const struct ast_node *self, double iter, struct context *ctx) {
+    size_t n = ctx->threads;
+    struct parallel_chunk *round = calloc(n + 1, sizeof(struct parallel_chunk));
+    struct parallel_chunk *next = calloc(n + 1, sizeof(struct parallel_chunk));
+    assert(round && next);
+
+    struct context dry;
+    context_copy(&dry, ctx);
+    dry.out = NULL;
+    dry.threads = 1;
+    dry.checkpoint = NULL;
+
+    double remaining = iter;
+    struct parallel_chunk failed; // the chunk where dry has an error
+    memset(&failed, 0, sizeof(struct parallel_chunk));
+    size_t count = parallel_plan(round, n, self, &remaining, &dry);
+    if (dry.status != EVAL_OK) {
+        failed = round[count];
+    }
+
+    while (count > 0) {
+        for (size_t i = 0; i < count; ++i) {
+            round[i].ctx = ctx;
+            if (pthread_create(&round[i].thread, NULL, parallel_worker, &round[i]) != 0) {
+                parallel_worker(&round[i]);
+                round[i].ctx = NULL;
+            }
+        }
+
+        size_t nextCount = 0;
+        if (dry.status == EVAL_OK) {
+            nextCount = parallel_plan(next, n, self, &remaining, &dry);
+            if (dry.status != EVAL_OK) {
+                failed = next[nextCount];
+            }
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            if (round[i].ctx) {
+                pthread_join(round[i].thread, NULL);
+            }
+            fwrite(round[i].buf, 1, round[i].size, ctx->out);
+            free(round[i].buf);
+        }
+
+        struct parallel_chunk *tmp = round;
+        round = next;
+        next = tmp;
+        count = nextCount;
+    }
+
+    if (dry.status != EVAL_OK) {
+        // the iterations from the failing chunk are evaluated again to get their output and error
+        parallel_pose_set(ctx, &failed);
+        eval_repeat(self, remaining, ctx);
+    } else {
+        ctx->x = dry.x;
+        ctx->y = dry.y;
+        ctx->angle = dry.angle;
+        ctx->up = dry.up;
+        ctx->color = dry.color;
+        ctx->output = dry.output;
+        ctx->executed = dry.executed;
+    }
+
+    ctx_handler_destroy(&dry);
+    free(round);
+    free(next);
+}
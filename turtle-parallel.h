@@ -0,0 +1,28 @@
+#ifndef TURTLE_PARALLEL_H
+#define TURTLE_PARALLEL_H
+
+#include "turtle-ast.h"
+
+// smallest repeat loop split between threads
+#define PARALLEL_MIN_ITERATIONS 4096
+
+// largest number of iterations given to a thread at once
+#define PARALLEL_CHUNK_ITERATIONS 16384
+
+/*
+ * repeat loops whose body only moves the turtle, with the primitives
+ * formatted in parallel : the loop itself is still evaluated sequentially,
+ * once without output to get the start pose of each chunk of iterations,
+ * then the threads evaluate their chunk again from its pose with their own
+ * output buffer, written in order. only the formatting of the primitives,
+ * which costs much more than moving the turtle, is shared between the
+ * threads, and the output is the same as the one of the sequential evaluation
+ */
+
+// check that a body has no side effect other than the pose and the output
+bool parallel_repeat_pure(const struct ast_node *self);
+
+// evaluate a body iter times, the primitives formatted by ctx->threads threads
+void parallel_repeat(const struct ast_node *self, double iter, struct context *ctx);
+
+#endif /* TURTLE_PARALLEL_H */
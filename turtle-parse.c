@@ -0,0 +1,354 @@
+// MAP_ANONYMOUS is not in POSIX
+#define _DEFAULT_SOURCE
+
+#include "turtle-parse.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "turtle-hoist.h"
+#include "turtle-parser.h"
+#include "turtle-lexer.h"
+
+/**
+ * intern function to run the parser on a scanner, and destroy the scanner
+ * @param scanner the scanner with its input
+ * @param root the tree to fill
+ * @return 0 on success
+ */
+static int parse_run(yyscan_t scanner, struct ast *root) {
+    int ret = yyparse(root, scanner);
+    yylex_destroy(scanner);
+
+    if (ret != 0) {
+        root->unit = NULL;
+    }
+    return ret;
+}
+
+/**
+ * parse a program from a file
+ * @param in the file to read
+ * @param root the tree to fill
+ * @return 0 on success
+ */
+int parse_file(FILE *in, struct ast *root) {
+    root->unit = NULL;
+    yyscan_t scanner;
+    if (yylex_init(&scanner) != 0) {
+        return -1;
+    }
+    yyset_in(in, scanner);
+    int ret = parse_run(scanner, root);
+    ast_fuse(root->unit);
+    ast_hoist(root->unit);
+    return ret;
+}
+
+/**
+ * parse a program from memory
+ * @param buf the text of the program
+ * @param size the size of the text
+ * @param root the tree to fill
+ * @return 0 on success
+ */
+int parse_buffer(const char *buf, size_t size, struct ast *root) {
+    root->unit = NULL;
+    yyscan_t scanner;
+    if (yylex_init(&scanner) != 0) {
+        return -1;
+    }
+    // the line of a buffer of a reentrant scanner is not reset by flex
+    yy_scan_bytes(buf, size, scanner);
+    yyset_lineno(1, scanner);
+    int ret = parse_run(scanner, root);
+    ast_fuse(root->unit);
+    ast_hoist(root->unit);
+    return ret;
+}
+
+// a part of a program parsed by a thread
+struct parse_chunk {
+    pthread_t thread;
+    const char *buf;
+    size_t size;
+    int line;               // line of the first byte in the program
+    struct ast root;
+    struct ast_node *last;  // last command of the part
+    int ret;
+};
+
+/**
+ * intern function to parse a part of a program in a thread
+ * @param data the part
+ * @return NULL
+ */
+static void *parse_chunk_run(void *data) {
+    struct parse_chunk *chunk = data;
+    chunk->root.unit = NULL;
+    yyscan_t scanner;
+    if (yylex_init(&scanner) != 0) {
+        chunk->ret = -1;
+        return NULL;
+    }
+    yy_scan_bytes(chunk->buf, chunk->size, scanner);
+    yyset_lineno(chunk->line, scanner);
+    chunk->ret = parse_run(scanner, &chunk->root);
+
+    chunk->last = chunk->root.unit;
+    while (chunk->last && chunk->last->next) {
+        chunk->last = chunk->last->next;
+    }
+    return NULL;
+}
+
+/**
+ * intern function to check that a word is a command, and if it opens a body
+ * @param word the word
+ * @param size the size of the word
+ * @param body set to true for repeat and proc, whose next command is their body
+ * @return true if the word is a command
+ */
+static bool parse_is_cmd(const char *word, size_t size, bool *body) {
+    static const char *cmds[] = {
+        "print", "up", "down", "forward", "fw", "backward", "bw", "position", "pos",
+        "right", "rt", "left", "lt", "heading", "hd", "color", "home", "set", "call",
+        "repeat", "proc",
+    };
+    for (size_t i = 0; i < sizeof(cmds) / sizeof(cmds[0]); ++i) {
+        if (strlen(cmds[i]) == size && memcmp(cmds[i], word, size) == 0) {
+            *body = i >= sizeof(cmds) / sizeof(cmds[0]) - 2;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * intern function to find where a program can be split in parts parsed
+ * separately : before a command or a block at the top level, which is not
+ * the body of a repeat or a proc. the text is scanned as the lexer does
+ * for the words, the comments and the braces
+ * @param buf the text of the program
+ * @param size the size of the text
+ * @param count the wanted number of parts
+ * @param chunks the parts to fill, count of them
+ * @return the number of parts, at least 1
+ */
+static size_t parse_split(const char *buf, size_t size, size_t count, struct parse_chunk *chunks) {
+    size_t n = 1;
+    chunks[0].buf = buf;
+    chunks[0].line = 1;
+
+    int line = 1;
+    size_t depth = 0;
+    bool pending = false; // the next command is the body of a repeat or a proc
+    size_t i = 0;
+    while (i < size && n < count) {
+        char c = buf[i];
+        size_t start = i;
+        bool split = false;
+
+        if (c == '\n') {
+            ++line;
+            ++i;
+        } else if (c == '#') {
+            // as the rule of the comments in the lexer
+            ++i;
+            while (i < size && ((buf[i] >= ' ' && buf[i] <= '_') || (buf[i] >= 'a' && buf[i] <= 'z'))) {
+                ++i;
+            }
+        } else if (c >= 'a' && c <= 'z') {
+            while (i < size && buf[i] >= 'a' && buf[i] <= 'z') {
+                ++i;
+            }
+            bool body;
+            if (depth == 0 && parse_is_cmd(buf + start, i - start, &body)) {
+                split = !pending;
+                pending = body;
+            }
+        } else if (c == '{') {
+            if (depth == 0) {
+                split = !pending;
+                pending = false;
+            }
+            ++depth;
+            ++i;
+        } else if (c == '}') {
+            if (depth > 0) {
+                --depth;
+            }
+            ++i;
+        } else {
+            ++i;
+        }
+
+        if (split && start >= size / count * n) {
+            chunks[n].buf = buf + start;
+            chunks[n].line = line;
+            ++n;
+        }
+    }
+
+    for (size_t k = 0; k < n; ++k) {
+        const char *end = k + 1 < n ? chunks[k + 1].buf : buf + size;
+        chunks[k].size = end - chunks[k].buf;
+    }
+    return n;
+}
+
+/**
+ * parse a program from memory with several threads : the text is split at
+ * the top level, the parts are parsed at the same time, each with its own
+ * scanner, and their sequences are linked in order. the tree is the same
+ * as the one of a sequential parse
+ * @param buf the text of the program
+ * @param size the size of the text
+ * @param threads the number of threads
+ * @param root the tree to fill
+ * @return 0 on success
+ */
+static int parse_parallel(const char *buf, size_t size, unsigned threads, struct ast *root) {
+    root->unit = NULL;
+
+    // the scanner takes the size of a part as an int
+    size_t count = threads;
+    if (size / count >= PARSE_CHUNK_MAX) {
+        count = size / PARSE_CHUNK_MAX + 1;
+    }
+    struct parse_chunk *chunks = calloc(count, sizeof(struct parse_chunk));
+    assert(chunks);
+    count = parse_split(buf, size, count, chunks);
+
+    int ret = 0;
+    for (size_t k = 0; k < count; ++k) {
+        if (chunks[k].size > INT_MAX) {
+            ret = -1;
+        }
+    }
+
+    // the parts are parsed by waves of threads
+    for (size_t k = 0; k < count && ret == 0; k += threads) {
+        size_t end = k + threads < count ? k + threads : count;
+        for (size_t j = k; j < end; ++j) {
+            if (pthread_create(&chunks[j].thread, NULL, parse_chunk_run, &chunks[j]) != 0) {
+                parse_chunk_run(&chunks[j]);
+                chunks[j].thread = pthread_self();
+            }
+        }
+        for (size_t j = k; j < end; ++j) {
+            if (!pthread_equal(chunks[j].thread, pthread_self())) {
+                pthread_join(chunks[j].thread, NULL);
+            }
+        }
+    }
+
+    struct ast_node **tail = &root->unit;
+    for (size_t k = 0; k < count; ++k) {
+        if (ret == 0 && chunks[k].ret != 0) {
+            ret = chunks[k].ret;
+        }
+        if (chunks[k].root.unit) {
+            *tail = chunks[k].root.unit;
+            tail = &chunks[k].last->next;
+        }
+    }
+    free(chunks);
+
+    if (ret != 0) {
+        ast_node_destroy(root->unit);
+        root->unit = NULL;
+    }
+    ast_fuse(root->unit);
+    ast_hoist(root->unit);
+    return ret;
+}
+
+/**
+ * parse a program file, mapped in memory and scanned in place
+ * flex needs two NUL bytes after the text : the file is mapped over a zeroed
+ * anonymous mapping one page longer, so they are always there. the mapping is
+ * private and writable because flex writes in the buffer while it scans
+ * a big file is parsed by parts with several threads
+ * @param path the file to parse
+ * @param threads the number of threads for a big file
+ * @param root the tree to fill
+ * @return 0 on success, -1 if the file can not be read
+ */
+int parse_path(const char *path, unsigned threads, struct ast *root) {
+    root->unit = NULL;
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    // a pipe or an empty file goes through stdio
+    long page = sysconf(_SC_PAGESIZE);
+    size_t size = st.st_size;
+    size_t length = (size + 2 + page - 1) / page * page;
+    char *base = MAP_FAILED;
+    if (S_ISREG(st.st_mode) && size > 0) {
+        base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (base != MAP_FAILED && mmap(base, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(base, length);
+        base = MAP_FAILED;
+    }
+    if (base == MAP_FAILED) {
+        FILE *in = fdopen(fd, "r");
+        if (in == NULL) {
+            perror(path);
+            close(fd);
+            return -1;
+        }
+        int ret = parse_file(in, root);
+        fclose(in);
+        return ret;
+    }
+    close(fd);
+    posix_madvise(base, size, POSIX_MADV_SEQUENTIAL);
+
+    int ret;
+    if (threads > 1 && size >= 2 * PARSE_CHUNK_MIN) {
+        if (size / threads < PARSE_CHUNK_MIN) {
+            threads = size / PARSE_CHUNK_MIN;
+        }
+        ret = parse_parallel(base, size, threads, root);
+        if (ret >= 0) {
+            munmap(base, length);
+            return ret;
+        }
+    }
+
+    yyscan_t scanner;
+    if (yylex_init(&scanner) != 0) {
+        munmap(base, length);
+        return -1;
+    }
+    // without the two NUL bytes, flex gives no buffer and would read stdin
+    if (yy_scan_buffer(base, size + 2, scanner) == NULL) {
+        fprintf(stderr, "Error : %s can not be scanned in place\n", path);
+        yylex_destroy(scanner);
+        munmap(base, length);
+        return -1;
+    }
+    yyset_lineno(1, scanner);
+    ret = parse_run(scanner, root);
+    munmap(base, length);
+
+    ast_fuse(root->unit);
+    ast_hoist(root->unit);
+    return ret;
+}
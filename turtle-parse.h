@@ -0,0 +1,29 @@
+#ifndef TURTLE_PARSE_H
+#define TURTLE_PARSE_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "turtle-ast.h"
+
+// smallest part of a program parsed by a thread
+#define PARSE_CHUNK_MIN (1 << 20)
+
+// largest part of a program parsed by a thread, the scanner takes an int
+#define PARSE_CHUNK_MAX (1 << 30)
+
+/*
+ * parse a whole program, each parse has its own scanner : several
+ * programs can be parsed at the same time
+ * the steps of the tree are marked with ast_fuse
+ * return 0 on success, root->unit is NULL on an error
+ */
+int parse_file(FILE *in, struct ast *root);
+int parse_buffer(const char *buf, size_t size, struct ast *root);
+
+// parse a program file without copying it, through mmap, -1 if it can not be read
+// a file of at least 2 * PARSE_CHUNK_MIN bytes is split at the top level and
+// its parts are parsed with up to threads threads
+int parse_path(const char *path, unsigned threads, struct ast *root);
+
+#endif /* TURTLE_PARSE_H */
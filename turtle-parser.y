@@ -4,18 +4,34 @@
 
 #include "turtle-ast.h"
 #include "turtle.h"
+%}
 
-int yylex();
-void yyerror(struct ast *ret, const char *);
+%code requires {
+// the state of a reentrant scanner, as in the header of flex
+#ifndef YY_TYPEDEF_YY_SCANNER_T
+#define YY_TYPEDEF_YY_SCANNER_T
+typedef void *yyscan_t;
+#endif
+}
 
-%}
+%code {
+int yylex(YYSTYPE *lvalp, YYLTYPE *llocp, yyscan_t scanner);
+void yyerror(YYLTYPE *loc, struct ast *ret, yyscan_t scanner, const char *);
+}
 
 %debug
 %defines
+%locations
 
 %define parse.error verbose
 
-%parse-param { struct ast *ret }
+/**
+ * The parser and the scanner are reentrant : several programs can be parsed
+ * at the same time, each with its own scanner.
+ */
+%define api.pure full
+%lex-param { yyscan_t scanner }
+%parse-param { struct ast *ret } { yyscan_t scanner }
 
 /**
  * All types possible.
@@ -26,6 +42,10 @@ void yyerror(struct ast *ret, const char *);
   double value;
   char *name;
   struct ast_node *node;
+  struct {
+    struct ast_node *first;
+    struct ast_node *last;
+  } list;
   struct {
   	double r;
   	double g;
@@ -61,7 +81,8 @@ void yyerror(struct ast *ret, const char *);
 %token		  MATH_RANDOM   "random"
 %token		  MATH_SQRT   	"sqrt"
 
-%type <node> unit cmds cmd expr
+%type <node> unit cmd expr
+%type <list> cmds
 
 /**
  * Priority rules :
@@ -76,19 +97,26 @@ void yyerror(struct ast *ret, const char *);
 %%
 
 unit:
-    cmds              { $$ = $1; ret->unit = $$; }
+    cmds              { $$ = $1.first; ret->unit = $$; }
 ;
 
+/**
+ * The sequence is left recursive, each command is appended to the last one
+ * as soon as it is parsed, so the stack of the parser does not grow with
+ * the length of the sequence.
+ */
 cmds:
-    cmd cmds          { $1->next = $2; $$ = $1; }
-  | /* empty */       { $$ = NULL; }
+    cmds cmd          { $2->line = @2.first_line;
+                        if ($1.last) { $1.last->next = $2; } else { $1.first = $2; }
+                        $$.first = $1.first; $$.last = $2; }
+  | /* empty */       { $$.first = NULL; $$.last = NULL; }
 ;
 
 /**
  * Grammar rules for each commands.
  */
 cmd:
-     '{' cmds '}'			{ $$ = make_cmd_block($2); 			}
+     '{' cmds '}'			{ $$ = make_cmd_block($2.first); 		}
   |  KW_UP	   			{ $$ = make_cmd_up(); 				}
   |  KW_DOWN				{ $$ = make_cmd_down(); 			}
   |  KW_FORWARD expr   			{ $$ = make_cmd_forward($2); 			}
@@ -101,9 +129,9 @@ cmd:
   |  KW_COLOR expr ',' expr ','	expr	{ $$ = make_cmd_color($2, $4, $6); 		}				/* color with values of rgb 	*/
   |  KW_COLOR COLOR			{ $$ = make_cmd_color_yy($<color>2.r, $<color>2.g, $<color>2.b); }		/* color with keyword 		*/
   |  KW_HOME				{ $$ = make_cmd_home(); 			}
-  |  KW_REPEAT expr cmd			{ $$ = make_cmd_repeat($2, $3); 		}
+  |  KW_REPEAT expr cmd			{ $3->line = @3.first_line; $$ = make_cmd_repeat($2, $3); }
   |  KW_SET NAME expr			{ $$ = make_cmd_set($2, $3);			}
-  |  KW_PROC NAME cmd			{ $$ = make_cmd_proc($2, $3); 			}
+  |  KW_PROC NAME cmd			{ $3->line = @3.first_line; $$ = make_cmd_proc($2, $3); }
   |  KW_CALL expr			{ $$ = make_cmd_call($2); 			}
 ;
 
@@ -130,7 +158,9 @@ expr:
 
 %%
 
-void yyerror(struct ast *ret, const char *msg) {
+void yyerror(YYLTYPE *loc, struct ast *ret, yyscan_t scanner, const char *msg) {
+  (void) loc;
   (void) ret;
+  (void) scanner;
   fprintf(stderr, "%s\n", msg);
 }
@@ -0,0 +1,170 @@
+#include "turtle-pipeline.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * intern function to wake a thread waiting on a condition, once a batch is ready
+ * the flag is read after the index was published, and the waiting thread
+ * sets it before it checks the index again : one of them sees the other
+ * @param self the pipeline
+ * @param waiting the flag of the waiting thread
+ * @param cond the condition it waits on
+ * @param ready the records written, or the free records, for the waiting thread
+ */
+static void pipeline_wake(struct pipeline *self, int *waiting, pthread_cond_t *cond, uint64_t ready) {
+    if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST) && ready >= PIPELINE_BATCH) {
+        pthread_mutex_lock(&self->lock);
+        pthread_cond_signal(cond);
+        pthread_mutex_unlock(&self->lock);
+    }
+}
+
+/**
+ * intern function to get the next record for the writer, waiting if the ring is empty
+ * @param self the pipeline
+ * @param record where to copy the record
+ * @return false once the ring is empty and closed
+ */
+static bool pipeline_pop(struct pipeline *self, struct pipeline_record *record) {
+    uint64_t tail = self->tail;
+    if (tail == __atomic_load_n(&self->head, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&self->lock);
+        __atomic_store_n(&self->consumerWaiting, 1, __ATOMIC_SEQ_CST);
+        while (tail == __atomic_load_n(&self->head, __ATOMIC_SEQ_CST)) {
+            if (__atomic_load_n(&self->closed, __ATOMIC_SEQ_CST)) {
+                __atomic_store_n(&self->consumerWaiting, 0, __ATOMIC_SEQ_CST);
+                pthread_mutex_unlock(&self->lock);
+                return false;
+            }
+            pthread_cond_wait(&self->notEmpty, &self->lock);
+        }
+        __atomic_store_n(&self->consumerWaiting, 0, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&self->lock);
+    }
+
+    *record = self->ring[tail & (PIPELINE_CAPACITY - 1)];
+    __atomic_store_n(&self->tail, tail + 1, __ATOMIC_SEQ_CST);
+    pipeline_wake(self, &self->producerWaiting, &self->notFull,
+                  PIPELINE_CAPACITY - (__atomic_load_n(&self->head, __ATOMIC_ACQUIRE) - (tail + 1)));
+    return true;
+}
+
+/**
+ * the writer thread : encode and write the records in order
+ * @param data the pipeline
+ */
+static void *pipeline_writer(void *data) {
+    struct pipeline *self = data;
+    struct pipeline_record record;
+    while (pipeline_pop(self, &record)) {
+        switch (record.op) {
+            case PIPELINE_LINE:
+            case PIPELINE_MOVE:
+                output_point(&self->output, self->out, record.values[0], record.values[1], record.op == PIPELINE_MOVE);
+                break;
+            case PIPELINE_COLOR:
+                output_color(&self->output, self->out, record.values[0], record.values[1], record.values[2]);
+                break;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * intern function to add a record for the writer, waiting if the ring is full
+ * @param self the pipeline
+ * @param record the record
+ */
+static void pipeline_push(struct pipeline *self, const struct pipeline_record *record) {
+    uint64_t head = self->head;
+    if (head - __atomic_load_n(&self->tail, __ATOMIC_ACQUIRE) == PIPELINE_CAPACITY) {
+        pthread_mutex_lock(&self->lock);
+        __atomic_store_n(&self->producerWaiting, 1, __ATOMIC_SEQ_CST);
+        while (head - __atomic_load_n(&self->tail, __ATOMIC_SEQ_CST) == PIPELINE_CAPACITY) {
+            pthread_cond_wait(&self->notFull, &self->lock);
+        }
+        __atomic_store_n(&self->producerWaiting, 0, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&self->lock);
+    }
+
+    self->ring[head & (PIPELINE_CAPACITY - 1)] = *record;
+    __atomic_store_n(&self->head, head + 1, __ATOMIC_SEQ_CST);
+    pipeline_wake(self, &self->consumerWaiting, &self->notEmpty, head + 1 - __atomic_load_n(&self->tail, __ATOMIC_ACQUIRE));
+}
+
+/**
+ * intern function to push a point, the sink of the evaluator
+ * @param data the pipeline
+ * @param x the abscissa
+ * @param y the ordinate
+ * @param move true for MoveTo, false for LineTo
+ */
+static void pipeline_point(void *data, double x, double y, bool move) {
+    struct pipeline *self = data;
+    struct pipeline_record record = { move ? PIPELINE_MOVE : PIPELINE_LINE, { x, y, 0.0 } };
+    pipeline_push(self, &record);
+}
+
+/**
+ * intern function to push a color, the sink of the evaluator
+ * @param data the pipeline
+ * @param r the red component
+ * @param g the green component
+ * @param b the blue component
+ */
+static void pipeline_color(void *data, double r, double g, double b) {
+    struct pipeline *self = data;
+    struct pipeline_record record = { PIPELINE_COLOR, { r, g, b } };
+    pipeline_push(self, &record);
+}
+
+/**
+ * start the writer thread, the primitives written with output go through the ring
+ * @param self the pipeline
+ * @param output the encoder of the evaluator, its state goes to the writer
+ * @param out where the writer writes
+ * @return 0 on success
+ */
+int pipeline_open(struct pipeline *self, struct output *output, FILE *out) {
+    memset(self, 0, sizeof(struct pipeline));
+    self->ring = malloc(PIPELINE_CAPACITY * sizeof(struct pipeline_record));
+    if (!self->ring) {
+        return -1;
+    }
+    self->out = out;
+    self->output = *output;
+    self->output.sink = NULL;
+    self->sink.point = pipeline_point;
+    self->sink.color = pipeline_color;
+    self->sink.data = self;
+    pthread_mutex_init(&self->lock, NULL);
+    pthread_cond_init(&self->notFull, NULL);
+    pthread_cond_init(&self->notEmpty, NULL);
+
+    if (pthread_create(&self->thread, NULL, pipeline_writer, self) != 0) {
+        free(self->ring);
+        return -1;
+    }
+    output->sink = &self->sink;
+    return 0;
+}
+
+/**
+ * write the remaining records and stop the writer thread
+ * @param self the pipeline
+ * @param output the encoder of the evaluator, it gets the state of the writer back
+ */
+void pipeline_close(struct pipeline *self, struct output *output) {
+    pthread_mutex_lock(&self->lock);
+    __atomic_store_n(&self->closed, 1, __ATOMIC_SEQ_CST);
+    pthread_cond_signal(&self->notEmpty);
+    pthread_mutex_unlock(&self->lock);
+    pthread_join(self->thread, NULL);
+
+    *output = self->output;
+    pthread_mutex_destroy(&self->lock);
+    pthread_cond_destroy(&self->notFull);
+    pthread_cond_destroy(&self->notEmpty);
+    free(self->ring);
+}
@@ -0,0 +1,71 @@
+#ifndef TURTLE_PIPELINE_H
+#define TURTLE_PIPELINE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "turtle-output.h"
+
+// number of records of the ring, a power of 2
+#define PIPELINE_CAPACITY 8192
+
+// records written or freed before the waiting thread is woken up
+#define PIPELINE_BATCH (PIPELINE_CAPACITY / 8)
+
+// size of a cache line, to keep the indexes of both threads apart
+#define PIPELINE_CACHE_LINE 64
+
+// kind of a record
+enum pipeline_op {
+    PIPELINE_LINE,
+    PIPELINE_MOVE,
+    PIPELINE_COLOR,
+};
+
+// a primitive, as computed by the evaluator
+struct pipeline_record {
+    enum pipeline_op op;
+    double values[3];
+};
+
+/*
+ * pipelined output : the evaluator pushes the primitives as records into a
+ * single-producer single-consumer ring, and a thread encodes them with its
+ * own encoder and writes them
+ * the fast path has no lock : each thread only writes its own index and reads
+ * the other one. a thread waits on a condition only when the ring is full
+ * (back-pressure on the evaluator) or empty, and it is woken up once a batch
+ * of records is ready, not for each record
+ */
+struct pipeline {
+    uint64_t head;                          // next record to write, by the evaluator
+    char padHead[PIPELINE_CACHE_LINE - sizeof(uint64_t)];
+    uint64_t tail;                          // next record to read, by the writer
+    char padTail[PIPELINE_CACHE_LINE - sizeof(uint64_t)];
+
+    struct pipeline_record *ring;
+    pthread_t thread;
+    FILE *out;
+    struct output output;                   // the encoder of the writer
+    struct output_sink sink;                // the evaluator side
+
+    // the slow path, when a thread has to wait
+    pthread_mutex_t lock;
+    pthread_cond_t notFull;
+    pthread_cond_t notEmpty;
+    int producerWaiting;
+    int consumerWaiting;
+    int closed;
+};
+
+// start the writer thread, the primitives of output go to out through the ring,
+// pushing a primitive waits while the ring is full
+// returns 0 on success
+int pipeline_open(struct pipeline *self, struct output *output, FILE *out);
+
+// write the remaining records, stop the thread and give back the encoder state
+void pipeline_close(struct pipeline *self, struct output *output);
+
+#endif /* TURTLE_PIPELINE_H */
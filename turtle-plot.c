@@ -0,0 +1,708 @@
+#include "turtle-plot.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// a polyline and its color, to group the polylines by pen
+struct plot_key {
+    double color[3];
+    size_t line;
+};
+
+// a polyline of a path, with the points where the path enters and leaves it
+struct plot_step {
+    double in[2];
+    double out[2];
+    size_t line;
+    bool backward;
+};
+
+// the polylines of a pen being ordered, with the grid of their ends
+struct plot_order {
+    const struct plot *plot;
+    const size_t *lines;   // the polylines of the pen
+    size_t count;
+
+    // the grid : the end 2 * k is the first point of lines[k], 2 * k + 1 its last point
+    double x0;
+    double y0;
+    double cell;           // side of a cell
+    long cols;
+    long rows;
+    size_t *start;         // first entry of each cell
+    size_t *used;          // ends left in each cell
+    size_t *entries;       // the ends, by cell
+    size_t *slot;          // position of each end in entries
+
+    // the polylines left, to search them all when the grid is almost empty
+    size_t *left;
+    size_t *leftSlot;
+    size_t leftCount;
+};
+
+/**
+ * intern function to add a point to the polylines
+ * @param self the plot
+ * @param x the abscissa
+ * @param y the ordinate
+ * @return false if the allocation failed
+ */
+static bool plot_push(struct plot *self, double x, double y) {
+    if (self->pointsCount == self->pointsCapacity) {
+        size_t capacity = self->pointsCapacity ? 2 * self->pointsCapacity : 1024;
+        double *points = realloc(self->points, 2 * capacity * sizeof(double));
+        if (!points) {
+            return false;
+        }
+        self->points = points;
+        self->pointsCapacity = capacity;
+    }
+    self->points[2 * self->pointsCount] = x;
+    self->points[2 * self->pointsCount + 1] = y;
+    self->pointsCount++;
+    return true;
+}
+
+/**
+ * intern function to start a polyline at the last point
+ * @param self the plot
+ * @return false if the allocation failed
+ */
+static bool plot_start(struct plot *self) {
+    if (self->linesCount == self->linesCapacity) {
+        size_t capacity = self->linesCapacity ? 2 * self->linesCapacity : 256;
+        struct plot_line *lines = realloc(self->lines, capacity * sizeof(struct plot_line));
+        if (!lines) {
+            return false;
+        }
+        self->lines = lines;
+        self->linesCapacity = capacity;
+    }
+    struct plot_line *line = &self->lines[self->linesCount];
+    line->first = self->pointsCount;
+    line->count = 0;
+    memcpy(line->color, self->color, sizeof(line->color));
+    if (!plot_push(self, self->x, self->y)) {
+        return false;
+    }
+    line->count = 1;
+    self->linesCount++;
+    return true;
+}
+
+/**
+ * intern function to receive a point from the evaluator
+ * @param data the plot
+ * @param x the abscissa
+ * @param y the ordinate
+ * @param move true for MoveTo, false for LineTo
+ */
+static void plot_point(void *data, double x, double y, bool move) {
+    struct plot *self = data;
+    if (move) {
+        self->drawing = false;
+    } else if (!self->failed) {
+        if (!self->drawing) {
+            self->failed = !plot_start(self);
+            self->drawing = !self->failed;
+        }
+        if (self->drawing && plot_push(self, x, y)) {
+            self->lines[self->linesCount - 1].count++;
+        } else {
+            self->failed = true;
+        }
+    }
+    self->x = x;
+    self->y = y;
+}
+
+/**
+ * intern function to receive a color from the evaluator
+ * @param data the plot
+ * @param r the red component
+ * @param g the green component
+ * @param b the blue component
+ */
+static void plot_color(void *data, double r, double g, double b) {
+    struct plot *self = data;
+    self->color[0] = r;
+    self->color[1] = g;
+    self->color[2] = b;
+    self->drawing = false;
+}
+
+/**
+ * collect the primitives of an output as polylines, instead of writing them
+ * @param self the plot
+ * @param output the output of the context
+ * @param format the language of the plotter
+ * @param scale millimeters per unit
+ * @param reverse true if a polyline may be drawn backward
+ */
+void plot_open(struct plot *self, struct output *output, enum plot_format format, double scale, bool reverse) {
+    memset(self, 0, sizeof(struct plot));
+    self->format = format;
+    self->scale = scale;
+    self->reverse = reverse;
+    self->sink.point = plot_point;
+    self->sink.color = plot_color;
+    self->sink.data = self;
+    output->sink = &self->sink;
+}
+
+/**
+ * intern function to get a point of a polyline
+ * @param self the plot
+ * @param line the polyline
+ * @param last false for its first point, true for its last one
+ * @return the x and y of the point
+ */
+static const double *plot_end(const struct plot *self, size_t line, bool last) {
+    const struct plot_line *l = &self->lines[line];
+    return &self->points[2 * (l->first + (last ? l->count - 1 : 0))];
+}
+
+/**
+ * intern function to get the distance between two points
+ */
+static double plot_distance(const double *a, const double *b) {
+    double dx = a[0] - b[0];
+    double dy = a[1] - b[1];
+    return sqrt(dx * dx + dy * dy);
+}
+
+/**
+ * intern function to get the point of an end of the grid
+ */
+static const double *plot_order_end(const struct plot_order *o, size_t end) {
+    return plot_end(o->plot, o->lines[end / 2], end & 1);
+}
+
+/**
+ * intern function to get the column of an abscissa, or the row of an ordinate
+ * @param value the coordinate
+ * @param origin the coordinate of the first cell
+ * @param cell the side of a cell
+ * @param count the number of columns or rows
+ * @return the column or row, the point is in the nearest one when it is outside
+ */
+static long plot_cell(double value, double origin, double cell, long count) {
+    double index = floor((value - origin) / cell);
+    if (!(index >= 0)) {
+        return 0;
+    }
+    return index >= count ? count - 1 : (long) index;
+}
+
+/**
+ * intern function to get the cell of an end
+ */
+static size_t plot_order_cell(const struct plot_order *o, size_t end) {
+    const double *p = plot_order_end(o, end);
+    return plot_cell(p[1], o->y0, o->cell, o->rows) * o->cols + plot_cell(p[0], o->x0, o->cell, o->cols);
+}
+
+/**
+ * intern function to release the grid of a pen
+ */
+static void plot_order_destroy(struct plot_order *o) {
+    free(o->start);
+    free(o->used);
+    free(o->entries);
+    free(o->slot);
+    free(o->left);
+    free(o->leftSlot);
+}
+
+/**
+ * intern function to build the grid of the ends of the polylines of a pen,
+ * with about one end per cell
+ * @param o the order, with its plot and polylines
+ * @return false if the allocation failed
+ */
+static bool plot_order_create(struct plot_order *o) {
+    size_t step = o->plot->reverse ? 1 : 2;
+    size_t ends = 2 * o->count;
+
+    double x1 = -INFINITY;
+    double y1 = -INFINITY;
+    o->x0 = INFINITY;
+    o->y0 = INFINITY;
+    for (size_t end = 0; end < ends; end += step) {
+        const double *p = plot_order_end(o, end);
+        o->x0 = fmin(o->x0, p[0]);
+        o->y0 = fmin(o->y0, p[1]);
+        x1 = fmax(x1, p[0]);
+        y1 = fmax(y1, p[1]);
+    }
+    double width = x1 - o->x0;
+    double height = y1 - o->y0;
+    size_t inserted = ends / step;
+    o->cell = sqrt(width * height / inserted);
+    if (!(o->cell > 0) || !isfinite(o->cell)) {
+        o->cell = fmax(width, height) / inserted;
+    }
+    if (!(o->cell > 0) || !isfinite(o->cell)) {
+        o->cell = 1;
+    }
+    // no more cells than ends, for the thin drawings
+    while ((width / o->cell + 1) * (height / o->cell + 1) > 2.0 * inserted + 1) {
+        o->cell *= 2;
+    }
+    o->cols = (long) (width / o->cell) + 1;
+    o->rows = (long) (height / o->cell) + 1;
+
+    size_t cells = (size_t) o->cols * o->rows;
+    o->start = calloc(cells + 1, sizeof(size_t));
+    o->used = calloc(cells, sizeof(size_t));
+    o->entries = malloc(inserted * sizeof(size_t));
+    o->slot = malloc(ends * sizeof(size_t));
+    o->left = malloc(o->count * sizeof(size_t));
+    o->leftSlot = malloc(o->count * sizeof(size_t));
+    if (!o->start || !o->used || !o->entries || !o->slot || !o->left || !o->leftSlot) {
+        return false;
+    }
+
+    for (size_t end = 0; end < ends; end += step) {
+        o->start[plot_order_cell(o, end) + 1]++;
+    }
+    for (size_t c = 0; c < cells; ++c) {
+        o->start[c + 1] += o->start[c];
+    }
+    for (size_t end = 0; end < ends; end += step) {
+        size_t c = plot_order_cell(o, end);
+        o->slot[end] = o->start[c] + o->used[c]++;
+        o->entries[o->slot[end]] = end;
+    }
+
+    for (size_t k = 0; k < o->count; ++k) {
+        o->left[k] = k;
+        o->leftSlot[k] = k;
+    }
+    o->leftCount = o->count;
+    return true;
+}
+
+/**
+ * intern function to take a polyline out of the grid
+ * @param o the order
+ * @param k the index of the polyline in o->lines
+ */
+static void plot_order_remove(struct plot_order *o, size_t k) {
+    for (size_t end = 2 * k; end < 2 * k + 2; end += o->plot->reverse ? 1 : 2) {
+        size_t c = plot_order_cell(o, end);
+        size_t last = o->start[c] + --o->used[c];
+        size_t moved = o->entries[last];
+        o->entries[o->slot[end]] = moved;
+        o->slot[moved] = o->slot[end];
+    }
+
+    size_t moved = o->left[--o->leftCount];
+    o->left[o->leftSlot[k]] = moved;
+    o->leftSlot[moved] = o->leftSlot[k];
+}
+
+/**
+ * intern function to keep the nearest of two ends, the smallest one on a tie
+ */
+static void plot_order_closer(const struct plot_order *o, const double *p, size_t end, size_t *best, double *bestDistance) {
+    double d = plot_distance(p, plot_order_end(o, end));
+    if (d < *bestDistance || (d == *bestDistance && end < *best)) {
+        *best = end;
+        *bestDistance = d;
+    }
+}
+
+/**
+ * intern function to find the nearest end of the polylines left : the cells
+ * are searched by rings around the point, until the next ring is further than
+ * the best end. when more cells than polylines were searched, the polylines
+ * left are searched instead
+ * @param o the order
+ * @param p the point
+ * @return the end
+ */
+static size_t plot_order_nearest(const struct plot_order *o, const double *p) {
+    long cx = plot_cell(p[0], o->x0, o->cell, o->cols);
+    long cy = plot_cell(p[1], o->y0, o->cell, o->rows);
+    size_t best = SIZE_MAX;
+    double bestDistance = INFINITY;
+    size_t searched = 0;
+    long rings = o->cols > o->rows ? o->cols : o->rows;
+
+    for (long r = 0; r <= rings; ++r) {
+        // the ends of the ring r are at least (r - 1) cells away
+        if (r > 0 && (r - 1) * o->cell > bestDistance) {
+            return best;
+        }
+        if (searched > o->leftCount) {
+            break;
+        }
+        for (long y = cy - r; y <= cy + r; ++y) {
+            if (y < 0 || y >= o->rows) {
+                continue;
+            }
+            long dx = (y == cy - r || y == cy + r) ? 1 : 2 * r;
+            for (long x = cx - r; x <= cx + r; x += dx > 0 ? dx : 1) {
+                if (x < 0 || x >= o->cols) {
+                    continue;
+                }
+                size_t c = (size_t) y * o->cols + x;
+                searched++;
+                for (size_t i = o->start[c]; i < o->start[c] + o->used[c]; ++i) {
+                    plot_order_closer(o, p, o->entries[i], &best, &bestDistance);
+                }
+            }
+        }
+    }
+    if (best != SIZE_MAX && searched <= o->leftCount) {
+        return best;
+    }
+
+    best = SIZE_MAX;
+    bestDistance = INFINITY;
+    for (size_t i = 0; i < o->leftCount; ++i) {
+        plot_order_closer(o, p, 2 * o->left[i], &best, &bestDistance);
+        if (o->plot->reverse) {
+            plot_order_closer(o, p, 2 * o->left[i] + 1, &best, &bestDistance);
+        }
+    }
+    return best;
+}
+
+/**
+ * intern function to get the point where the path enters or leaves a polyline
+ * @param self the plot
+ * @param line the polyline
+ * @param backward true if it is drawn backward
+ * @param exit false for the point where the path enters, true for where it leaves
+ */
+static const double *plot_path_end(const struct plot *self, size_t line, bool backward, bool exit) {
+    return plot_end(self, line, exit != backward);
+}
+
+/**
+ * intern function to draw a polyline of a path in the other direction
+ */
+static void plot_step_reverse(struct plot_step *self) {
+    double in[2] = { self->in[0], self->in[1] };
+    memcpy(self->in, self->out, sizeof(in));
+    memcpy(self->out, in, sizeof(in));
+    self->backward = !self->backward;
+}
+
+/**
+ * intern function to improve a path by 2-opt : a part of the path is drawn
+ * in the opposite order and direction when it shortens the moves with the pen up
+ * the ends of the polylines are copied next to each other, the 2-opt reads
+ * them for every exchange of the window
+ * @param self the plot
+ * @param from the point before the path
+ * @param path the polylines
+ * @param backward the directions, updated
+ * @param count the number of polylines
+ * @return false if the allocation failed
+ */
+static bool plot_two_opt(const struct plot *self, const double *from, size_t *path, bool *backward, size_t count) {
+    struct plot_step *steps = malloc(count * sizeof(struct plot_step) + 1);
+    if (!steps) {
+        return false;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        memcpy(steps[i].in, plot_path_end(self, path[i], backward[i], false), sizeof(steps[i].in));
+        memcpy(steps[i].out, plot_path_end(self, path[i], backward[i], true), sizeof(steps[i].out));
+        steps[i].line = path[i];
+        steps[i].backward = backward[i];
+    }
+
+    for (int pass = 0; pass < PLOT_TWO_OPT_PASSES; ++pass) {
+        bool improved = false;
+        for (size_t i = 0; i < count; ++i) {
+            // the part steps[i..j] is reversed
+            const double *a = i > 0 ? steps[i - 1].out : from;
+            for (size_t j = i; j < count && j < i + PLOT_TWO_OPT_WINDOW; ++j) {
+                const double *b = steps[i].in;
+                const double *c = steps[j].out;
+                double delta = plot_distance(a, c) - plot_distance(a, b);
+                if (j + 1 < count) {
+                    const double *d = steps[j + 1].in;
+                    delta += plot_distance(b, d) - plot_distance(c, d);
+                }
+                if (delta < -1e-9) {
+                    for (size_t lo = i, hi = j; lo <= hi && hi != SIZE_MAX; ++lo, --hi) {
+                        struct plot_step step = steps[lo];
+                        steps[lo] = steps[hi];
+                        steps[hi] = step;
+                        plot_step_reverse(&steps[lo]);
+                        if (lo != hi) {
+                            plot_step_reverse(&steps[hi]);
+                        }
+                    }
+                    improved = true;
+                }
+            }
+        }
+        if (!improved) {
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        path[i] = steps[i].line;
+        backward[i] = steps[i].backward;
+    }
+    free(steps);
+    return true;
+}
+
+/**
+ * intern function to order the polylines of a pen : nearest neighbour from
+ * the current point, then 2-opt when the polylines can be drawn backward
+ * @param self the plot
+ * @param from the point before the path, updated to the end of the path
+ * @param path the polylines, ordered in place
+ * @param backward the directions
+ * @param count the number of polylines
+ * @return false if the allocation failed
+ */
+static bool plot_order(const struct plot *self, double *from, size_t *path, bool *backward, size_t count) {
+    struct plot_order o;
+    memset(&o, 0, sizeof(struct plot_order));
+    o.plot = self;
+    o.lines = path;
+    o.count = count;
+    size_t *ordered = malloc(count * sizeof(size_t));
+    if (!ordered || !plot_order_create(&o)) {
+        free(ordered);
+        plot_order_destroy(&o);
+        return false;
+    }
+
+    double p[2] = { from[0], from[1] };
+    for (size_t i = 0; i < count; ++i) {
+        size_t end = plot_order_nearest(&o, p);
+        size_t k = end / 2;
+        plot_order_remove(&o, k);
+        ordered[i] = path[k];
+        backward[i] = end & 1;
+        const double *exit = plot_path_end(self, ordered[i], backward[i], true);
+        p[0] = exit[0];
+        p[1] = exit[1];
+    }
+    plot_order_destroy(&o);
+    memcpy(path, ordered, count * sizeof(size_t));
+    free(ordered);
+
+    if (self->reverse && !plot_two_opt(self, from, path, backward, count)) {
+        return false;
+    }
+    if (count > 0) {
+        const double *exit = plot_path_end(self, path[count - 1], backward[count - 1], true);
+        from[0] = exit[0];
+        from[1] = exit[1];
+    }
+    return true;
+}
+
+/**
+ * intern function to compare two colors
+ */
+static int plot_color_compare(const double *a, const double *b) {
+    for (size_t i = 0; i < 3; ++i) {
+        if (a[i] != b[i]) {
+            return a[i] < b[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * intern function to compare the colors of two polylines, then their order
+ */
+static int plot_key_compare(const void *a, const void *b) {
+    const struct plot_key *ka = a;
+    const struct plot_key *kb = b;
+    int color = plot_color_compare(ka->color, kb->color);
+    if (color != 0) {
+        return color;
+    }
+    return ka->line < kb->line ? -1 : ka->line > kb->line;
+}
+
+/**
+ * intern function to compare two pens by their first polyline
+ */
+static int plot_pen_compare(const void *a, const void *b) {
+    const struct plot_key *ka = *(const struct plot_key * const *) a;
+    const struct plot_key *kb = *(const struct plot_key * const *) b;
+    return ka->line < kb->line ? -1 : ka->line > kb->line;
+}
+
+/**
+ * intern function to get the length of the moves with the pen up of a path, from the origin
+ * @param self the plot
+ * @param path the polylines, NULL for the order of the program
+ * @param backward the directions, NULL for none backward
+ * @return the length
+ */
+static double plot_travel(const struct plot *self, const size_t *path, const bool *backward) {
+    double origin[2] = { 0.0, 0.0 };
+    const double *p = origin;
+    double length = 0.0;
+    for (size_t i = 0; i < self->linesCount; ++i) {
+        size_t line = path ? path[i] : i;
+        bool back = backward ? backward[i] : false;
+        length += plot_distance(p, plot_path_end(self, line, back, false));
+        p = plot_path_end(self, line, back, true);
+    }
+    return length;
+}
+
+/**
+ * intern function to write the polylines in HPGL, in plotter units
+ * @param self the plot
+ * @param path the polylines
+ * @param backward the directions
+ * @param pens the pen of each polyline, from 1
+ * @param out where to write
+ */
+static void plot_write_hpgl(const struct plot *self, const size_t *path, const bool *backward, const size_t *pens, FILE *out) {
+    double units = self->scale * PLOT_HPGL_UNITS;
+    fprintf(out, "IN;\n");
+    for (size_t i = 0; i < self->linesCount; ++i) {
+        if (i == 0 || pens[i] != pens[i - 1]) {
+            fprintf(out, "SP%zu;\n", pens[i]);
+        }
+        const struct plot_line *line = &self->lines[path[i]];
+        for (size_t j = 0; j < line->count; ++j) {
+            size_t k = line->first + (backward[i] ? line->count - 1 - j : j);
+            fprintf(out, "%s%ld,%ld", j == 0 ? "PU" : (j == 1 ? ";PD" : ","),
+                    lround(self->points[2 * k] * units), lround(-self->points[2 * k + 1] * units));
+        }
+        fprintf(out, ";\n");
+    }
+    fprintf(out, "PU;SP0;\n");
+}
+
+/**
+ * intern function to write the polylines in G-code, in millimeters
+ * the pen goes up and down along z, the program pauses to change the pen
+ * @param self the plot
+ * @param path the polylines
+ * @param backward the directions
+ * @param pens the pen of each polyline, from 1
+ * @param out where to write
+ */
+static void plot_write_gcode(const struct plot *self, const size_t *path, const bool *backward, const size_t *pens, FILE *out) {
+    fprintf(out, "G21\nG90\nG0 Z%.3f\n", PLOT_GCODE_UP);
+    for (size_t i = 0; i < self->linesCount; ++i) {
+        const struct plot_line *line = &self->lines[path[i]];
+        if (i == 0 || pens[i] != pens[i - 1]) {
+            fprintf(out, "; pen %zu : color %f %f %f\n", pens[i], line->color[0], line->color[1], line->color[2]);
+            if (i > 0) {
+                fprintf(out, "M0\n");
+            }
+        }
+        for (size_t j = 0; j < line->count; ++j) {
+            size_t k = line->first + (backward[i] ? line->count - 1 - j : j);
+            double x = self->points[2 * k] * self->scale;
+            double y = 0.0 - self->points[2 * k + 1] * self->scale;  // no -0.000
+            if (j == 0) {
+                fprintf(out, "G0 X%.3f Y%.3f\nG1 Z%.3f F%.0f\n", x, y, PLOT_GCODE_DOWN, PLOT_GCODE_FEED_PEN);
+            } else {
+                fprintf(out, j == 1 ? "G1 X%.3f Y%.3f F%.0f\n" : "G1 X%.3f Y%.3f\n", x, y, PLOT_GCODE_FEED_DRAW);
+            }
+        }
+        fprintf(out, "G0 Z%.3f\n", PLOT_GCODE_UP);
+    }
+    fprintf(out, "G0 X0 Y0\nM2\n");
+}
+
+/**
+ * intern function to release the polylines of a plot
+ */
+static void plot_destroy(struct plot *self) {
+    free(self->points);
+    free(self->lines);
+    self->points = NULL;
+    self->lines = NULL;
+}
+
+/**
+ * order the polylines by pen, shorten the moves with the pen up, then write
+ * them for the plotter and report the length of the moves before and after
+ * @param self the plot
+ * @param output the output of the context, it gets back its encoder
+ * @param out where to write
+ * @return 0 on success
+ */
+int plot_close(struct plot *self, struct output *output, FILE *out) {
+    output->sink = NULL;
+    size_t count = self->linesCount;
+    struct plot_key *keys = malloc(count * sizeof(struct plot_key) + 1);
+    struct plot_key **pens = malloc(count * sizeof(struct plot_key *) + 1);
+    size_t *path = malloc(count * sizeof(size_t) + 1);
+    size_t *penOf = malloc(count * sizeof(size_t) + 1);
+    bool *backward = calloc(count + 1, sizeof(bool));
+    int ret = 0;
+    if (self->failed || !keys || !pens || !path || !penOf || !backward) {
+        fprintf(stderr, "Error : the polylines could not be kept in memory\n");
+        ret = -1;
+        goto end;
+    }
+
+    // the polylines of a color are a pen, the pens in the order of their first use
+    for (size_t i = 0; i < count; ++i) {
+        memcpy(keys[i].color, self->lines[i].color, sizeof(keys[i].color));
+        keys[i].line = i;
+    }
+    qsort(keys, count, sizeof(struct plot_key), plot_key_compare);
+    size_t pensCount = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (i == 0 || plot_color_compare(keys[i].color, keys[i - 1].color) != 0) {
+            pens[pensCount++] = &keys[i];
+        }
+    }
+    qsort(pens, pensCount, sizeof(struct plot_key *), plot_pen_compare);
+
+    // each pen goes on from where the previous one stopped
+    double from[2] = { 0.0, 0.0 };
+    size_t ordered = 0;
+    for (size_t p = 0; p < pensCount; ++p) {
+        size_t first = ordered;
+        for (const struct plot_key *key = pens[p]; key < keys + count; ++key) {
+            if (plot_color_compare(key->color, pens[p]->color) != 0) {
+                break;
+            }
+            penOf[ordered] = p + 1;
+            path[ordered++] = key->line;
+        }
+        if (!plot_order(self, from, path + first, backward + first, ordered - first)) {
+            fprintf(stderr, "Error : the polylines could not be kept in memory\n");
+            ret = -1;
+            goto end;
+        }
+    }
+
+    if (self->format == PLOT_HPGL) {
+        plot_write_hpgl(self, path, backward, penOf, out);
+    } else {
+        plot_write_gcode(self, path, backward, penOf, out);
+    }
+    fprintf(stderr, "pen-up travel : %.3f before, %.3f after the ordering (%zu polylines, %zu pens)\n",
+            plot_travel(self, NULL, NULL), plot_travel(self, path, backward), count, pensCount);
+    if (ferror(out)) {
+        ret = -1;
+    }
+
+end:
+    free(keys);
+    free(pens);
+    free(path);
+    free(penOf);
+    free(backward);
+    plot_destroy(self);
+    return ret;
+}
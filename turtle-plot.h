@@ -0,0 +1,74 @@
+#ifndef TURTLE_PLOT_H
+#define TURTLE_PLOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "turtle-output.h"
+
+// iterations of the 2-opt over the whole path, and how far an exchange goes
+#define PLOT_TWO_OPT_PASSES 3
+#define PLOT_TWO_OPT_WINDOW 24
+
+// plotter units of HPGL per millimeter
+#define PLOT_HPGL_UNITS 40.0
+
+// G-code : heights of the pen and feed rates, in millimeters and millimeters per minute
+#define PLOT_GCODE_UP 5.0
+#define PLOT_GCODE_DOWN 0.0
+#define PLOT_GCODE_FEED_PEN 1000.0
+#define PLOT_GCODE_FEED_DRAW 3000.0
+
+// language of the plotter
+enum plot_format {
+    PLOT_HPGL,
+    PLOT_GCODE,
+};
+
+// a polyline drawn with the pen down, in a single color
+struct plot_line {
+    size_t first;      // index of its first point
+    size_t count;      // number of points, at least 2
+    double color[3];
+};
+
+/*
+ * output for pen plotters : the primitives are collected as polylines, then
+ * the polylines of each color (a pen, in the order of their first use) are
+ * ordered to shorten the moves with the pen up, and written in HPGL or G-code
+ * the order is built by nearest neighbour, with a grid of the ends of the
+ * polylines to find the nearest one, then improved by 2-opt exchanges of
+ * at most PLOT_TWO_OPT_WINDOW polylines. a polyline may be drawn backward,
+ * unless the directions are kept
+ * the y axis goes up on the plotter, down for the viewer : it is flipped
+ */
+struct plot {
+    enum plot_format format;
+    double scale;             // millimeters per unit
+    bool reverse;             // a polyline may be drawn backward
+
+    double *points;           // x and y of the points of the polylines
+    size_t pointsCount;
+    size_t pointsCapacity;
+    struct plot_line *lines;
+    size_t linesCount;
+    size_t linesCapacity;
+
+    double x;                 // last point
+    double y;
+    double color[3];          // current color
+    bool drawing;             // the last polyline goes on with the next LineTo
+    bool failed;              // a polyline could not be kept in memory
+
+    struct output_sink sink;
+};
+
+// collect the primitives of output, instead of writing them
+void plot_open(struct plot *self, struct output *output, enum plot_format format, double scale, bool reverse);
+
+// order the polylines, write them to out and report the moves with the pen up
+// to stderr, then release them. returns 0 on success
+int plot_close(struct plot *self, struct output *output, FILE *out);
+
+#endif /* TURTLE_PLOT_H */
@@ -0,0 +1,404 @@
+#include "turtle-server.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "turtle-budget.h"
+#include "turtle-parse.h"
+
+// number of accepted connections waiting for a thread
+#define SERVER_QUEUE_MAX 1024
+
+struct server {
+    int fd;
+    struct context template;   // context with the definitions of the libraries
+    struct budget budget;      // limits of each request
+    unsigned threads;
+
+    // connections waiting for a thread
+    pthread_mutex_t queueLock;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+    int queue[SERVER_QUEUE_MAX];
+    size_t head;
+    size_t size;
+
+    // statistics of the requests
+    pthread_mutex_t statsLock;
+    uint64_t histogram[SERVER_HISTOGRAM_BUCKETS];
+    uint64_t requests;
+    uint64_t failed;
+    double totalUs;
+    double maxUs;
+    uint64_t seed;
+};
+
+/**
+ * intern function to get the time in microseconds
+ */
+static double server_now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+/**
+ * record the latency of a request
+ * @param s the server
+ * @param us the latency in microseconds
+ * @param failed true if the program had an error
+ */
+static void server_record(struct server *s, double us, bool failed) {
+    size_t bucket = 0;
+    while (bucket < SERVER_HISTOGRAM_BUCKETS - 1 && us >= (double) (1ULL << bucket)) {
+        ++bucket;
+    }
+
+    pthread_mutex_lock(&s->statsLock);
+    s->histogram[bucket]++;
+    s->requests++;
+    s->failed += failed;
+    s->totalUs += us;
+    if (us > s->maxUs) {
+        s->maxUs = us;
+    }
+    pthread_mutex_unlock(&s->statsLock);
+}
+
+/**
+ * intern function to get an upper bound of a percentile from the histogram
+ */
+static uint64_t server_percentile(const uint64_t *histogram, uint64_t requests, double p) {
+    uint64_t target = (uint64_t) (p * requests);
+    uint64_t sum = 0;
+    for (size_t i = 0; i < SERVER_HISTOGRAM_BUCKETS; ++i) {
+        sum += histogram[i];
+        if (sum > target) {
+            return 1ULL << i;
+        }
+    }
+    return 1ULL << (SERVER_HISTOGRAM_BUCKETS - 1);
+}
+
+/**
+ * send the statistics of the requests
+ * @param s the server
+ * @param out the connection
+ */
+static void server_stats(struct server *s, FILE *out) {
+    uint64_t histogram[SERVER_HISTOGRAM_BUCKETS];
+
+    pthread_mutex_lock(&s->statsLock);
+    memcpy(histogram, s->histogram, sizeof(histogram));
+    uint64_t requests = s->requests;
+    uint64_t failed = s->failed;
+    double mean = requests ? s->totalUs / requests : 0.0;
+    double max = s->maxUs;
+    pthread_mutex_unlock(&s->statsLock);
+
+    fprintf(out, "requests %llu\n", (unsigned long long) requests);
+    fprintf(out, "failed %llu\n", (unsigned long long) failed);
+    fprintf(out, "mean_us %.1f\n", mean);
+    fprintf(out, "max_us %.1f\n", max);
+    fprintf(out, "p50_us %llu\n", (unsigned long long) server_percentile(histogram, requests, 0.50));
+    fprintf(out, "p90_us %llu\n", (unsigned long long) server_percentile(histogram, requests, 0.90));
+    fprintf(out, "p99_us %llu\n", (unsigned long long) server_percentile(histogram, requests, 0.99));
+    for (size_t i = 0; i < SERVER_HISTOGRAM_BUCKETS; ++i) {
+        if (histogram[i]) {
+            fprintf(out, "lt_us %llu %llu\n", 1ULL << i, (unsigned long long) histogram[i]);
+        }
+    }
+    fprintf(out, "Done\n");
+}
+
+/**
+ * intern function to read a whole request, within SERVER_REQUEST_SECONDS
+ * so that a slow or idle client does not hold a thread of the pool
+ * @param fd the connection
+ * @param size the size of the request
+ * @param start the time the connection was taken, in microseconds
+ * @return the request, NULL if it is too big, too slow or on an error
+ */
+static char *server_read(int fd, size_t *size, double start) {
+    size_t capacity = 4096;
+    char *buf = malloc(capacity);
+    assert(buf);
+
+    *size = 0;
+    for (;;) {
+        if (*size == capacity) {
+            if (capacity >= SERVER_REQUEST_MAX) {
+                free(buf);
+                return NULL;
+            }
+            capacity *= 2;
+            buf = realloc(buf, capacity);
+            assert(buf);
+        }
+
+        double left = start + SERVER_REQUEST_SECONDS * 1e6 - server_now_us();
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        int ready = left > 0 ? poll(&pfd, 1, (int) (left / 1000) + 1) : 0;
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ready <= 0) {
+            free(buf);
+            return NULL;
+        }
+
+        ssize_t n = read(fd, buf + *size, capacity - *size);
+        if (n == 0) {
+            return buf;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            free(buf);
+            return NULL;
+        }
+        *size += n;
+    }
+}
+
+/**
+ * handle a connection, then close it
+ * @param s the server
+ * @param fd the connection
+ */
+static void server_handle(struct server *s, int fd) {
+    double start = server_now_us();
+
+    size_t size;
+    char *request = server_read(fd, &size, start);
+    FILE *out = fdopen(fd, "w");
+    if (out == NULL) {
+        close(fd);
+        free(request);
+        return;
+    }
+    if (request == NULL) {
+        fprintf(out, "Error : the request could not be read\n");
+        fclose(out);
+        return;
+    }
+
+    // the command line
+    char *program = memchr(request, '\n', size);
+    size_t line = program ? (size_t) (program - request) : size;
+    program = program ? program + 1 : request + size;
+    size_t programSize = size - (program - request);
+
+    if (line >= 5 && strncmp(request, "STATS", 5) == 0) {
+        server_stats(s, out);
+        fclose(out);
+        free(request);
+        return;
+    }
+    if (line < 3 || strncmp(request, "RUN", 3) != 0) {
+        fprintf(out, "Error : unknown request\n");
+        fclose(out);
+        free(request);
+        return;
+    }
+
+    struct context ctx;
+    context_copy(&ctx, &s->template);
+    ctx.out = out;
+    ctx.threads = 1;
+
+    pthread_mutex_lock(&s->statsLock);
+    ctx.seed = s->seed++;
+    pthread_mutex_unlock(&s->statsLock);
+    if (line > 4) {
+        ctx.seed = strtoull(request + 4, NULL, 10);
+    }
+
+    struct ast root;
+    int ret = parse_buffer(program, programSize, &root);
+    free(request);
+
+    struct budget budget = s->budget;
+    if (ret == 0 && budget_check_ast(&budget, &root, &ctx) == 0) {
+        if (budget_limited(&budget)) {
+            budget_start(&budget, &ctx);
+        }
+        ast_eval(&root, &ctx);
+    }
+
+    bool failed = true;
+    if (ret != 0) {
+        fprintf(out, "Error : the program could not be parsed\n");
+    } else if (ctx.status != EVAL_OK) {
+        if (ctx.error.line > 0) {
+            fprintf(out, "Error : line %d : %s\n", ctx.error.line, ctx.error.msg);
+        } else {
+            fprintf(out, "Error : %s\n", ctx.error.msg);
+        }
+    } else {
+        fprintf(out, "Done\n");
+        failed = false;
+    }
+
+    fclose(out);
+    ast_destroy(&root);
+    ctx_handler_destroy(&ctx);
+
+    server_record(s, server_now_us() - start, failed);
+}
+
+/**
+ * thread of the pool : handle the connections of the queue
+ * @param data the server
+ */
+static void *server_worker(void *data) {
+    struct server *s = data;
+
+    for (;;) {
+        pthread_mutex_lock(&s->queueLock);
+        while (s->size == 0) {
+            pthread_cond_wait(&s->notEmpty, &s->queueLock);
+        }
+        int fd = s->queue[s->head];
+        s->head = (s->head + 1) % SERVER_QUEUE_MAX;
+        s->size--;
+        pthread_cond_signal(&s->notFull);
+        pthread_mutex_unlock(&s->queueLock);
+
+        server_handle(s, fd);
+    }
+
+    return NULL;
+}
+
+/**
+ * evaluate a library in the template context, its procedures
+ * and variables are then defined for every request
+ * @param s the server
+ * @param path the library file
+ * @return 0 on success
+ */
+static int server_library(struct server *s, const char *path) {
+    // the tree of a library is kept until the end, for its procedures
+    struct ast *root = calloc(1, sizeof(struct ast));
+    assert(root);
+    int ret = parse_path(path, 1, root);
+    if (ret != 0) {
+        if (ret > 0) {
+            fprintf(stderr, "Error : the library %s could not be parsed\n", path);
+        }
+        free(root);
+        return -1;
+    }
+
+    FILE *out = s->template.out;
+    s->template.out = NULL;
+    if (ast_eval(root, &s->template) != EVAL_OK) {
+        fprintf(stderr, "%s : ", path);
+        eval_error_print(&s->template);
+        ast_destroy(root);
+        free(root);
+        return -1;
+    }
+    s->template.out = out;
+    return 0;
+}
+
+/**
+ * server mode : evaluate the programs sent on a UNIX domain socket
+ * @param path the path of the socket
+ * @param libraries the files of the libraries
+ * @param count the number of libraries
+ * @param init the initial context, its number of threads is the size of the pool
+ * @return only on a startup error
+ */
+int server_run(const char *path, const char **libraries, size_t count, const struct context *init) {
+    struct server *s = calloc(1, sizeof(struct server));
+    assert(s);
+    context_copy(&s->template, init);
+    budget_create(&s->budget);
+    if (init->budget) {
+        s->budget = *init->budget;
+        s->template.budget = NULL;
+    }
+    s->threads = init->threads;
+    s->seed = init->seed;
+    pthread_mutex_init(&s->queueLock, NULL);
+    pthread_mutex_init(&s->statsLock, NULL);
+    pthread_cond_init(&s->notEmpty, NULL);
+    pthread_cond_init(&s->notFull, NULL);
+
+    for (size_t i = 0; i < count; ++i) {
+        if (server_library(s, libraries[i]) != 0) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error : the socket path %s is too long\n", path);
+        return EXIT_FAILURE;
+    }
+    strcpy(addr.sun_path, path);
+
+    s->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);
+    if (s->fd < 0 || bind(s->fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(s->fd, SOMAXCONN) != 0) {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+
+    // a client which leaves must not stop the server
+    struct sigaction ignore;
+    memset(&ignore, 0, sizeof(ignore));
+    ignore.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &ignore, NULL);
+
+    for (unsigned i = 0; i < s->threads; ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, server_worker, s) != 0) {
+            perror("pthread_create");
+            return EXIT_FAILURE;
+        }
+    }
+
+    fprintf(stderr, "server : listening on %s with %u threads\n", path, s->threads);
+
+    for (;;) {
+        int fd = accept(s->fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR) {
+                perror("accept");
+            }
+            continue;
+        }
+
+        // a client which does not read its response does not hold a thread either
+        struct timeval timeout = { .tv_sec = SERVER_REQUEST_SECONDS };
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        pthread_mutex_lock(&s->queueLock);
+        while (s->size == SERVER_QUEUE_MAX) {
+            pthread_cond_wait(&s->notFull, &s->queueLock);
+        }
+        s->queue[(s->head + s->size) % SERVER_QUEUE_MAX] = fd;
+        s->size++;
+        pthread_cond_signal(&s->notEmpty);
+        pthread_mutex_unlock(&s->queueLock);
+    }
+}
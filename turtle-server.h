@@ -0,0 +1,36 @@
+#ifndef TURTLE_SERVER_H
+#define TURTLE_SERVER_H
+
+#include <stddef.h>
+
+#include "turtle-ast.h"
+
+// largest program accepted in a request
+#define SERVER_REQUEST_MAX (64 * 1024 * 1024)
+
+// seconds given to a client to send its request, and to each write of the response
+#define SERVER_REQUEST_SECONDS 10
+
+// number of buckets of the latency histogram, bucket i counts latencies < 2^i us
+#define SERVER_HISTOGRAM_BUCKETS 32
+
+/*
+ * server mode : listen on a UNIX domain socket and evaluate the programs
+ * sent by the clients, each with its own context, on a pool of threads
+ *
+ * a request is a command line followed by the program, until the client
+ * shuts down its side of the connection :
+ *   RUN [seed]\n<program>  the primitives are sent back, then a last line
+ *                          "Done" or "Error : line N : message"
+ *   STATS\n                the latency histogram of the requests is sent back,
+ *                          then a last line "Done"
+ *
+ * a client which does not send its whole request within SERVER_REQUEST_SECONDS
+ * gets "Error : the request could not be read", and the connection is closed
+ *
+ * the procedures and variables of the libraries are defined in the context
+ * of every request. returns only on a startup error.
+ */
+int server_run(const char *path, const char **libraries, size_t count, const struct context *init);
+
+#endif /* TURTLE_SERVER_H */
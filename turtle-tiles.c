@@ -0,0 +1,606 @@
+#include "turtle-tiles.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// maximum length of the path of a tile file
+#define TILES_PATH_MAX 4096
+
+// a tile which is not empty, with the records not written to its file yet
+struct tiles_tile {
+    size_t level;
+    uint32_t x;
+    uint32_t y;
+    uint64_t segments;
+    uint16_t color[3];          // color of the last record
+    bool created;               // its file was created
+    unsigned char *buffer;
+    size_t size;
+    size_t capacity;
+};
+
+// a segment written to a tile, to find it again
+struct tiles_recent {
+    uint64_t segment;           // the ends on the grid, the smallest end first
+    uint32_t tile;              // index of the tile, UINT32_MAX for an empty entry
+    uint16_t color[3];
+};
+
+// the tiles of an export
+struct tiles_pyramid {
+    const struct tiles *tiles;
+    double x0;                  // the square of the level 0
+    double y0;
+    double size;
+    struct tiles_tile *all;
+    size_t count;
+    size_t capacity;
+    size_t *table;              // open addressing, indexes in all, SIZE_MAX when empty
+    size_t tableSize;
+    size_t buffered;            // bytes of the buffers
+    struct tiles_recent *recent; // TILES_RECENT segments written, by hash
+};
+
+/**
+ * intern function to put a color on 16 bits per component
+ * @param color the components, between 0 and 1
+ * @param packed the color on 16 bits
+ */
+static void tiles_pack(const double *color, uint16_t *packed) {
+    for (size_t i = 0; i < 3; ++i) {
+        packed[i] = (uint16_t) lround(fmin(fmax(color[i], 0.0), 1.0) * 65535);
+    }
+}
+
+/**
+ * intern function to write the segments not spilled yet
+ * @param self the export
+ */
+static void tiles_spill(struct tiles *self) {
+    if (self->chunkCount && fwrite(self->chunk, sizeof(struct tiles_segment), self->chunkCount, self->spill) != self->chunkCount) {
+        self->failed = true;
+    }
+    self->chunkCount = 0;
+}
+
+/**
+ * intern function to receive a point from the evaluator
+ * @param data the export
+ * @param x the abscissa
+ * @param y the ordinate
+ * @param move true for MoveTo, false for LineTo
+ */
+static void tiles_point(void *data, double x, double y, bool move) {
+    struct tiles *self = data;
+    double x1 = self->x;
+    double y1 = self->y;
+    self->x = x;
+    self->y = y;
+    if (move) {
+        return;
+    }
+    // the tiles of a huge drawing would be empty but one
+    if (!(fabs(x1) < 1e15) || !(fabs(y1) < 1e15) || !(fabs(x) < 1e15) || !(fabs(y) < 1e15)) {
+        self->skipped++;
+        return;
+    }
+
+    struct tiles_segment *segment = &self->chunk[self->chunkCount++];
+    segment->x1 = x1;
+    segment->y1 = y1;
+    segment->x2 = x;
+    segment->y2 = y;
+    memcpy(segment->color, self->color, sizeof(segment->color));
+    self->min[0] = fmin(self->min[0], fmin(x1, x));
+    self->min[1] = fmin(self->min[1], fmin(y1, y));
+    self->max[0] = fmax(self->max[0], fmax(x1, x));
+    self->max[1] = fmax(self->max[1], fmax(y1, y));
+    self->segments++;
+    if (self->chunkCount == TILES_CHUNK) {
+        tiles_spill(self);
+    }
+}
+
+/**
+ * intern function to receive a color from the evaluator
+ * @param data the export
+ * @param r the red component
+ * @param g the green component
+ * @param b the blue component
+ */
+static void tiles_color(void *data, double r, double g, double b) {
+    struct tiles *self = data;
+    double color[3] = { r, g, b };
+    tiles_pack(color, self->color);
+}
+
+/**
+ * collect the segments of an output to export them as tiles
+ * @param self the export
+ * @param output the output of the context
+ * @param dir the directory of the tiles, created if needed
+ * @param levels the number of zoom levels
+ * @return 0 on success
+ */
+int tiles_open(struct tiles *self, struct output *output, const char *dir, size_t levels) {
+    memset(self, 0, sizeof(struct tiles));
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+        perror(dir);
+        return -1;
+    }
+    self->spill = tmpfile();
+    self->chunk = malloc(TILES_CHUNK * sizeof(struct tiles_segment));
+    if (!self->spill || !self->chunk) {
+        fprintf(stderr, "Error : the segments could not be spilled to a temporary file\n");
+        if (self->spill) {
+            fclose(self->spill);
+        }
+        free(self->chunk);
+        return -1;
+    }
+    self->dir = dir;
+    self->levels = levels;
+    self->min[0] = self->min[1] = INFINITY;
+    self->max[0] = self->max[1] = -INFINITY;
+    self->sink.point = tiles_point;
+    self->sink.color = tiles_color;
+    self->sink.data = self;
+    output->sink = &self->sink;
+    return 0;
+}
+
+/**
+ * intern function to write a varint
+ * @param buf the buffer
+ * @param n the bytes in buf
+ * @param value the value
+ * @return the bytes in buf
+ */
+static size_t tiles_varint(unsigned char *buf, size_t n, uint64_t value) {
+    while (value >= 0x80) {
+        buf[n++] = (unsigned char) (value | 0x80);
+        value >>= 7;
+    }
+    buf[n++] = (unsigned char) value;
+    return n;
+}
+
+/**
+ * intern function to get the path of the file of a tile
+ * @param self the pyramid
+ * @param tile the tile
+ * @param path the path
+ */
+static void tiles_path(const struct tiles_pyramid *self, const struct tiles_tile *tile, char *path) {
+    snprintf(path, TILES_PATH_MAX, "%s/%zu-%" PRIu32 "-%" PRIu32 ".tile", self->tiles->dir, tile->level, tile->x, tile->y);
+}
+
+/**
+ * intern function to append the buffer of a tile to its file, created with its header
+ * @param self the pyramid
+ * @param tile the tile
+ * @return 0 on success
+ */
+static int tiles_write(struct tiles_pyramid *self, struct tiles_tile *tile) {
+    if (tile->size == 0) {
+        return 0;
+    }
+    char path[TILES_PATH_MAX];
+    tiles_path(self, tile, path);
+    FILE *file = fopen(path, tile->created ? "ab" : "wb");
+    if (!file) {
+        perror(path);
+        return -1;
+    }
+    int ret = 0;
+    if (!tile->created) {
+        unsigned char header[64];
+        memcpy(header, TILES_MAGIC, 4);
+        header[4] = TILES_VERSION;
+        size_t n = tiles_varint(header, 5, tile->level);
+        n = tiles_varint(header, n, tile->x);
+        n = tiles_varint(header, n, tile->y);
+        n = tiles_varint(header, n, TILES_GRID);
+        ret = fwrite(header, 1, n, file) == n ? 0 : -1;
+        tile->created = true;
+    }
+    if (fwrite(tile->buffer, 1, tile->size, file) != tile->size || ret != 0) {
+        ret = -1;
+    }
+    if (fclose(file) != 0 || ret != 0) {
+        fprintf(stderr, "Error : the tile '%s' could not be written\n", path);
+        ret = -1;
+    }
+    self->buffered -= tile->size;
+    free(tile->buffer);
+    tile->buffer = NULL;
+    tile->size = 0;
+    tile->capacity = 0;
+    return ret;
+}
+
+/**
+ * intern function to append the buffers of all the tiles to their files
+ * @param self the pyramid
+ * @return 0 on success
+ */
+static int tiles_write_all(struct tiles_pyramid *self) {
+    for (size_t i = 0; i < self->count; ++i) {
+        if (tiles_write(self, &self->all[i]) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * intern function to get the slot of a tile in the table
+ */
+static size_t tiles_slot(const struct tiles_pyramid *self, size_t level, uint32_t x, uint32_t y) {
+    uint64_t h = (uint64_t) level << 58 ^ (uint64_t) x << 29 ^ y;
+    h ^= h >> 31;
+    h *= 0x9E3779B97F4A7C15ULL;
+    h ^= h >> 29;
+    size_t slot = h & (self->tableSize - 1);
+    while (self->table[slot] != SIZE_MAX) {
+        const struct tiles_tile *tile = &self->all[self->table[slot]];
+        if (tile->level == level && tile->x == x && tile->y == y) {
+            break;
+        }
+        slot = (slot + 1) & (self->tableSize - 1);
+    }
+    return slot;
+}
+
+/**
+ * intern function to find a tile, added when it is not there yet
+ * @param self the pyramid
+ * @param level the level
+ * @param x the column
+ * @param y the row
+ * @return the tile, NULL if the allocation failed
+ */
+static struct tiles_tile *tiles_find(struct tiles_pyramid *self, size_t level, uint32_t x, uint32_t y) {
+    size_t slot = tiles_slot(self, level, x, y);
+    if (self->table[slot] != SIZE_MAX) {
+        return &self->all[self->table[slot]];
+    }
+
+    if (self->count == self->capacity) {
+        size_t capacity = self->capacity ? 2 * self->capacity : 256;
+        struct tiles_tile *all = realloc(self->all, capacity * sizeof(struct tiles_tile));
+        if (!all) {
+            return NULL;
+        }
+        self->all = all;
+        self->capacity = capacity;
+    }
+    // the table stays at most half full
+    if (2 * (self->count + 1) > self->tableSize) {
+        size_t *table = malloc(2 * self->tableSize * sizeof(size_t));
+        if (!table) {
+            return NULL;
+        }
+        free(self->table);
+        self->table = table;
+        self->tableSize *= 2;
+        for (size_t i = 0; i < self->tableSize; ++i) {
+            self->table[i] = SIZE_MAX;
+        }
+        for (size_t i = 0; i < self->count; ++i) {
+            self->table[tiles_slot(self, self->all[i].level, self->all[i].x, self->all[i].y)] = i;
+        }
+        slot = tiles_slot(self, level, x, y);
+    }
+
+    struct tiles_tile *tile = &self->all[self->count];
+    memset(tile, 0, sizeof(struct tiles_tile));
+    tile->level = level;
+    tile->x = x;
+    tile->y = y;
+    self->table[slot] = self->count++;
+    return tile;
+}
+
+/**
+ * intern function to add bytes to the buffer of a tile
+ * @return false if the allocation failed
+ */
+static bool tiles_append(struct tiles_pyramid *self, struct tiles_tile *tile, const unsigned char *bytes, size_t n) {
+    if (tile->size + n > tile->capacity) {
+        size_t capacity = tile->capacity ? 2 * tile->capacity : 256;
+        unsigned char *buffer = realloc(tile->buffer, capacity);
+        if (!buffer) {
+            return false;
+        }
+        tile->buffer = buffer;
+        tile->capacity = capacity;
+    }
+    memcpy(tile->buffer + tile->size, bytes, n);
+    tile->size += n;
+    self->buffered += n;
+    return true;
+}
+
+/**
+ * intern function to put a coordinate on the grid of a tile
+ * @param value the coordinate
+ * @param origin the smallest coordinate of the tile
+ * @param size the side of the tile
+ * @param simplified true to put it at the center of its pixel
+ * @return the coordinate on the grid
+ */
+static uint16_t tiles_quantize(double value, double origin, double size, bool simplified) {
+    double q = fmin(fmax(round((value - origin) / size * TILES_GRID), 0), TILES_GRID);
+    if (simplified) {
+        const int pixel = TILES_GRID / TILES_PIXELS;
+        int p = (int) q / pixel;
+        q = (p < TILES_PIXELS ? p : TILES_PIXELS - 1) * pixel + pixel / 2;
+    }
+    return (uint16_t) q;
+}
+
+/**
+ * intern function to add a segment clipped to a tile
+ * @param self the pyramid
+ * @param level the level of the tile
+ * @param x the column of the tile
+ * @param y the row of the tile
+ * @param origin the smallest x and y of the tile
+ * @param size the side of the tile
+ * @param s the segment clipped : x1, y1, x2, y2
+ * @param color the color of the segment
+ * @return 0 on success
+ */
+static int tiles_put(struct tiles_pyramid *self, size_t level, uint32_t x, uint32_t y, const double *origin, double size,
+                     const double *s, const uint16_t *color) {
+    bool simplified = level + 1 < self->tiles->levels;
+    uint16_t q[4];
+    for (size_t i = 0; i < 4; ++i) {
+        q[i] = tiles_quantize(s[i], origin[i & 1], size, simplified);
+    }
+    if (q[0] == q[2] && q[1] == q[3]) {
+        return 0;
+    }
+
+    struct tiles_tile *tile = tiles_find(self, level, x, y);
+    if (!tile) {
+        return -1;
+    }
+
+    // a segment written again to the tile in the same color is removed
+    uint64_t a = (uint64_t) q[0] << 16 | q[1];
+    uint64_t b = (uint64_t) q[2] << 16 | q[3];
+    struct tiles_recent recent = { a < b ? a << 32 | b : b << 32 | a, (uint32_t) (tile - self->all), { color[0], color[1], color[2] } };
+    uint64_t h = recent.segment ^ (uint64_t) recent.tile << 40 ^ (uint64_t) color[0] << 8 ^ (uint64_t) color[1] << 24 ^ (uint64_t) color[2] << 48;
+    h *= 0x9E3779B97F4A7C15ULL;
+    struct tiles_recent *entry = &self->recent[h >> 32 & (TILES_RECENT - 1)];
+    if (entry->segment == recent.segment && entry->tile == recent.tile && memcmp(entry->color, color, sizeof(entry->color)) == 0) {
+        return 0;
+    }
+    *entry = recent;
+
+    unsigned char record[16];
+    size_t n = 0;
+    if (memcmp(tile->color, color, sizeof(tile->color)) != 0) {
+        record[n++] = TILES_OP_COLOR;
+        for (size_t i = 0; i < 3; ++i) {
+            record[n++] = color[i] & 0xFF;
+            record[n++] = color[i] >> 8;
+        }
+        memcpy(tile->color, color, sizeof(tile->color));
+    }
+    record[n++] = TILES_OP_SEGMENT;
+    for (size_t i = 0; i < 4; ++i) {
+        record[n++] = q[i] & 0xFF;
+        record[n++] = q[i] >> 8;
+    }
+    if (!tiles_append(self, tile, record, n)) {
+        return -1;
+    }
+    tile->segments++;
+
+    if (self->buffered > TILES_MEMORY) {
+        return tiles_write_all(self);
+    }
+    return 0;
+}
+
+/**
+ * intern function to clip a segment to a square (Liang-Barsky)
+ * @param s the segment : x1, y1, x2, y2
+ * @param origin the smallest x and y of the square
+ * @param size the side of the square
+ * @param clipped the part of the segment in the square
+ * @return false if the segment does not cross the square
+ */
+static bool tiles_clip(const double *s, const double *origin, double size, double *clipped) {
+    double d[2] = { s[2] - s[0], s[3] - s[1] };
+    double t0 = 0.0;
+    double t1 = 1.0;
+    for (size_t axis = 0; axis < 2; ++axis) {
+        double low = origin[axis] - s[axis];
+        double high = origin[axis] + size - s[axis];
+        if (d[axis] == 0) {
+            if (low > 0 || high < 0) {
+                return false;
+            }
+            continue;
+        }
+        double a = low / d[axis];
+        double b = high / d[axis];
+        t0 = fmax(t0, fmin(a, b));
+        t1 = fmin(t1, fmax(a, b));
+    }
+    if (t0 > t1) {
+        return false;
+    }
+    clipped[0] = s[0] + t0 * d[0];
+    clipped[1] = s[1] + t0 * d[1];
+    clipped[2] = s[0] + t1 * d[0];
+    clipped[3] = s[1] + t1 * d[1];
+    return true;
+}
+
+/**
+ * intern function to add a segment to a tile and to its children
+ * @param self the pyramid
+ * @param level the level of the tile
+ * @param x the column of the tile
+ * @param y the row of the tile
+ * @param s the segment : x1, y1, x2, y2
+ * @param color the color of the segment
+ * @return 0 on success
+ */
+static int tiles_add(struct tiles_pyramid *self, size_t level, uint32_t x, uint32_t y, const double *s, const uint16_t *color) {
+    double size = ldexp(self->size, -(int) level);
+    double origin[2] = { self->x0 + x * size, self->y0 + y * size };
+    double clipped[4];
+    if (!tiles_clip(s, origin, size, clipped)) {
+        return 0;
+    }
+    if (tiles_put(self, level, x, y, origin, size, clipped, color) != 0) {
+        return -1;
+    }
+    if (level + 1 < self->tiles->levels) {
+        for (uint32_t i = 0; i < 4; ++i) {
+            if (tiles_add(self, level + 1, 2 * x + (i & 1), 2 * y + (i >> 1), clipped, color) != 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * intern function to compare two tiles by level, row and column
+ */
+static int tiles_compare(const void *a, const void *b) {
+    const struct tiles_tile *ta = a;
+    const struct tiles_tile *tb = b;
+    if (ta->level != tb->level) {
+        return ta->level < tb->level ? -1 : 1;
+    }
+    if (ta->y != tb->y) {
+        return ta->y < tb->y ? -1 : 1;
+    }
+    return ta->x < tb->x ? -1 : ta->x > tb->x;
+}
+
+/**
+ * intern function to write the index of the tiles
+ * @param self the pyramid, its tiles are sorted
+ * @return 0 on success
+ */
+static int tiles_index(struct tiles_pyramid *self) {
+    char path[TILES_PATH_MAX];
+    snprintf(path, sizeof(path), "%s/index", self->tiles->dir);
+    FILE *index = fopen(path, "w");
+    if (!index) {
+        perror(path);
+        return -1;
+    }
+    fprintf(index, "turtle-tiles %d\n", TILES_VERSION);
+    fprintf(index, "square %.17g %.17g %.17g\n", self->x0, self->y0, self->size);
+    fprintf(index, "levels %zu\n", self->tiles->levels);
+    fprintf(index, "grid %d\n", TILES_GRID);
+    for (size_t i = 0; i < self->count; ++i) {
+        const struct tiles_tile *tile = &self->all[i];
+        fprintf(index, "tile %zu %" PRIu32 " %" PRIu32 " %" PRIu64 "\n", tile->level, tile->x, tile->y, tile->segments);
+    }
+    if (fclose(index) != 0) {
+        fprintf(stderr, "Error : the index '%s' could not be written\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * intern function to read the spilled segments back and give them to the tiles
+ * @param self the pyramid
+ * @param chunk a buffer of TILES_CHUNK segments
+ * @return 0 on success
+ */
+static int tiles_build(struct tiles_pyramid *self, struct tiles_segment *chunk) {
+    FILE *spill = self->tiles->spill;
+    rewind(spill);
+    size_t n;
+    while ((n = fread(chunk, sizeof(struct tiles_segment), TILES_CHUNK, spill)) > 0) {
+        for (size_t i = 0; i < n; ++i) {
+            double s[4] = { chunk[i].x1, chunk[i].y1, chunk[i].x2, chunk[i].y2 };
+            if (tiles_add(self, 0, 0, 0, s, chunk[i].color) != 0) {
+                return -1;
+            }
+        }
+    }
+    return ferror(spill) ? -1 : 0;
+}
+
+/**
+ * write the tiles and the index, then release the segments
+ * @param self the export
+ * @param output the output of the context, it gets back its encoder
+ * @return 0 on success
+ */
+int tiles_close(struct tiles *self, struct output *output) {
+    output->sink = NULL;
+    tiles_spill(self);
+
+    struct tiles_pyramid pyramid;
+    memset(&pyramid, 0, sizeof(struct tiles_pyramid));
+    pyramid.tiles = self;
+    pyramid.tableSize = 512;
+    pyramid.table = malloc(pyramid.tableSize * sizeof(size_t));
+    pyramid.recent = malloc(TILES_RECENT * sizeof(struct tiles_recent));
+
+    // the square around the drawing, a little larger to keep its sides in the tiles
+    if (self->segments) {
+        double side = fmax(self->max[0] - self->min[0], self->max[1] - self->min[1]);
+        pyramid.x0 = self->min[0];
+        pyramid.y0 = self->min[1];
+        pyramid.size = side > 0 ? side * (1 + 1e-9) : 1.0;
+    } else {
+        pyramid.size = 1.0;
+    }
+
+    int ret = 0;
+    if (self->failed || !pyramid.table || !pyramid.recent) {
+        fprintf(stderr, "Error : the segments could not be spilled to a temporary file\n");
+        ret = -1;
+    } else {
+        for (size_t i = 0; i < pyramid.tableSize; ++i) {
+            pyramid.table[i] = SIZE_MAX;
+        }
+        for (size_t i = 0; i < TILES_RECENT; ++i) {
+            pyramid.recent[i].tile = UINT32_MAX;
+        }
+        if (tiles_build(&pyramid, self->chunk) != 0 || tiles_write_all(&pyramid) != 0) {
+            fprintf(stderr, "Error : the tiles could not be written\n");
+            ret = -1;
+        } else {
+            qsort(pyramid.all, pyramid.count, sizeof(struct tiles_tile), tiles_compare);
+            ret = tiles_index(&pyramid);
+        }
+    }
+    if (ret == 0) {
+        fprintf(stderr, "tiles : %" PRIu64 " segments in %zu tiles of %zu levels", self->segments, pyramid.count, self->levels);
+        if (self->skipped) {
+            fprintf(stderr, ", %" PRIu64 " segments too far skipped", self->skipped);
+        }
+        fprintf(stderr, "\n");
+    }
+
+    for (size_t i = 0; i < pyramid.count; ++i) {
+        free(pyramid.all[i].buffer);
+    }
+    free(pyramid.all);
+    free(pyramid.table);
+    free(pyramid.recent);
+    free(self->chunk);
+    fclose(self->spill);
+    return ret;
+}
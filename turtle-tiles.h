@@ -0,0 +1,97 @@
+#ifndef TURTLE_TILES_H
+#define TURTLE_TILES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "turtle-output.h"
+
+// default and maximum number of zoom levels of the pyramid
+#define TILES_LEVELS_DEFAULT 6
+#define TILES_LEVELS_MAX 12
+
+// grid steps of the side of a tile, and pixels of the side of a tile, to simplify
+#define TILES_GRID 4096
+#define TILES_PIXELS 256
+
+// segments written to the tiles which are remembered, to remove them when they come again
+#define TILES_RECENT (1 << 19)
+
+// segments written at once to the spill file, during the evaluation
+#define TILES_CHUNK 65536
+
+// bytes of the tile buffers before they are appended to their files
+#define TILES_MEMORY (64 << 20)
+
+// the tile files start with the magic and the version
+#define TILES_MAGIC "TTOT"
+#define TILES_VERSION 1
+
+/*
+ * a tile file is "TTOT", the version byte, then the level, the column, the row
+ * and the grid as varints, then the records, each one an operation byte :
+ *   TILES_OP_SEGMENT : x1, y1, x2, y2 as 16 bits little endian, on the grid
+ *                      of the tile, from its smallest x and y
+ *   TILES_OP_COLOR   : the components r, g, b times 65535, 16 bits little endian,
+ *                      the color of the next segments (black before the first one)
+ */
+enum tiles_op {
+    TILES_OP_SEGMENT,
+    TILES_OP_COLOR,
+};
+
+// a segment of the drawing, as spilled during the evaluation
+struct tiles_segment {
+    double x1;
+    double y1;
+    double x2;
+    double y2;
+    uint16_t color[3];
+};
+
+/*
+ * export of the drawing as a pyramid of tiles : the level z has 2^z x 2^z tiles
+ * over the square around the drawing, each tile has its own file in the
+ * directory, with the segments clipped to the tile, and the file "index"
+ * gives the square and the tiles which are not empty
+ * the levels before the last one are simplified : the ends of the segments
+ * are put on the TILES_PIXELS pixels of the tile, and a segment within a pixel
+ * is removed. on every level, a segment written again to a tile in the same
+ * color is removed, as long as it is among the TILES_RECENT segments remembered
+ * the export runs out of core : during the evaluation, the segments are
+ * spilled to a temporary file, since the square is only known at the end.
+ * then they are read back by chunks and given to the tiles, whose buffers
+ * are appended to their files once they take more than TILES_MEMORY bytes
+ */
+struct tiles {
+    const char *dir;
+    size_t levels;
+
+    FILE *spill;                        // the segments of the evaluation
+    struct tiles_segment *chunk;        // the segments not spilled yet
+    size_t chunkCount;
+
+    double x;                           // position of the evaluator
+    double y;
+    uint16_t color[3];                  // color of the evaluator
+    double min[2];                      // box of the drawing
+    double max[2];
+
+    uint64_t segments;                  // segments spilled
+    uint64_t skipped;                   // segments too far or not a number
+    bool failed;                        // the spill file could not be written
+
+    struct output_sink sink;
+};
+
+// collect the segments of output to export them, instead of writing them
+// returns 0 on success
+int tiles_open(struct tiles *self, struct output *output, const char *dir, size_t levels);
+
+// write the tiles and the index to the directory, report them to stderr and
+// release the segments. returns 0 on success
+int tiles_close(struct tiles *self, struct output *output);
+
+#endif /* TURTLE_TILES_H */
@@ -0,0 +1,279 @@
+#include "turtle-watch.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "turtle-parse.h"
+
+// the state before a top-level command
+struct watch_step {
+    struct context ctx; // copy of the context before the command
+    off_t offset;       // size of the output before the command
+};
+
+// pair of nodes at the same place in two equal trees
+struct watch_twin {
+    const struct ast_node *old;
+    const struct ast_node *new;
+};
+
+struct watch {
+    const char *path;
+    FILE *out;
+
+    struct ast root;            // the last program parsed
+    struct ast_node **cmds;     // its top-level commands
+    size_t count;
+
+    struct watch_step *steps;   // steps[i] is before cmds[i], steps[count] is the end
+    size_t evaluated;           // number of steps taken by the last evaluation
+
+    struct watch_twin *twins;   // bodies of the procedures of the old tree in the new one
+    size_t twinsCount;
+    size_t twinsCapacity;
+};
+
+/**
+ * parse a program file
+ * @param path the file to parse
+ * @param root the tree to fill
+ * @return 0 on success
+ */
+static int watch_parse(const char *path, struct ast *root) {
+    return parse_path(path, 1, root);
+}
+
+/**
+ * make the array of the top-level commands of a tree
+ * @param root the tree
+ * @param count the number of commands
+ * @return the array of commands
+ */
+static struct ast_node **watch_cmds(const struct ast *root, size_t *count) {
+    size_t n = 0;
+    for (struct ast_node *curr = root->unit; curr; curr = curr->next) {
+        ++n;
+    }
+
+    struct ast_node **cmds = calloc(n + 1, sizeof(struct ast_node *));
+    assert(cmds);
+
+    n = 0;
+    for (struct ast_node *curr = root->unit; curr; curr = curr->next) {
+        cmds[n++] = curr;
+    }
+
+    *count = n;
+    return cmds;
+}
+
+static void watch_twins_list(struct watch *w, const struct ast_node *old, const struct ast_node *new);
+
+/**
+ * record the procedure bodies of a node of the old tree,
+ * with their place in the equal node of the new tree
+ * @param w the watch state
+ * @param old the node of the old tree
+ * @param new the equal node of the new tree
+ */
+static void watch_twins_node(struct watch *w, const struct ast_node *old, const struct ast_node *new) {
+    if (old->kind == KIND_CMD_PROC) {
+        if (w->twinsCount == w->twinsCapacity) {
+            w->twinsCapacity = w->twinsCapacity ? 2 * w->twinsCapacity : 16;
+            w->twins = realloc(w->twins, w->twinsCapacity * sizeof(struct watch_twin));
+            assert(w->twins);
+        }
+        w->twins[w->twinsCount].old = old->children[0];
+        w->twins[w->twinsCount].new = new->children[0];
+        w->twinsCount++;
+    }
+
+    for (size_t i = 0; i < old->children_count; ++i) {
+        watch_twins_list(w, old->children[i], new->children[i]);
+    }
+}
+
+/**
+ * record the procedure bodies of a sequence of the old tree
+ * @param w the watch state
+ * @param old the first node of the sequence in the old tree
+ * @param new the first node of the equal sequence in the new tree
+ */
+static void watch_twins_list(struct watch *w, const struct ast_node *old, const struct ast_node *new) {
+    while (old) {
+        watch_twins_node(w, old, new);
+        old = old->next;
+        new = new->next;
+    }
+}
+
+/**
+ * make the procedures of a step point to the new tree
+ * @param w the watch state
+ * @param step the step to update
+ */
+static void watch_remap(const struct watch *w, struct watch_step *step) {
+    for (struct proc_handling_node *curr = step->ctx.handlerForProc->first; curr; curr = curr->next) {
+        for (size_t i = 0; i < w->twinsCount; ++i) {
+            if (w->twins[i].old == curr->astNode) {
+                curr->astNode = (struct ast_node *) w->twins[i].new;
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * evaluate the top-level commands from the k-th one
+ * the context must be the one of steps[k]
+ * @param w the watch state
+ * @param ctx the context of the evaluation
+ * @param k the first command to evaluate
+ */
+static void watch_eval(struct watch *w, struct context *ctx, size_t k) {
+    size_t i = k;
+    for (;;) {
+        if (i > k) {
+            context_copy(&w->steps[i].ctx, ctx);
+        }
+        w->steps[i].offset = ftello(w->out);
+
+        if (i == w->count) {
+            break;
+        }
+
+        eval_cmd_single(w->cmds[i], ctx);
+        if (ctx->status != EVAL_OK) {
+            eval_error_print(ctx);
+            break;
+        }
+        ++i;
+    }
+
+    w->evaluated = i + 1;
+    fflush(w->out);
+
+    fprintf(stderr, "watch : %zu of %zu commands evaluated\n", i - k, w->count);
+}
+
+/**
+ * parse the file again and evaluate what changed
+ * @param w the watch state
+ * @param ctx the context of the evaluation
+ */
+static void watch_reload(struct watch *w, struct context *ctx) {
+    struct ast root;
+    if (watch_parse(w->path, &root) != 0) {
+        fprintf(stderr, "watch : the program is kept as it was\n");
+        return;
+    }
+
+    size_t count;
+    struct ast_node **cmds = watch_cmds(&root, &count);
+
+    // first top-level command which changed
+    size_t k = 0;
+    while (k < count && k < w->count && ast_node_equal(cmds[k], w->cmds[k])) {
+        ++k;
+    }
+    if (k == count && k == w->count) {
+        free(cmds);
+        ast_destroy(&root);
+        return;
+    }
+
+    // the commands after a failing one were not evaluated
+    if (k >= w->evaluated) {
+        k = w->evaluated - 1;
+    }
+
+    // the steps kept must not point to the old tree any more
+    w->twinsCount = 0;
+    for (size_t i = 0; i < k; ++i) {
+        watch_twins_node(w, w->cmds[i], cmds[i]);
+    }
+    for (size_t i = 0; i <= k; ++i) {
+        watch_remap(w, &w->steps[i]);
+    }
+    for (size_t i = k + 1; i < w->evaluated; ++i) {
+        ctx_handler_destroy(&w->steps[i].ctx);
+    }
+
+    free(w->cmds);
+    ast_destroy(&w->root);
+    w->root = root;
+    w->cmds = cmds;
+    w->count = count;
+
+    w->steps = realloc(w->steps, (count + 1) * sizeof(struct watch_step));
+    assert(w->steps);
+
+    // restart from the state before the k-th command
+    ctx_handler_destroy(ctx);
+    context_copy(ctx, &w->steps[k].ctx);
+
+    fflush(w->out);
+    if (ftruncate(fileno(w->out), w->steps[k].offset) != 0 || fseeko(w->out, w->steps[k].offset, SEEK_SET) != 0) {
+        perror("watch");
+    }
+
+    watch_eval(w, ctx, k);
+}
+
+/**
+ * watch mode : evaluate the program, then evaluate it again from the first
+ * changed top-level command each time the file is modified
+ * @param path the program file
+ * @param init the initial context, with the output file
+ * @return only on a startup error
+ */
+int watch_run(const char *path, const struct context *init) {
+    struct watch w;
+    memset(&w, 0, sizeof(struct watch));
+    w.path = path;
+    w.out = init->out;
+
+    if (fseeko(w.out, 0, SEEK_SET) != 0 || ftruncate(fileno(w.out), 0) != 0) {
+        fprintf(stderr, "Error : the watch mode needs a regular output file\n");
+        return EXIT_FAILURE;
+    }
+    output_header(&init->output, w.out);
+
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+
+    struct context ctx;
+    context_copy(&ctx, init);
+
+    watch_parse(path, &w.root);
+    w.cmds = watch_cmds(&w.root, &w.count);
+    w.steps = calloc(w.count + 1, sizeof(struct watch_step));
+    assert(w.steps);
+    context_copy(&w.steps[0].ctx, init);
+    watch_eval(&w, &ctx, 0);
+
+    struct timespec delay = { 0, WATCH_INTERVAL_MS * 1000000L };
+    for (;;) {
+        nanosleep(&delay, NULL);
+
+        struct stat now;
+        if (stat(path, &now) != 0) {
+            continue;
+        }
+        if (now.st_mtim.tv_sec == st.st_mtim.tv_sec && now.st_mtim.tv_nsec == st.st_mtim.tv_nsec && now.st_size == st.st_size) {
+            continue;
+        }
+
+        st = now;
+        watch_reload(&w, &ctx);
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef TURTLE_WATCH_H
+#define TURTLE_WATCH_H
+
+#include "turtle-ast.h"
+
+// interval between two checks of the program file, in milliseconds
+#define WATCH_INTERVAL_MS 100
+
+/*
+ * watch mode : evaluate the program, then re-evaluate it each time the file
+ * changes, from the first top-level command that changed only.
+ * the output of init must be a regular file, it is truncated and completed
+ * so that it always holds the output of the whole program.
+ * returns only on a startup error.
+ */
+int watch_run(const char *path, const struct context *init);
+
+#endif /* TURTLE_WATCH_H */
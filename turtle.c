@@ -1,34 +1,565 @@
 #include <assert.h>
+#include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "turtle-ast.h"
-#include "turtle-lexer.h"
-#include "turtle-parser.h"
+#include "turtle-budget.h"
+#include "turtle-checkpoint.h"
+#include "turtle-compress.h"
+#include "turtle-dedup.h"
+#include "turtle-emit.h"
+#include "turtle-estimate.h"
+#include "turtle-hoist.h"
+#include "turtle-jit.h"
+#include "turtle-optimize.h"
+#include "turtle-parse.h"
+#include "turtle-pipeline.h"
+#include "turtle-plot.h"
+#include "turtle-tiles.h"
+#include "turtle-server.h"
+#include "turtle-watch.h"
 
-int main() {
-  srand(time(NULL));
+// most threads of --threads and --parse-threads
+#define THREADS_MAX 256
 
+/**
+ * display how to use the program
+ * @param prog the name of the program
+ */
+static void usage(const char *prog) {
+  fprintf(stderr, "Usage: %s [options] [program.turtle]\n", prog);
+  fprintf(stderr, "  --max-depth N   maximum depth of nested blocks, repeats and calls (default %d)\n", EVAL_DEPTH_DEFAULT);
+  fprintf(stderr, "  --max-commands N    stop after N commands\n");
+  fprintf(stderr, "  --max-primitives N  stop after about N primitives\n");
+  fprintf(stderr, "  --max-bytes N       stop after about N bytes of primitives\n");
+  fprintf(stderr, "  --max-seconds SEC   stop the evaluation after SEC seconds\n");
+  fprintf(stderr, "  --max-ast-bytes N   do not evaluate a program whose tree takes more than N bytes\n");
+  fprintf(stderr, "  --output FILE   write the primitives to FILE instead of stdout\n");
+  fprintf(stderr, "  --watch         evaluate the program again each time its file changes (needs --output)\n");
+  fprintf(stderr, "  --seed N        seed of the random generator (default: the time)\n");
+  fprintf(stderr, "  --checkpoint FILE          save the state of the evaluation to FILE periodically\n");
+  fprintf(stderr, "  --checkpoint-interval SEC  seconds between two checkpoints (default %.0f)\n", CHECKPOINT_INTERVAL_DEFAULT);
+  fprintf(stderr, "  --resume FILE   resume the evaluation of the program from a checkpoint\n");
+  fprintf(stderr, "  --threads N     threads to format the big repeat loops without side effects (default 1)\n");
+  fprintf(stderr, "  --format FORMAT text, or binary for quantized and delta encoded primitives (default text)\n");
+  fprintf(stderr, "  --grid N        grid steps per unit of the binary format (default %d)\n", OUTPUT_GRID_DEFAULT);
+  fprintf(stderr, "  --decode        decode the binary primitives of the input file back to text\n");
+  fprintf(stderr, "  --compress      compress the primitives by independent blocks\n");
+  fprintf(stderr, "  --decompress    decompress the input file with --threads threads\n");
+  fprintf(stderr, "  --serve SOCKET  evaluate the programs sent on the UNIX socket SOCKET\n");
+  fprintf(stderr, "  --library FILE  define the procedures and variables of FILE for every request (repeatable)\n");
+  fprintf(stderr, "  --parse-threads N  threads to parse a big program file by parts (default 1)\n");
+  fprintf(stderr, "  --no-jit        interpret the expressions instead of compiling the hot ones\n");
+  fprintf(stderr, "  --no-fuse       evaluate the moves, turns and jumps one command at a time\n");
+  fprintf(stderr, "  --no-hoist      evaluate the loop-invariant expressions in every iteration of their repeat\n");
+  fprintf(stderr, "  --dump-hoist    write the loop-invariant expressions of the repeats to stderr\n");
+  fprintf(stderr, "  --optimize      remove the dead procedures and set commands, with the pen up write one MoveTo per run of moves\n");
+  fprintf(stderr, "  --pipeline      write the primitives from a second thread, the big repeat loops stay sequential\n");
+  fprintf(stderr, "  --plot FORMAT   write the drawing for a pen plotter, hpgl or gcode, ordered to shorten the moves with the pen up\n");
+  fprintf(stderr, "  --plot-scale MM millimeters per unit of the plot (default 1)\n");
+  fprintf(stderr, "  --no-reverse    the plot keeps the direction of the lines\n");
+  fprintf(stderr, "  --dedup         remove the segments drawn again and merge the collinear ones\n");
+  fprintf(stderr, "  --dedup-grid N  grid steps per unit to compare the segments (default %d)\n", DEDUP_GRID_DEFAULT);
+  fprintf(stderr, "  --tiles DIR     write the drawing to DIR as a pyramid of tiles with an index, instead of the primitives\n");
+  fprintf(stderr, "  --tile-levels N zoom levels of the pyramid, at most %d (default %d)\n", TILES_LEVELS_MAX, TILES_LEVELS_DEFAULT);
+  fprintf(stderr, "  --estimate      write the estimated number of commands, primitives and seconds instead of evaluating\n");
+  fprintf(stderr, "  --emit-c        write the program translated to C instead of evaluating it\n");
+}
+
+/**
+ * read the limit of a budget
+ * @param arg the argument of the option
+ * @param value the limit, strictly positive
+ * @return true on success
+ */
+static bool read_limit(const char *arg, uint64_t *value) {
+  char *end;
+  *value = strtoull(arg, &end, 10);
+  if (*end != '\0' || *value == 0 || arg[0] == '-') {
+    fprintf(stderr, "Error : invalid limit '%s'\n", arg);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * read a number of threads
+ * @param arg the argument of the option
+ * @param value the number of threads, between 1 and THREADS_MAX
+ * @return true on success
+ */
+static bool read_threads(const char *arg, long *value) {
+  char *end;
+  *value = strtol(arg, &end, 10);
+  if (*end != '\0' || end == arg || *value < 1 || *value > THREADS_MAX) {
+    fprintf(stderr, "Error : invalid number of threads '%s'\n", arg);
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  size_t maxDepth = EVAL_DEPTH_DEFAULT;
+  const char *input = NULL;
+  const char *output = NULL;
+  bool watch = false;
+  uint64_t seed = time(NULL);
+  const char *checkpointPath = NULL;
+  double checkpointInterval = CHECKPOINT_INTERVAL_DEFAULT;
+  const char *resume = NULL;
+  long threads = 1;
+  enum output_format format = OUTPUT_TEXT;
+  uint64_t grid = OUTPUT_GRID_DEFAULT;
+  bool decode = false;
+  bool compress = false;
+  bool decompress = false;
+  const char *serve = NULL;
+  bool emitC = false;
+  bool estimate = false;
+  bool pipelined = false;
+  bool deduplicated = false;
+  uint64_t dedupGrid = DEDUP_GRID_DEFAULT;
+  const char *tilesDir = NULL;
+  long tileLevels = TILES_LEVELS_DEFAULT;
+  bool plotted = false;
+  enum plot_format plotFormat = PLOT_HPGL;
+  double plotScale = 1.0;
+  bool plotReverse = true;
+  struct budget budget;
+  budget_create(&budget);
+  bool jit = JIT_AVAILABLE;
+  bool fuse = true;
+  bool hoist = true;
+  bool dumpHoist = false;
+  bool optimize = false;
+  long parseThreads = 1;
+  const char **libraries = calloc(argc, sizeof(const char *));
+  size_t librariesCount = 0;
+  assert(libraries);
+
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--max-depth") == 0 && i + 1 < argc) {
+      char *end;
+      maxDepth = strtoul(argv[++i], &end, 10);
+      if (*end != '\0' || maxDepth == 0) {
+        fprintf(stderr, "Error : invalid maximum depth '%s'\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "--max-commands") == 0 && i + 1 < argc) {
+      if (!read_limit(argv[++i], &budget.commands)) {
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "--max-primitives") == 0 && i + 1 < argc) {
+      if (!read_limit(argv[++i], &budget.primitives)) {
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "--max-bytes") == 0 && i + 1 < argc) {
+      if (!read_limit(argv[++i], &budget.bytes)) {
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "--max-seconds") == 0 && i + 1 < argc) {
+      char *end;
+      budget.seconds = strtod(argv[++i], &end);
+      if (*end != '\0' || !(budget.seconds > 0)) {
+        fprintf(stderr, "Error : invalid limit '%s'\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "--max-ast-bytes") == 0 && i + 1 < argc) {
+      if (!read_limit(argv[++i], &budget.astBytes)) {
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    } else if (strcmp(argv[i], "--watch") == 0) {
+      watch = true;
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      char *end;
+      seed = strtoull(argv[++i], &end, 10);
+      if (*end != '\0' || end == argv[i] || argv[i][0] == '-') {
+        fprintf(stderr, "Error : invalid seed '%s'\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+      checkpointPath = argv[++i];
+    } else if (strcmp(argv[i], "--checkpoint-interval") == 0 && i + 1 < argc) {
+      char *end;
+      checkpointInterval = strtod(argv[++i], &end);
+      if (*end != '\0' || !(checkpointInterval > 0) || isinf(checkpointInterval)) {
+        fprintf(stderr, "Error : invalid checkpoint interval '%s'\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "--resume") == 0 && i + 1 < argc) {
+      resume = argv[++i];
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      if (!read_threads(argv[++i], &threads)) {
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+      ++i;
+      if (strcmp(argv[i], "text") == 0) {
+        format = OUTPUT_TEXT;
+      } else if (strcmp(argv[i], "binary") == 0) {
+        format = OUTPUT_BINARY;
+      } else {
+        fprintf(stderr, "Error : unknown output format '%s'\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "--grid") == 0 && i + 1 < argc) {
+      char *end;
+      grid = strtoull(argv[++i], &end, 10);
+      if (*end != '\0' || grid == 0) {
+        fprintf(stderr, "Error : invalid grid '%s'\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "--decode") == 0) {
+      decode = true;
+    } else if (strcmp(argv[i], "--compress") == 0) {
+      compress = true;
+    } else if (strcmp(argv[i], "--decompress") == 0) {
+      decompress = true;
+    } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+      serve = argv[++i];
+    } else if (strcmp(argv[i], "--library") == 0 && i + 1 < argc) {
+      libraries[librariesCount++] = argv[++i];
+    } else if (strcmp(argv[i], "--no-jit") == 0) {
+      jit = false;
+    } else if (strcmp(argv[i], "--parse-threads") == 0 && i + 1 < argc) {
+      if (!read_threads(argv[++i], &parseThreads)) {
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "--no-fuse") == 0) {
+      fuse = false;
+    } else if (strcmp(argv[i], "--no-hoist") == 0) {
+      hoist = false;
+    } else if (strcmp(argv[i], "--dump-hoist") == 0) {
+      dumpHoist = true;
+    } else if (strcmp(argv[i], "--optimize") == 0) {
+      optimize = true;
+    } else if (strcmp(argv[i], "--pipeline") == 0) {
+      pipelined = true;
+    } else if (strcmp(argv[i], "--dedup") == 0) {
+      deduplicated = true;
+    } else if (strcmp(argv[i], "--dedup-grid") == 0 && i + 1 < argc) {
+      char *end;
+      dedupGrid = strtoull(argv[++i], &end, 10);
+      if (*end != '\0' || dedupGrid == 0) {
+        fprintf(stderr, "Error : invalid grid '%s'\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "--tiles") == 0 && i + 1 < argc) {
+      tilesDir = argv[++i];
+    } else if (strcmp(argv[i], "--tile-levels") == 0 && i + 1 < argc) {
+      char *end;
+      tileLevels = strtol(argv[++i], &end, 10);
+      if (*end != '\0' || tileLevels < 1 || tileLevels > TILES_LEVELS_MAX) {
+        fprintf(stderr, "Error : invalid number of levels '%s'\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "--plot") == 0 && i + 1 < argc) {
+      ++i;
+      plotted = true;
+      if (strcmp(argv[i], "hpgl") == 0) {
+        plotFormat = PLOT_HPGL;
+      } else if (strcmp(argv[i], "gcode") == 0) {
+        plotFormat = PLOT_GCODE;
+      } else {
+        fprintf(stderr, "Error : unknown plot format '%s'\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "--plot-scale") == 0 && i + 1 < argc) {
+      char *end;
+      plotScale = strtod(argv[++i], &end);
+      if (*end != '\0' || !(plotScale > 0) || !isfinite(plotScale)) {
+        fprintf(stderr, "Error : invalid plot scale '%s'\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "--no-reverse") == 0) {
+      plotReverse = false;
+    } else if (strcmp(argv[i], "--estimate") == 0) {
+      estimate = true;
+    } else if (strcmp(argv[i], "--emit-c") == 0) {
+      emitC = true;
+    } else if (argv[i][0] != '-' && input == NULL) {
+      input = argv[i];
+    } else {
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (watch && (input == NULL || output == NULL)) {
+    fprintf(stderr, "Error : the watch mode needs a program file and --output\n");
+    return EXIT_FAILURE;
+  }
+  if (watch && (checkpointPath || resume)) {
+    fprintf(stderr, "Error : the watch mode does not use checkpoints\n");
+    return EXIT_FAILURE;
+  }
+
+  if (compress && (watch || checkpointPath || resume)) {
+    fprintf(stderr, "Error : the compressed output can not be used with the watch mode or checkpoints\n");
+    return EXIT_FAILURE;
+  }
+
+  bool budgeted = budget_limited(&budget) || budget.astBytes;
+  if (budgeted && watch) {
+    fprintf(stderr, "Error : the watch mode does not use budgets\n");
+    return EXIT_FAILURE;
+  }
+  if (pipelined && budget.bytes) {
+    fprintf(stderr, "Error : the pipelined output can not be used with --max-bytes\n");
+    return EXIT_FAILURE;
+  }
+
+  if (pipelined && (watch || checkpointPath || resume)) {
+    fprintf(stderr, "Error : the pipelined output can not be used with the watch mode or checkpoints\n");
+    return EXIT_FAILURE;
+  }
+
+  if (tilesDir && (output || budget.bytes || format != OUTPUT_TEXT || compress || pipelined || deduplicated || plotted)) {
+    fprintf(stderr, "Error : the tiles can not be used with --output, --max-bytes, --format binary, --compress, --pipeline, --dedup or --plot\n");
+    return EXIT_FAILURE;
+  }
+  if (tilesDir && (watch || checkpointPath || resume)) {
+    fprintf(stderr, "Error : the tiles can not be used with the watch mode or checkpoints\n");
+    return EXIT_FAILURE;
+  }
+
+  if (deduplicated && (budget.bytes || pipelined || plotted)) {
+    fprintf(stderr, "Error : the deduplication can not be used with --max-bytes, --pipeline or --plot\n");
+    return EXIT_FAILURE;
+  }
+  if (deduplicated && (watch || checkpointPath || resume)) {
+    fprintf(stderr, "Error : the deduplication can not be used with the watch mode or checkpoints\n");
+    return EXIT_FAILURE;
+  }
+
+  if (plotted && (budget.bytes || format != OUTPUT_TEXT || pipelined)) {
+    fprintf(stderr, "Error : the plot can not be used with --max-bytes, --format binary or --pipeline\n");
+    return EXIT_FAILURE;
+  }
+  if (plotted && (watch || checkpointPath || resume)) {
+    fprintf(stderr, "Error : the plot can not be used with the watch mode or checkpoints\n");
+    return EXIT_FAILURE;
+  }
+
+  if (optimize && watch) {
+    fprintf(stderr, "Error : the watch mode does not optimize the program\n");
+    return EXIT_FAILURE;
+  }
+
+  if (estimate && (emitC || optimize || plotted || deduplicated || tilesDir || budgeted || pipelined || watch || checkpointPath || resume || format != OUTPUT_TEXT || compress || serve)) {
+    fprintf(stderr, "Error : the estimate only takes --output\n");
+    return EXIT_FAILURE;
+  }
+
+  if (emitC && (optimize || plotted || deduplicated || tilesDir || budgeted || pipelined || watch || checkpointPath || resume || format != OUTPUT_TEXT || compress || serve)) {
+    fprintf(stderr, "Error : the translation to C only takes --output\n");
+    return EXIT_FAILURE;
+  }
+
+  if (decode || decompress) {
+    FILE *in = input ? fopen(input, "rb") : stdin;
+    FILE *out = output ? fopen(output, "w") : stdout;
+    if (in == NULL || out == NULL) {
+      perror(in == NULL ? input : output);
+      return EXIT_FAILURE;
+    }
+    int ret = decode ? output_decode(in, out) : decompress_file(in, out, threads > 1 ? threads : 1);
+    fclose(in);
+    fclose(out);
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  if (serve && (input || output || watch || checkpointPath || resume || format != OUTPUT_TEXT || compress || pipelined || optimize || plotted || deduplicated || tilesDir)) {
+    fprintf(stderr, "Error : the server mode only takes --library, --seed, --threads, --max-depth, the budgets, --no-jit, --no-fuse and --no-hoist\n");
+    return EXIT_FAILURE;
+  }
+
+  struct context ctx;
+  context_create(&ctx);
+  ctx.stack.maxDepth = maxDepth;
+  ctx.seed = seed;
+  ctx.threads = threads > 1 ? threads : 1;
+  ctx.jit = jit;
+  ctx.fuse = fuse;
+  ctx.hoist = hoist;
+  output_create(&ctx.output, format, grid);
+
+  if (output && !resume) {
+    ctx.out = fopen(output, watch ? "w+" : "w");
+    if (ctx.out == NULL) {
+      perror(output);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (budgeted) {
+    ctx.budget = &budget;
+  }
+
+  if (serve) {
+    return server_run(serve, libraries, librariesCount, &ctx);
+  }
+  free(libraries);
+
+  if (watch) {
+    return watch_run(input, &ctx);
+  }
+
+  // the primitives go through the compression thread
+  struct compress compressor;
+  FILE *file = ctx.out;
+  if (compress) {
+    ctx.out = compress_open(&compressor, file);
+    if (ctx.out == NULL) {
+      return EXIT_FAILURE;
+    }
+  }
+
+  // a program file is mapped in memory, stdin is read through stdio
   struct ast root;
-  int ret = yyparse(&root);
+  int ret = input ? parse_path(input, parseThreads, &root) : parse_file(stdin, &root);
 
+  if (ret < 0) {
+    return EXIT_FAILURE;
+  }
   if (ret != 0) {
     return ret;
   }
 
-  yylex_destroy();
-
   assert(root.unit);
 
-  struct context ctx;
-  context_create(&ctx);
+  if (optimize) {
+    ast_optimize(&root);
+  }
+
+  if (dumpHoist) {
+    hoist_dump(root.unit);
+  }
+
+  if (estimate) {
+    ret = estimate_print(&root, ctx.out) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    ast_destroy(&root);
+    ctx_handler_destroy(&ctx);
+    if (output) {
+      fclose(ctx.out);
+    }
+    return ret;
+  }
+
+  if (emitC) {
+    ret = emit_c(&root, ctx.out) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    ast_destroy(&root);
+    ctx_handler_destroy(&ctx);
+    if (output) {
+      fclose(ctx.out);
+    }
+    return ret;
+  }
+
+  if (budget_check_ast(&budget, &root, &ctx) != 0) {
+    eval_error_print(&ctx);
+    return ctx.status;
+  }
+
+  struct checkpoint checkpoint;
+  checkpoint_create(&checkpoint, &root, checkpointPath, checkpointInterval);
+  if (checkpointPath) {
+    ctx.checkpoint = &checkpoint;
+  }
+
+  if (resume) {
+    // the output goes on from where the checkpoint was written
+    int64_t offset;
+    if (checkpoint_restore(&checkpoint, resume, &ctx, &offset) != 0) {
+      return EXIT_FAILURE;
+    }
+    if (output) {
+      ctx.out = fopen(output, offset >= 0 ? "r+" : "w");
+      if (ctx.out == NULL || (offset >= 0 && (ftruncate(fileno(ctx.out), offset) != 0 || fseeko(ctx.out, offset, SEEK_SET) != 0))) {
+        perror(output);
+        return EXIT_FAILURE;
+      }
+    }
+  }
 
-  ast_eval(&root, &ctx);
+  if (!resume) {
+    output_header(&ctx.output, ctx.out);
+  }
+
+  // the primitives go through the writer thread
+  struct pipeline pipeline;
+  if (pipelined && pipeline_open(&pipeline, &ctx.output, ctx.out) != 0) {
+    fprintf(stderr, "Error : the writer thread could not be started\n");
+    return EXIT_FAILURE;
+  }
+
+  // the segments go through the deduplication
+  struct dedup dedup;
+  if (deduplicated && dedup_open(&dedup, &ctx.output, ctx.out, dedupGrid) != 0) {
+    fprintf(stderr, "Error : the deduplication could not be started\n");
+    return EXIT_FAILURE;
+  }
+
+  // the segments are spilled to a temporary file, then cut into tiles
+  struct tiles tiles;
+  if (tilesDir && tiles_open(&tiles, &ctx.output, tilesDir, tileLevels) != 0) {
+    return EXIT_FAILURE;
+  }
+
+  // the primitives are kept as polylines until the end of the evaluation
+  struct plot plot;
+  if (plotted) {
+    plot_open(&plot, &ctx.output, plotFormat, plotScale, plotReverse);
+  }
+
+  // the budget counts from here, ctx.budget stays NULL without limits
+  ctx.budget = NULL;
+  if (budget_limited(&budget)) {
+    budget_start(&budget, &ctx);
+  }
+
+  enum eval_status status = resume ? ast_eval_resume(&ctx) : ast_eval(&root, &ctx);
   //ast_print(&root);
 
+  if (pipelined) {
+    pipeline_close(&pipeline, &ctx.output);
+  }
+  if (deduplicated) {
+    dedup_close(&dedup, &ctx.output);
+  }
+  if (tilesDir && tiles_close(&tiles, &ctx.output) != 0) {
+    ret = EXIT_FAILURE;
+  }
+  if (plotted && plot_close(&plot, &ctx.output, ctx.out) != 0) {
+    ret = EXIT_FAILURE;
+  }
+
+  if (status != EVAL_OK) {
+    eval_error_print(&ctx);
+    ret = status;
+  }
+
+  checkpoint_destroy(&checkpoint);
   ast_destroy(&root);
   ctx_handler_destroy(&ctx);
 
+  if (compress) {
+    if (compress_close(&compressor, ctx.out) != 0) {
+      fprintf(stderr, "Error : the compressed output could not be written\n");
+      ret = EXIT_FAILURE;
+    }
+    ctx.out = file;
+  }
+
+  if (output) {
+    fclose(ctx.out);
+  }
+
   return ret;
 }